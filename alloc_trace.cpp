@@ -0,0 +1,110 @@
+#include "alloc_trace.h"
+#include "gc.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+// Records are buffered and written in blocks of this many words.
+const size_t kBufferWords = 1 << 16;
+
+uint32_t address_word(const void *ptr) {
+  return (uint32_t)(uintptr_t) ptr;
+}
+
+}  // namespace
+
+AllocTrace::AllocTrace(const std::string &path, int heap_size_in_words,
+                       int roots_interval_words)
+    : roots_interval_words(roots_interval_words) {
+  out = fopen(path.c_str(), "wb");
+  if (out == NULL) {
+    throw std::runtime_error("Cannot write the allocation trace '" + path +
+                             "'.");
+  }
+  buffer.reserve(kBufferWords);
+  buffer.insert(buffer.end(), {kAllocTraceMagic, kAllocTraceVersion,
+                               (uint32_t) sizeof(intptr_t),
+                               (uint32_t) heap_size_in_words,
+                               (uint32_t) roots_interval_words});
+  // The pointer stores are recorded by write_barrier
+  __atomic_fetch_add(&write_barrier_active, 1, __ATOMIC_RELAXED);
+}
+
+AllocTrace::~AllocTrace() {
+  __atomic_fetch_sub(&write_barrier_active, 1, __ATOMIC_RELAXED);
+  Flush();
+  fclose(out);
+}
+
+void AllocTrace::RecordAlloc(intptr_t *obj_ptr, int32_t num_words,
+                             uint32_t tag, void *site,
+                             intptr_t *base_frame_ptr,
+                             intptr_t *curr_frame_ptr, bool collected) {
+  flush_pending_alloc();
+
+  words_since_roots += num_words + 1;
+  if (collected) {
+    record_roots(base_frame_ptr, curr_frame_ptr, RootsReason::Collection);
+  } else if (words_since_roots >= roots_interval_words) {
+    record_roots(base_frame_ptr, curr_frame_ptr, RootsReason::Interval);
+  }
+
+  uint32_t record[4] = {
+      (uint32_t) TraceRecord::Alloc | (uint32_t) num_words << 8,
+      address_word(obj_ptr), tag, address_word(site)};
+  if (tag != 0) {
+    buffer.insert(buffer.end(), record, record + 4);
+    if (buffer.size() >= kBufferWords) write_buffer();
+  } else {
+    pending_obj = obj_ptr;
+    std::copy(record, record + 4, pending_record);
+  }
+}
+
+void AllocTrace::RecordStore(intptr_t *slot, intptr_t *value) {
+  flush_pending_alloc();
+  buffer.insert(buffer.end(), {(uint32_t) TraceRecord::Store,
+                               address_word(slot), address_word(value)});
+  if (buffer.size() >= kBufferWords) write_buffer();
+}
+
+bool AllocTrace::Flush() {
+  flush_pending_alloc();
+  write_buffer();
+  if (fflush(out) != 0) write_failed = true;
+  return !write_failed;
+}
+
+void AllocTrace::flush_pending_alloc() {
+  if (pending_obj == NULL) return;
+  pending_record[2] = (uint32_t) *(pending_obj - 1);
+  buffer.insert(buffer.end(), pending_record, pending_record + 4);
+  pending_obj = NULL;
+  if (buffer.size() >= kBufferWords) write_buffer();
+}
+
+void AllocTrace::record_roots(intptr_t *base_frame_ptr,
+                              intptr_t *curr_frame_ptr, RootsReason reason) {
+  words_since_roots = 0;
+  buffer.push_back((uint32_t) TraceRecord::Roots | (uint32_t) reason << 8);
+  size_t num_roots_index = buffer.size();
+  buffer.push_back(0);
+
+  FrameLayout::ForEachRootSlot(
+      curr_frame_ptr, base_frame_ptr, [&](intptr_t *slot) {
+        if (*slot != 0) buffer.push_back(address_word((void*) *slot));
+      });
+
+  buffer[num_roots_index] = buffer.size() - num_roots_index - 1;
+  if (buffer.size() >= kBufferWords) write_buffer();
+}
+
+void AllocTrace::write_buffer() {
+  if (!buffer.empty() &&
+      fwrite(buffer.data(), 4, buffer.size(), out) != buffer.size()) {
+    write_failed = true;
+  }
+  buffer.clear();
+}
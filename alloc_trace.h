@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Allocation traces record what a program does to the heap, so that
+// collector policies and heap sizes can be compared offline with
+// build/gc_simulator instead of by rerunning the program.
+//
+// A trace is a flat sequence of little-endian 32-bit words, a header followed
+// by records until the end of the file:
+//
+//   header: 'L2AT' magic, version, bytes per word, heap size of the
+//           recording run in words, roots interval in words
+//   alloc:  kind | number of fields << 8, object address, header word,
+//           allocation site (return address of the call to 'allocate',
+//           'allocate_typed', 'allocate_atomic' or 'allocate_weak')
+//   store:  kind, field address, stored pointer
+//   roots:  kind | RootsReason << 8, num_roots, num_roots x object address
+//
+// Addresses are truncated to 32 bits, which only matters for 64-bit hosts.
+// Objects are identified by their address, which is only unique until the
+// object is freed, so traces can only be recorded with collectors that do not
+// move objects. Only stores of pointers into objects are recorded, the stack
+// is recorded by roots records instead: one after every collection of the
+// recording run, and one whenever the program has allocated the roots
+// interval since the last. Only non-nil roots are recorded.
+
+const uint32_t kAllocTraceMagic = 0x5441324c;  // "L2AT"
+const uint32_t kAllocTraceVersion = 1;
+
+// Kind of a record, in the low 8 bits of its first word.
+enum class TraceRecord : uint32_t {
+  Alloc = 1,
+  Store = 2,
+  Roots = 3,
+};
+
+// Why a roots record was written.
+enum class RootsReason : uint32_t {
+  Interval = 0,
+  Collection = 1,
+};
+
+// Writes the trace of one runtime context.
+class AllocTrace {
+ public:
+  // Creates the trace file 'path' for a heap of 'heap_size_in_words' words.
+  // Throws std::runtime_error if it cannot be created. While a trace is
+  // open the compiled programs call write_barrier for every pointer store.
+  AllocTrace(const std::string &path, int heap_size_in_words,
+             int roots_interval_words);
+
+  // Writes the buffered records and closes the file.
+  ~AllocTrace();
+
+  AllocTrace(const AllocTrace&) = delete;
+  AllocTrace& operator=(const AllocTrace&) = delete;
+
+  // Records the allocation of the object 'obj_ptr' with 'num_words' fields
+  // and the header word 'tag' at 'site', preceded by the roots of the stack
+  // from 'curr_frame_ptr' to 'base_frame_ptr' if the allocation 'collected'
+  // or the roots interval is over. If 'tag' is 0 the header word is read
+  // when the next record is written, after the program has stored it.
+  void RecordAlloc(intptr_t *obj_ptr, int32_t num_words, uint32_t tag,
+                   void *site, intptr_t *base_frame_ptr,
+                   intptr_t *curr_frame_ptr, bool collected);
+
+  // Records the store of 'value' into the heap field 'slot'.
+  void RecordStore(intptr_t *slot, intptr_t *value);
+
+  // Writes the buffered records. Returns false if anything written to the
+  // file so far could not be written.
+  bool Flush();
+
+ private:
+  FILE *out;
+  bool write_failed = false;
+  std::vector<uint32_t> buffer;
+
+  // The last allocated object, whose record waits for its header word
+  intptr_t *pending_obj = NULL;
+  uint32_t pending_record[4];
+
+  int roots_interval_words;
+  int words_since_roots = 0;
+
+  void flush_pending_alloc();
+  void record_roots(intptr_t *base_frame_ptr, intptr_t *curr_frame_ptr,
+                    RootsReason reason);
+  void write_buffer();
+};
@@ -34,8 +34,20 @@ struct L final : public Operand {
   }
 };
 
+// address of a label, as a constant
+struct A final : public Operand {
+  std::string value;
+
+  A(std::string v) : value(std::move(v)) {}
+
+  const std::string toString() const override {
+    return '$' + value;
+  }
+};
+
 // pre-defined registers
 static const R EAX{"eax"};
+static const R ECX{"ecx"};
 static const R EDX{"edx"};
 static const R ESP{"esp"};
 static const R EBP{"ebp"};
@@ -78,6 +90,18 @@ struct O final : public Operand {
   }
 };
 
+// register relative to the address of a symbol
+struct S final : public Operand {
+  std::string symbol;
+  R reg;
+
+  S(std::string symbol, R reg) : symbol(std::move(symbol)), reg(reg) {}
+
+  const std::string toString() const override {
+    return symbol + "(" + reg.toString() + ")";
+  }
+};
+
 // Helper functions for producing assembly code
 
 // overload for nullary case
@@ -196,9 +220,19 @@ CodeGen::TmpVar CodeGen::freshTmp() {
 
 std::vector<std::string> CodeGen::generateCode(const Program & program) {
   // reset instructions, label counter, symbol table, etc.
-  insns = {"  .extern allocate"};
+  insns = {"  .extern allocate_typed", "  .extern allocate_atomic",
+           "  .extern allocate_weak", "  .extern read_barrier",
+           "  .extern read_barrier_active", "  .extern write_barrier",
+           "  .extern write_barrier_active", "  .extern card_table",
+           "  .extern card_marking_active", "  .extern heap_image_restore",
+           "  .extern heap_image_save", "  .extern spawn_thread",
+           "  .extern join_thread", "  .extern safepoint",
+           "  .extern safepoint_requested"};
   nextIndex = 0;
   symbolTable = {};
+  checkpointCall = nullptr;
+  mainBlock = nullptr;
+  functionNames.clear();
   inTopLevelScope = true;
   // actual code gen
   VisitProgramExpr(program);
@@ -217,14 +251,25 @@ void CodeGen::VisitNewExpr(const NewExpr& exp) {
   }
 
   auto size = static_cast<int32_t>(typeInfo->second.fields.size());
-  // call allocate(int32_t size)
+  // call allocate_typed(uint32_t tag), the runtime sets up the tag or, if
+  // the collector keeps the layout of the object elsewhere, leaves it out.
+  // Structs without pointer fields go through allocate_atomic instead, the
+  // collector never scans them, and structs with weak fields through
+  // allocate_weak(uint32_t tag, uint32_t weak_bits).
   insns.push_back("  // ALLOCATE FOR NEW " + exp.type());
-  insns.push_back(Insn("pushl", C{size}));
-  insns.push_back(Insn("call", L{"allocate"}));
+  auto weakBits = typeInfo->second.weakBits();
+  if (weakBits != 0) {
+    insns.push_back(Insn("pushl", H{weakBits}));
+  }
+  insns.push_back(Insn("pushl", H{typeInfo->second.tag()}));
+  if (weakBits != 0) {
+    insns.push_back(Insn("call", L{"allocate_weak"}));
+  } else if (typeInfo->second.pointerFree()) {
+    insns.push_back(Insn("call", L{"allocate_atomic"}));
+  } else {
+    insns.push_back(Insn("call", L{"allocate_typed"}));
+  }
   insns.push_back(Insn("sub", C{4}, ESP));
-  insns.push_back("  // SET TAG");
-  // set up the tag
-  insns.push_back(Insn("movl", H{typeInfo->second.tag()}, O{-4, EAX}));
   insns.push_back("  // INITIALIZE FIELDS");
   // initialize fields to 0
   for (int32_t i = 0; i < size; ++i) {
@@ -261,21 +306,49 @@ void CodeGen::VisitAccessPath(const AccessPath& exp) {
   exp.root().Visit(this);
   // Dereference field addresses
   auto type = symbolTable.ctx.lookup(exp.root().name())->second;
+  bool first = true;
   for (auto field : exp.fieldAccesses()) {
     auto [offset, fieldType] = symbolTable.typeInfo[type].varInfoOf(field);
-    // dereference field address
-    insns.push_back(Insn("movl", O{0, EAX}, EAX) + " /* dereference the address at EAX */");
+    // dereference field address, the first one is the variable on the stack
+    if (first) {
+      insns.push_back(Insn("movl", O{0, EAX}, EAX) + " /* dereference the address at EAX */");
+    } else {
+      loadPointerField();
+    }
     insns.push_back(Insn("add", C{offset * 4}, EAX) + " /* load address of field ." + field + " */");
     // update the type
     type = fieldType;
+    first = false;
   }
   // Dereference the last part if we are not in lhs
   if (! inLhsOfAssignment) {
     insns.push_back("  // dereference the address because we are on rhs of an assignment");
-    insns.push_back(Insn("movl", O{0, EAX}, EAX));
+    if (!first && type != "int") {
+      loadPointerField();
+    } else {
+      insns.push_back(Insn("movl", O{0, EAX}, EAX));
+    }
   }
 }
 
+void CodeGen::loadPointerField() {
+  // The read barrier is only called while an incremental collection is
+  // running, it returns the pointer after the collector is done moving the
+  // object it points to.
+  auto n = std::to_string(freshIndex());
+  auto plainLabel = L{"READ_PLAIN_" + n};
+  auto endLabel = L{"READ_END_" + n};
+  insns.push_back(Insn("cmpl", C{0}, L{"read_barrier_active"}));
+  insns.push_back(Insn("je", plainLabel));
+  insns.push_back(Insn("pushl", EAX));
+  insns.push_back(Insn("call", L{"read_barrier"}));
+  insns.push_back(Insn("add", C{4}, ESP));
+  insns.push_back(Insn("jmp", endLabel));
+  insns.push_back(plainLabel.value + ":");
+  insns.push_back(Insn("movl", O{0, EAX}, EAX) + " /* dereference the address at EAX */");
+  insns.push_back(endLabel.value + ":");
+}
+
 void CodeGen::VisitAddExpr(const AddExpr& exp) {
   auto tmpVar = freshTmp();
   exp.lhs().Visit(this);
@@ -396,6 +469,22 @@ void CodeGen::VisitBlockStmt(const BlockStmt& exp) {
     d.Visit(this);
     insns.push_back(Insn("movl", C{0}, O{-(symbolTable.ctx.lookup(d.id().name())->first), EBP}));
   }
+  // call heap_image_restore(void *resume, int32_t num_locals), which fills
+  // the locals from the heap image and returns 1 if there is one, and go on
+  // after the checkpoint() in that case. The result of checkpoint() is the
+  // result of the call in EAX.
+  if (&exp == mainBlock && checkpointCall != nullptr) {
+    insns.push_back("  // RESTORE HEAP IMAGE");
+    insns.push_back(Insn("pushl", C{static_cast<int32_t>(exp.decls().size())}));
+    insns.push_back(Insn("pushl", A{"CHECKPOINT_RESUME"}));
+    insns.push_back(Insn("call", L{"heap_image_restore"}));
+    insns.push_back(Insn("add", C{8}, ESP));
+    insns.push_back(Insn("cmp", C{0}, EAX));
+    insns.push_back(Insn("jne", L{"CHECKPOINT_RESUME"}));
+  }
+  if (wasInTopLevelScope) {
+    pollSafepoint();
+  }
   // Generate code for the statements, note that this may create additional temporaries
   for (auto & s : exp.stmts()) {
     s->Visit(this);
@@ -434,7 +523,50 @@ void CodeGen::VisitAssignmentExpr(const Assignment& assignment) {
   //
   // move the result from the temporary to the lhs
   insns.push_back(Insn("movl", O{-(*tmpVar), EBP}, EDX));
+  if (isPointerField(assignment.lhs())) {
+    storePointerField();
+  } else {
+    insns.push_back(Insn("movl", EDX, O{0, EAX}));
+  }
+}
+
+bool CodeGen::isPointerField(const AccessPath& path) {
+  if (path.fieldAccesses().empty()) {
+    // a variable on the stack
+    return false;
+  }
+  auto type = symbolTable.ctx.lookup(path.root().name())->second;
+  for (auto field : path.fieldAccesses()) {
+    type = symbolTable.typeInfo[type].varInfoOf(field).second;
+  }
+  return type != "int";
+}
+
+void CodeGen::storePointerField() {
+  auto n = std::to_string(freshIndex());
+  auto plainLabel = L{"WRITE_PLAIN_" + n};
+  auto endLabel = L{"WRITE_END_" + n};
+  auto cleanLabel = L{"WRITE_CARD_CLEAN_" + n};
+  // Dirty the card of the field, 512 bytes per card (see card_table in
+  // gc.cpp), while a generational collector is in use
+  insns.push_back(Insn("cmpl", C{0}, L{"card_marking_active"}));
+  insns.push_back(Insn("je", cleanLabel));
+  insns.push_back(Insn("movl", EAX, ECX));
+  insns.push_back(Insn("shrl", C{9}, ECX));
+  insns.push_back(Insn("movb", C{1}, S{"card_table", ECX}));
+  insns.push_back(cleanLabel.value + ":");
+  // The write barrier is only called when a reference-counting collector
+  // is in use, it updates the counts of both the new and the old value.
+  insns.push_back(Insn("cmpl", C{0}, L{"write_barrier_active"}));
+  insns.push_back(Insn("je", plainLabel));
+  insns.push_back(Insn("pushl", EDX));
+  insns.push_back(Insn("pushl", EAX));
+  insns.push_back(Insn("call", L{"write_barrier"}));
+  insns.push_back(Insn("add", C{8}, ESP));
+  insns.push_back(Insn("jmp", endLabel));
+  insns.push_back(plainLabel.value + ":");
   insns.push_back(Insn("movl", EDX, O{0, EAX}));
+  insns.push_back(endLabel.value + ":");
 }
 
 void CodeGen::VisitConditionalExpr(const Conditional& conditional) {
@@ -459,11 +591,35 @@ void CodeGen::VisitLoopExpr(const Loop& loop) {
   insns.push_back(Insn("cmp", C{0}, EAX));
   insns.push_back(Insn("je", endLabel));
   loop.body().Visit(this);
+  pollSafepoint();
   insns.push_back(Insn("jmp", startLabel));
   insns.push_back(endLabel.value + ":");
 }
 
+bool CodeGen::isCheckpoint(const FunctionCall& call) {
+  return call.callee_name() == "checkpoint" && symbolTable.fnInfo.count("checkpoint") == 0;
+}
+
 void CodeGen::VisitFunctionCallExpr(const FunctionCall& call) {
+  if (isCheckpoint(call)) {
+    if (&call != checkpointCall) {
+      throw CodeGenError { "checkpoint() can only be called by a statement of the program's main block" };
+    }
+    if (!call.arguments().empty()) {
+      throw CodeGenError { "The function checkpoint expects 0 arguments but " + std::to_string(call.arguments().size()) + " arguments are given" };
+    }
+    // call heap_image_save(void *resume, int32_t num_locals), which writes
+    // the locals of the main block and the objects they reach, returns 0
+    auto numLocals = static_cast<int32_t>(mainBlock->decls().size());
+    insns.push_back("  // CHECKPOINT");
+    insns.push_back(Insn("pushl", C{numLocals}));
+    insns.push_back(Insn("pushl", A{"CHECKPOINT_RESUME"}));
+    insns.push_back(Insn("call", L{"heap_image_save"}));
+    insns.push_back(Insn("add", C{8}, ESP));
+    insns.push_back("CHECKPOINT_RESUME:");
+    return;
+  }
+
   // check if the arities match
   auto arity = symbolTable.getArity(call.callee_name());
   if (arity != call.arguments().size()) {
@@ -493,6 +649,68 @@ void CodeGen::VisitFunctionCallExpr(const FunctionCall& call) {
   symbolTable.ctx.nextOffset -= stackSpace;
 }
 
+void CodeGen::VisitSpawnExpr(const Spawn& spawn) {
+  auto & call = spawn.call();
+  auto fn = symbolTable.fnInfo.find(call.callee_name());
+  if (fn == symbolTable.fnInfo.end()) {
+    throw CodeGenError {"Trying to spawn undefined function " + call.callee_name()};
+  }
+  auto & argTypes = fn->second.argTypes;
+  if (argTypes.size() != call.arguments().size()) {
+    throw CodeGenError { std::string("The function ") + call.callee_name() + " expects " + std::to_string(argTypes.size()) + " arguments but " + std::to_string(call.arguments().size()) + " arguments are given" };
+  }
+  // The thread may end before it is joined, its result must not point into
+  // the heap then
+  if (fn->second.retType != "int") {
+    throw CodeGenError {"Only functions that return int can be spawned, " + call.callee_name() + " returns " + fn->second.retType};
+  }
+  if (argTypes.size() > kMaxSpawnArgs) {
+    throw CodeGenError {"Spawned functions take at most " + std::to_string(kMaxSpawnArgs) + " arguments"};
+  }
+
+  // the runtime keeps the pointer arguments alive until the thread starts
+  uint32_t argInfo = 0;
+  for (size_t i = 0; i < argTypes.size(); ++i) {
+    if (argTypes[i] != "int") {
+      argInfo |= 1 << i;
+    }
+  }
+
+  insns.push_back("  // SPAWN " + call.callee_name());
+  auto stackSpace = static_cast<int32_t>(call.arguments().size() * 4);
+  for (auto arg = call.arguments().rbegin(), end = call.arguments().rend(); arg != end; ++arg) {
+    (*arg)->Visit(this);
+    insns.push_back(Insn("push", EAX));
+    symbolTable.ctx.nextOffset += 4;
+  }
+
+  // call spawn_thread(function, int32_t num_args, uint32_t arg_info, args...),
+  // which returns the handle of the thread
+  insns.push_back(Insn("pushl", H{argInfo}));
+  insns.push_back(Insn("pushl", C{static_cast<int32_t>(argTypes.size())}));
+  insns.push_back(Insn("pushl", A{call.callee_name()}));
+  insns.push_back(Insn("call", L{"spawn_thread"}));
+  insns.push_back(Insn("add", C{stackSpace + 12}, ESP));
+  symbolTable.ctx.nextOffset -= stackSpace;
+}
+
+void CodeGen::VisitJoinExpr(const Join& join) {
+  // call join_thread(int32_t thread), which returns the result of the thread
+  join.thread().Visit(this);
+  insns.push_back("  // JOIN");
+  insns.push_back(Insn("push", EAX));
+  insns.push_back(Insn("call", L{"join_thread"}));
+  insns.push_back(Insn("add", C{4}, ESP));
+}
+
+void CodeGen::pollSafepoint() {
+  auto skipLabel = L{"SAFEPOINT_" + std::to_string(freshIndex())};
+  insns.push_back(Insn("cmpl", C{0}, L{"safepoint_requested"}));
+  insns.push_back(Insn("je", skipLabel));
+  insns.push_back(Insn("call", L{"safepoint"}));
+  insns.push_back(skipLabel.value + ":");
+}
+
 void CodeGen::VisitFunctionDefExpr(const FunctionDef& def) {
   uint32_t argInfo = 0;
   size_t i = 0;
@@ -513,6 +731,12 @@ void CodeGen::VisitFunctionDefExpr(const FunctionDef& def) {
   }
 
   symbolTable.resetLocalsInfo();
+  // Hosts call the function through '<entry>_<name>', which cannot clash
+  // with the functions of other programs since L2 names have no '_'
+  std::string exportedName = entryName + "_" + def.function_name();
+  insns.push_back("  .globl " + exportedName);
+  insns.push_back("  .type " + exportedName + ", @function");
+  insns.push_back(exportedName + ":");
   insns.push_back(def.function_name() + ":");
   // prologue
   insns.push_back("  // FUNCTION PROLOGUE");
@@ -557,7 +781,9 @@ void CodeGen::VisitFunctionDefExpr(const FunctionDef& def) {
   insns.push_back(Insn("ret"));
   // end epilogue
   insns.push_back("  // END OF " + def.function_name());
+  insns.push_back("FUNCTION_END_" + def.function_name() + ":");
   insns.push_back("");
+  functionNames.push_back(def.function_name());
 
   // remove parameters from current context
   symbolTable.closeScope();
@@ -570,12 +796,16 @@ void CodeGen::VisitTypeDef(const TypeDef& def) {
   }
   
   std::vector<std::pair<std::string, std::string>> fields;
+  std::vector<std::string> weakFields;
 
   for (auto & decl : def.fields()) {
     fields.push_back({decl.id().name(), decl.type().name()});
+    if (decl.isWeak()) {
+      weakFields.push_back(decl.id().name());
+    }
   }
   
-  symbolTable.typeInfo.emplace(std::string(def.type_name()), TypeInfo{std::string(def.type_name()), std::move(fields)});
+  symbolTable.typeInfo.emplace(std::string(def.type_name()), TypeInfo{std::string(def.type_name()), std::move(fields), std::move(weakFields)});
 }
 
 void CodeGen::VisitProgramExpr(const Program& program) {
@@ -589,6 +819,22 @@ void CodeGen::VisitProgramExpr(const Program& program) {
     symbolTable.addFnDef(*fnDef);
   }
 
+  // find the checkpoint() of the main block, there is at most one
+  mainBlock = &program.statements();
+  for (const auto & stmt : program.statements().stmts()) {
+    auto assignment = dynamic_cast<const Assignment*>(stmt.get());
+    if (assignment == nullptr) {
+      continue;
+    }
+    auto call = dynamic_cast<const FunctionCall*>(&assignment->rhs());
+    if (call != nullptr && isCheckpoint(*call)) {
+      if (checkpointCall != nullptr) {
+        throw CodeGenError { "checkpoint() can only be called once" };
+      }
+      checkpointCall = call;
+    }
+  }
+
   // generate definitions
   for (const auto & fnDef : program.function_defs()) {
     fnDef->Visit(this);
@@ -603,9 +849,9 @@ void CodeGen::VisitProgramExpr(const Program& program) {
     ++i;
   }
 
-  insns.push_back("  .globl Entry");
-  insns.push_back("  .type Entry, @function");
-  insns.push_back("Entry:");
+  insns.push_back("  .globl " + entryName);
+  insns.push_back("  .type " + entryName + ", @function");
+  insns.push_back(entryName + ":");
   //program entry prologue
   insns.push_back("  // BOOTSTRAP ENTRY");
   insns.push_back(Insn("push", EBP));
@@ -628,6 +874,25 @@ void CodeGen::VisitProgramExpr(const Program& program) {
   insns.push_back(Insn("movl", EBP, ESP));
   insns.push_back(Insn("pop", EBP));
   insns.push_back(Insn("ret"));
+  insns.push_back("FUNCTION_END_" + entryName + ":");
+  functionNames.push_back(entryName);
+
+  emitFunctionTable();
+}
+
+void CodeGen::emitFunctionTable() {
+  insns.push_back("");
+  insns.push_back("  // FUNCTION TABLE");
+  insns.push_back("  .section l2_functions, \"aw\"");
+  for (const auto & name : functionNames) {
+    insns.push_back("  .long " + name + ", FUNCTION_END_" + name + ", FUNCTION_NAME_" + name);
+  }
+  insns.push_back("  .section .rodata");
+  for (const auto & name : functionNames) {
+    insns.push_back("FUNCTION_NAME_" + name + ":");
+    insns.push_back("  .string \"" + name + "\"");
+  }
+  insns.push_back("  .text");
 }
 
 }  // namespace cs160::backend
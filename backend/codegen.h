@@ -4,6 +4,7 @@
 #include "frontend/ast_visitor.h"
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include <memory>
 #include <unordered_map>
@@ -42,6 +43,8 @@ struct TypeInfo {
   const std::string name;
   // Fields are represented as pairs of variables and types
   const std::vector<std::pair<std::string, std::string>> fields;
+  // Names of the weak fields
+  const std::vector<std::string> weakFields;
 
   int32_t offsetOf(std::string const & field) const {
     return varInfoOf(field).first;
@@ -61,11 +64,34 @@ struct TypeInfo {
     throw std::logic_error { std::string("Field ") + field + " is not found in struct " + name };
   }
 
+  bool isWeak(std::string const & field) const {
+    return std::find(weakFields.begin(), weakFields.end(), field) != weakFields.end();
+  }
+
+  // Whether no field is a pointer, so that the GC never has to scan the
+  // fields of the objects
+  bool pointerFree() const {
+    return (tag() & 0x00FFFFFE) == 0 && weakBits() == 0;
+  }
+
+  // Compute the bits of the weak fields, laid out like the pointer bits of
+  // the tag. Weak fields are left out of the tag, so the GC only finds them
+  // through these bits.
+  uint32_t weakBits() const {
+    uint32_t bits = 0;
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (isWeak(fields[i].first)) {
+        bits |= 1 << (i + 1);
+      }
+    }
+    return bits;
+  }
+
   // Compute the tag needed by GC
   uint32_t tag() const {
     auto tag = (uint32_t)fields.size() << 24;
     for (size_t i = 0; i < fields.size(); ++i) {
-      if (fields[i].second != "int") {
+      if (fields[i].second != "int" && !isWeak(fields[i].first)) {
         // the field is a pointer set the relevant bit in tag
         tag |= 1 << (i + 1);
       }
@@ -105,9 +131,18 @@ struct SymbolTable {
   void closeScope();
 };
 
+// Most arguments a function started with 'spawn' can take, see spawn_thread
+// in runtime.cpp
+const size_t kMaxSpawnArgs = 8;
+
 // The code generator is implemented as an AST visitor that will generate the relevant pieces of code as it traverses a node
 class CodeGen final : public AstVisitor {
  public:
+  // 'entryName' is the global symbol of the program's entry point. Programs
+  // linked into the same executable need different names. Every function
+  // 'f' of the program is exported as '<entryName>_f' for hosts.
+  explicit CodeGen(std::string entryName = "Entry") : entryName(std::move(entryName)) {}
+
   // Entry point of the code generator. This function should visit given program and return generated code as a list of instructions and labels.
   std::vector<std::string> generateCode(const Program & program);
 
@@ -133,6 +168,8 @@ class CodeGen final : public AstVisitor {
   void VisitConditionalExpr(const Conditional& conditional) override;
   void VisitLoopExpr(const Loop& loop) override;
   void VisitFunctionCallExpr(const FunctionCall& call) override;
+  void VisitSpawnExpr(const Spawn& spawn) override;
+  void VisitJoinExpr(const Join& join) override;
   void VisitFunctionDefExpr(const FunctionDef& def) override;
   void VisitTypeDef(const TypeDef& def) override;
   void VisitProgramExpr(const Program& program) override;
@@ -140,6 +177,9 @@ class CodeGen final : public AstVisitor {
  private:
   // Implementation details, remove in student solution
 
+  // Symbol of the program's entry point
+  std::string entryName;
+
   // Next index for label generation
   uint32_t nextIndex = 0;
   
@@ -147,6 +187,41 @@ class CodeGen final : public AstVisitor {
     return nextIndex++;
   }
 
+  // Loads the pointer stored in the heap field whose address is in EAX into
+  // EAX, through the collector's read barrier
+  void loadPointerField();
+
+  // Calls 'safepoint' if another thread of the program is waiting to
+  // collect. Emitted where the stack holds no temporaries: at the start of
+  // function bodies, after their locals are cleared, and at loop back-edges.
+  void pollSafepoint();
+
+  // Whether the access path ends at a pointer field of a heap object
+  bool isPointerField(const AccessPath& path);
+
+  // Functions generated so far, the entry point last. Every function ends
+  // at the label FUNCTION_END_<name>.
+  std::vector<std::string> functionNames;
+
+  // Emits the table of the generated functions into the l2_functions
+  // section, one entry of start address, end address and name per function.
+  // The profiler maps return addresses to functions with it, see profiler.h.
+  void emitFunctionTable();
+
+  // Stores EDX into the pointer field of a heap object whose address is in
+  // EAX, through the collector's write barrier
+  void storePointerField();
+
+  // The call to the built-in checkpoint() in the program's main block, if
+  // any, and that block. The statements before the call are skipped when
+  // the runtime restores a heap image instead.
+  const FunctionCall *checkpointCall = nullptr;
+  const BlockStmt *mainBlock = nullptr;
+
+  // Whether 'call' calls the built-in checkpoint(), which a function of the
+  // program can hide
+  bool isCheckpoint(const FunctionCall& call);
+
   // Whether we are currently generating left hand-side of an
   // assignment. This flag is used for keeping the address for an
   // access path.
@@ -5,7 +5,130 @@
 #include "frontend/lexer.h"
 #include "backend/codegen.h"
 
+#include <algorithm>
+#include <regex>
+
 using namespace cs160::frontend;
 using Catch::Matchers::Equals;
 using Catch::Matchers::Message;
+using namespace cs160::backend;
+
+// Generates the code of the L2 program 'source'. The numbers of the labels
+// are replaced by N, so that the code can be compared with a sequence that
+// does not depend on how many labels came before.
+std::vector<std::string> generate(const std::string & source) {
+  auto ast = Parser{Lexer{}.tokenize(source)}.parse();
+  auto insns = CodeGen{}.generateCode(*ast);
+  std::regex labelNumber{"([A-Z]_)[0-9]+"};
+  for (auto & insn : insns) {
+    insn = std::regex_replace(insn, labelNumber, "$1N");
+  }
+  return insns;
+}
+
+// Whether 'expected' appears in 'insns' as consecutive lines
+bool containsSequence(const std::vector<std::string> & insns,
+                      const std::vector<std::string> & expected) {
+  return std::search(insns.begin(), insns.end(), expected.begin(),
+                     expected.end()) != insns.end();
+}
+
+const std::string nodeProgram =
+    "struct %node { int value; %node next; };\n"
+    "def count(%node n, int k) : int { return k; }\n";
+
+const std::vector<std::string> safepointPoll = {
+    "  cmpl $0, safepoint_requested",
+    "  je SAFEPOINT_N",
+    "  call safepoint",
+    "SAFEPOINT_N:",
+};
+
+TEST_CASE("Safepoint polls", "[codegen]") {
+  auto insns = generate(
+      "int i; i := 0; while (i < 3) { i := i + 1; } output i;");
+
+  // at the start of the main block and at the back-edge of the loop
+  auto backEdge = safepointPoll;
+  backEdge.push_back("  jmp WHILE_START_N");
+  CHECK(containsSequence(insns, backEdge));
+  CHECK(std::count(insns.begin(), insns.end(), safepointPoll[0]) == 2);
+}
+
+TEST_CASE("Barriers on pointer fields", "[codegen]") {
+  auto pointerStore = generate(nodeProgram +
+      "%node n; n := new %node; n.next := n; output 0;");
+  CHECK(containsSequence(pointerStore, {
+      "  cmpl $0, card_marking_active",
+      "  je WRITE_CARD_CLEAN_N",
+      "  movl %eax, %ecx",
+      "  shrl $9, %ecx",
+      "  movb $1, card_table(%ecx)",
+      "WRITE_CARD_CLEAN_N:",
+      "  cmpl $0, write_barrier_active",
+      "  je WRITE_PLAIN_N",
+      "  pushl %edx",
+      "  pushl %eax",
+      "  call write_barrier",
+      "  add $8, %esp",
+      "  jmp WRITE_END_N",
+      "WRITE_PLAIN_N:",
+      "  movl %edx, 0(%eax)",
+      "WRITE_END_N:",
+  }));
+
+  // a store into an int field is a plain store
+  auto intStore = generate(nodeProgram +
+      "%node n; n := new %node; n.value := 1; output 0;");
+  auto usesBarrier = [](const std::string & insn) {
+    return insn.find(".extern") == std::string::npos &&
+           (insn.find("card_") != std::string::npos ||
+            insn.find("write_barrier") != std::string::npos);
+  };
+  CHECK(std::none_of(intStore.begin(), intStore.end(), usesBarrier));
+  CHECK(containsSequence(intStore, {
+      "  add $0, %eax /* load address of field .value */",
+      "  movl -16(%ebp), %edx",
+      "  movl %edx, 0(%eax)",
+  }));
+
+  auto pointerLoad = generate(nodeProgram +
+      "%node n; n := new %node; n := n.next; output 0;");
+  CHECK(containsSequence(pointerLoad, {
+      "  cmpl $0, read_barrier_active",
+      "  je READ_PLAIN_N",
+      "  pushl %eax",
+      "  call read_barrier",
+      "  add $4, %esp",
+      "  jmp READ_END_N",
+      "READ_PLAIN_N:",
+      "  movl 0(%eax), %eax /* dereference the address at EAX */",
+      "READ_END_N:",
+  }));
+}
+
+TEST_CASE("Spawn and join", "[codegen]") {
+  auto insns = generate(nodeProgram +
+      "%node n; int t; n := new %node; t := spawn count(n, 5);"
+      "t := join t; output t;");
+
+  // the arguments are pushed last to first, then the argument info with
+  // the pointer argument 0, the number of arguments and the function
+  CHECK(containsSequence(insns, {
+      "  pushl $0x00000001",
+      "  pushl $2",
+      "  pushl $count",
+      "  call spawn_thread",
+      "  add $20, %esp",
+  }));
+  CHECK(containsSequence(insns, {
+      "  // JOIN",
+      "  push %eax",
+      "  call join_thread",
+      "  add $4, %esp",
+  }));
 
+  CHECK_THROWS_AS(generate(nodeProgram +
+      "def link(%node n) : %node { return n; }\n"
+      "%node n; int t; t := spawn link(n); output 0;"), CodeGenError);
+}
@@ -0,0 +1,331 @@
+// Microbenchmarks that drive the collectors' Alloc directly from C++. The
+// L2 call stack is imitated with frames laid out the way the code generator
+// lays them out, so collector changes can be measured without compiling,
+// assembling or linking any L2 code.
+//
+// For every collector, object graph shape and live-set size it reports the
+// cost of an allocation, the average and longest pause, and the pause time of
+// a collection per MB of live data.
+#include "gc.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The collectors report their statistics here after each collection, the
+// benchmark reads Gc::Stats instead.
+void ReportGCStats(size_t liveObjects, size_t liveWords) {}
+
+namespace {
+
+// A chain of L2 stack frames with pointer locals. Every frame looks like
+//
+//   fp[1]       return address
+//   fp[0]       saved frame pointer of the caller
+//   fp[-1]      argument info word
+//   fp[-2]      local info word
+//   fp[-3 - i]  local i
+//
+// The locals of all frames together are the roots of the benchmark.
+class FakeStack {
+ public:
+  FakeStack(int num_frames, int roots_per_frame)
+      : words((num_frames + 1) * (roots_per_frame + 4) + 8, 0) {
+    base = &words[words.size() - 4];
+    top = base;
+    uint32_t local_info = (uint32_t) ((1ull << roots_per_frame) - 1);
+
+    for (int f = 0; f < num_frames; f++) {
+      intptr_t *fp = top - (roots_per_frame + 4);
+      fp[0] = (intptr_t) top;
+      fp[-1] = 0;
+      fp[-2] = local_info;
+      for (int i = 0; i < roots_per_frame; i++) {
+        roots.push_back(fp - 3 - i);
+      }
+      top = fp;
+    }
+  }
+
+  // Frame pointer of the frame below the L2 frames, passed to the collector.
+  intptr_t *base_frame_ptr() { return base; }
+  // Frame pointer of the innermost frame, passed to Alloc.
+  intptr_t *top_frame_ptr() { return top; }
+
+  intptr_t *&root(size_t i) { return *(intptr_t**) roots[i]; }
+  size_t num_roots() const { return roots.size(); }
+
+  void clear_roots() {
+    for (auto slot : roots) *slot = 0;
+  }
+
+ private:
+  std::vector<intptr_t> words;
+  intptr_t *base, *top;
+  std::vector<intptr_t*> roots;
+};
+
+// Header word for a struct with 'num_fields' fields, the same encoding as
+// TypeInfo::tag() in the code generator.
+uint32_t tag(int num_fields, uint32_t pointer_fields) {
+  return (uint32_t) num_fields << 24 | pointer_fields << 1 | 1;
+}
+
+// Whether structs without pointer fields are allocated with AllocAtomic, as
+// the code generator does
+bool use_alloc_atomic = true;
+
+intptr_t *new_object(Gc &gc, FakeStack &stack, int num_fields,
+                     uint32_t pointer_fields) {
+  intptr_t *obj =
+      pointer_fields == 0 && use_alloc_atomic
+          ? gc.AllocAtomic(tag(num_fields, 0), stack.top_frame_ptr())
+          : gc.AllocTyped(tag(num_fields, pointer_fields),
+                          stack.top_frame_ptr());
+  memset(obj, 0, num_fields * sizeof(intptr_t));
+  return obj;
+}
+
+uint32_t xorshift(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Builds a live object graph of about 'live_words' words reachable from the
+// roots of 'stack' and returns the number of words actually allocated. The
+// heap must be large enough that no collection happens while building, since
+// the pointers held here are not roots. Every object is linked into the graph
+// as soon as it is allocated, through the write barrier, so that the
+// reference-counting collector can collect while building.
+//
+//  list:  one linked list per root of { int value; ptr next; } nodes
+//  tree:  a complete binary tree of { ptr left; ptr right; int value; }
+//  graph: a 4-ary tree of { ptr c0..c3; ptr cross; int value; } where every
+//         node also points to a random node, so tracing jumps around the heap
+//  boxes: one linked list per root of { ptr next; ptr box; } nodes, where
+//         every box is a pointer-free { int x; int y; int z; }
+size_t build_shape(const std::string &shape, Gc &gc, FakeStack &stack,
+                   size_t live_words) {
+  size_t allocated = 0;
+
+  if (shape == "list") {
+    size_t num_nodes = live_words / 3;
+    std::vector<intptr_t*> tails(stack.num_roots(), NULL);
+    for (size_t i = 0; i < num_nodes; i++) {
+      size_t r = i % stack.num_roots();
+      intptr_t *node = new_object(gc, stack, 2, 0x2);
+      node[0] = i;
+      if (tails[r] == NULL) stack.root(r) = node;
+      else gc.WriteBarrier(&tails[r][1], node);
+      tails[r] = node;
+      allocated += 3;
+    }
+  } else if (shape == "tree") {
+    size_t num_nodes = live_words / 4;
+    std::vector<intptr_t*> nodes;
+    for (size_t i = 0; i < num_nodes; i++) {
+      nodes.push_back(new_object(gc, stack, 3, 0x3));
+      nodes.back()[2] = i;
+      if (i == 0) stack.root(0) = nodes[0];
+      else gc.WriteBarrier(&nodes[(i - 1) / 2][(i - 1) % 2], nodes[i]);
+      allocated += 4;
+    }
+  } else if (shape == "graph") {
+    size_t num_nodes = live_words / 7;
+    std::vector<intptr_t*> nodes;
+    uint32_t seed = 2463534242u;
+    for (size_t i = 0; i < num_nodes; i++) {
+      nodes.push_back(new_object(gc, stack, 6, 0x1f));
+      nodes.back()[5] = i;
+      if (i == 0) stack.root(0) = nodes[0];
+      else gc.WriteBarrier(&nodes[(i - 1) / 4][(i - 1) % 4], nodes[i]);
+      allocated += 7;
+    }
+    for (size_t i = 0; i < num_nodes; i++) {
+      gc.WriteBarrier(&nodes[i][4], nodes[xorshift(seed) % num_nodes]);
+    }
+  } else if (shape == "boxes") {
+    size_t num_nodes = live_words / 7;
+    std::vector<intptr_t*> tails(stack.num_roots(), NULL);
+    for (size_t i = 0; i < num_nodes; i++) {
+      size_t r = i % stack.num_roots();
+      intptr_t *node = new_object(gc, stack, 2, 0x3);
+      if (tails[r] == NULL) stack.root(r) = node;
+      else gc.WriteBarrier(&tails[r][0], node);
+      tails[r] = node;
+      intptr_t *box = new_object(gc, stack, 3, 0);
+      box[0] = i;
+      gc.WriteBarrier(&node[1], box);
+      allocated += 7;
+    }
+  } else {
+    fprintf(stderr, "Unknown shape '%s'\n", shape.c_str());
+    exit(1);
+  }
+
+  return allocated;
+}
+
+Gc *make_collector(const std::string &collector, intptr_t *base_frame_ptr,
+                   int heap_words, bool huge_pages, int num_threads,
+                   bool concurrent_sweep, bool generational,
+                   int incremental_scan_words) {
+  if (collector == "semispace") {
+    return new GcSemiSpace(base_frame_ptr, heap_words, huge_pages,
+                           incremental_scan_words);
+  } else if (collector == "marksweep") {
+    return new GcMarkSweep(base_frame_ptr, heap_words, huge_pages,
+                           num_threads, concurrent_sweep, generational);
+  } else if (collector == "refcount") {
+    return new GcRefCount(base_frame_ptr, heap_words, huge_pages);
+  } else if (collector == "bibop") {
+    return new GcBibop(base_frame_ptr, heap_words, huge_pages);
+  } else if (collector == "hybrid") {
+    return new GcHybrid(base_frame_ptr, heap_words, huge_pages);
+  }
+  fprintf(stderr, "Unknown collector '%s'\n", collector.c_str());
+  exit(1);
+}
+
+// Builds the live set, then allocates short-lived 2-field objects until
+// 'min_collections' collections have happened with the live set in place.
+void run(const std::string &collector, const std::string &shape,
+         size_t live_words, size_t min_collections, bool huge_pages,
+         int num_threads, bool concurrent_sweep, bool generational,
+         int incremental_scan_words) {
+  FakeStack stack(/*num_frames=*/4, /*roots_per_frame=*/8);
+  // four times the live set gives the semispace collector one live set worth
+  // of garbage per collection and the mark-sweep collector three
+  int heap_words = (int) (live_words * 4 + 4096) & ~1;
+  Gc *gc = make_collector(collector, stack.base_frame_ptr(), heap_words,
+                          huge_pages, num_threads, concurrent_sweep,
+                          generational,
+                          incremental_scan_words);
+
+  size_t allocated = build_shape(shape, *gc, stack, live_words);
+  GcStats before = gc->Stats();
+
+  size_t num_allocs = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (gc->Stats().num_collections - before.num_collections
+         < min_collections) {
+    new_object(*gc, stack, 2, 0x2);
+    num_allocs++;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  GcStats after = gc->Stats();
+  size_t collections = after.num_collections - before.num_collections;
+  double total_ns = std::chrono::duration<double, std::nano>(end - start).count();
+  size_t pauses = after.num_pauses - before.num_pauses;
+  double pause_ns = after.total_pause_ns - before.total_pause_ns;
+  double live_mb = allocated * sizeof(intptr_t) / (1024.0 * 1024.0);
+
+  printf("%-10s %-6s %10zu %10zu %12.1f %12.1f %10zu %12.3f %12.3f %14.3f "
+         "%-7s %10zu\n",
+         collector.c_str(), shape.c_str(), allocated, num_allocs,
+         total_ns / num_allocs, (total_ns - pause_ns) / num_allocs,
+         collections, pause_ns / pauses / 1e6,
+         (after.max_pause_ns) / 1e6, pause_ns / collections / 1e6 / live_mb,
+         gc->PagesName(), gc->HugePageBytes() / 1024);
+
+  delete gc;
+}
+
+std::vector<std::string> split(const std::string &list) {
+  std::vector<std::string> items;
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) end = list.size();
+    if (end > start) items.push_back(list.substr(start, end - start));
+    start = end + 1;
+  }
+  return items;
+}
+
+void usage(const char *program_name) {
+  fprintf(stderr,
+          "Usage: %s [--collector semispace,marksweep,refcount,bibop,hybrid]\n"
+          "          [--shape list,tree,graph,boxes]\n"
+          "          [--live WORDS,...] [--collections N] [--threads N]\n"
+          "          [--concurrent-sweep] [--generational] [--incremental WORDS]\n"
+          "          [--huge-pages] [--no-atomic]\n\n"
+          "Runs every combination of the given collectors, object graph shapes "
+          "and live-set sizes in words.\n"
+          "--threads sets the number of marking and sweeping threads of the\n"
+          "mark-sweep collector, --concurrent-sweep makes it sweep in the\n"
+          "background, --generational makes it collect young objects\n"
+          "separately, --incremental makes the semispace collector copy\n"
+          "incrementally, scanning WORDS words per allocation,\n"
+          "--huge-pages backs the heaps with huge pages when available, and\n"
+          "--no-atomic allocates the structs without pointers with\n"
+          "AllocTyped instead of AllocAtomic.\n",
+          program_name);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> collectors = {"semispace", "marksweep", "refcount",
+                                         "bibop", "hybrid"};
+  std::vector<std::string> shapes = {"list", "tree", "graph"};
+  std::vector<std::string> live_sizes = {"10000", "100000", "1000000"};
+  size_t min_collections = 5;
+  bool huge_pages = false;
+  int num_threads = 1;
+  bool concurrent_sweep = false;
+  bool generational = false;
+  int incremental_scan_words = 0;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--huge-pages") {
+      huge_pages = true;
+    } else if (arg == "--no-atomic") {
+      use_alloc_atomic = false;
+    } else if (arg == "--concurrent-sweep") {
+      concurrent_sweep = true;
+    } else if (arg == "--generational") {
+      generational = true;
+    } else if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 1;
+    } else if (arg == "--collector") {
+      collectors = split(argv[++i]);
+    } else if (arg == "--shape") {
+      shapes = split(argv[++i]);
+    } else if (arg == "--live") {
+      live_sizes = split(argv[++i]);
+    } else if (arg == "--collections") {
+      min_collections = atoi(argv[++i]);
+    } else if (arg == "--threads") {
+      num_threads = atoi(argv[++i]);
+    } else if (arg == "--incremental") {
+      incremental_scan_words = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  printf("%-10s %-6s %10s %10s %12s %12s %10s %12s %12s %14s %-7s %10s\n",
+         "collector", "shape", "live_words", "allocs", "alloc_ns/op",
+         "mutator_ns", "gcs", "avg_pause_ms", "max_pause_ms", "pause_ms/MB",
+         "pages", "huge_kb");
+  for (auto &live : live_sizes) {
+    for (auto &shape : shapes) {
+      for (auto &collector : collectors) {
+        run(collector, shape, std::stoul(live), min_collections, huge_pages,
+            num_threads, concurrent_sweep, generational,
+            incremental_scan_words);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,61 @@
+#!/bin/bash
+# Builds the L2 benchmarks in bench/ and runs each of them under every
+# collector for every heap size listed on its "BENCH HEAP SIZES" line. Prints
+# one CSV row per run: wall time, number of collections and the total and
+# maximum pause reported by the runtime through L2_GC_STATS.
+#
+# COLLECTORS selects the collectors to run (default: all of them), REPEAT the
+# number of runs per configuration and BENCHMARKS the programs to run. Set
+# L2_GC_HUGE_PAGES to back the heaps with huge pages, the "pages" column shows
+# which pages were obtained.
+
+cd "$(dirname "$0")/.." || exit 1
+
+COLLECTORS=${COLLECTORS:-"marksweep semispace refcount bibop hybrid"}
+REPEAT=${REPEAT:-1}
+BENCHMARKS=${BENCHMARKS:-$(ls bench/*.l2)}
+
+mkdir -p build/bench
+echo "benchmark,collector,heap_words,status,wall_ms,collections,total_pause_ms,max_pause_ms,pages"
+
+for src in $BENCHMARKS; do
+  name=$(basename "$src" .l2)
+  exe=build/bench/$name
+  if ! ./build/c1 "$src" "$exe" > build/bench/$name.build.txt 2>&1; then
+    echo "Failed to build $src, see build/bench/$name.build.txt" >&2
+    exit 1
+  fi
+
+  sizes=$(sed -n 's|^// BENCH HEAP SIZES: *||p' "$src")
+  for gc in $COLLECTORS; do
+    for size in $sizes; do
+      for ((run = 0; run < REPEAT; run++)); do
+        start=$(date +%s%N)
+        L2_GC=$gc L2_GC_STATS=1 "$exe" "$size" > /dev/null 2> build/bench/stderr.txt
+        code=$?
+        end=$(date +%s%N)
+
+        if [ $code -eq 0 ]; then
+          status=OK
+        elif grep -q OutOfMemoryError build/bench/stderr.txt; then
+          status=OOM
+        else
+          status=FAIL
+        fi
+
+        stats=$(grep '^gc-stats:' build/bench/stderr.txt)
+        collections=$(echo "$stats" | sed -n 's|.* collections=\([0-9]*\).*|\1|p')
+        total_us=$(echo "$stats" | sed -n 's|.* total_pause_us=\([0-9]*\).*|\1|p')
+        max_us=$(echo "$stats" | sed -n 's|.* max_pause_us=\([0-9]*\).*|\1|p')
+        pages=$(echo "$stats" | sed -n 's|.* pages=\([a-z0-9]*\).*|\1|p')
+
+        awk -v name="$name" -v gc="$gc" -v size="$size" -v status="$status" \
+            -v wall_ns=$((end - start)) -v collections="$collections" \
+            -v total_us="$total_us" -v max_us="$max_us" -v pages="$pages" 'BEGIN {
+          printf "%s,%s,%s,%s,%.3f,%s,%.3f,%.3f,%s\n", name, gc, size, status,
+                 wall_ns / 1e6, collections, total_us / 1e3, max_us / 1e3, pages
+        }'
+      done
+    done
+  done
+done
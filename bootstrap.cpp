@@ -1,26 +1,51 @@
-#include "gc.h"
+#include "runtime.h"
+#include "heap_snapshot.h"
+#include "profiler.h"
 
+#include <csignal>
 #include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <stdexcept>
 
-// The runtime memory manager.
-// GcSemiSpace *gc;
-GcMarkSweep *gc;
+// Whether to print collection statistics at exit, set by L2_GC_STATS.
+bool print_gc_stats = false;
+
+// Where to write the CPU profile at exit, set by L2_PROFILE.
+const char *profile_path = NULL;
 
 // 'Entry' is the entry point of an L2 program.
 extern "C" {
 int32_t Entry(void);
 }
 
-// Define the 'allocate' function without name mangling so that it can be called
-// from L2 code.
-extern "C" intptr_t *allocate(int32_t num_words) {
-  // The current frame pointer is for allocate(), which is called from
-  // the L2 program so we dereference the frame pointer once to get
-  // the L2 program's frame pointer.
-  intptr_t* curr_frame_ptr = *(intptr_t**)__builtin_frame_address(0);
-  return gc->Alloc(num_words, curr_frame_ptr);
+// Prints the number of collections and their pause times on one line so that
+// bench/run_bench.sh can pick them up from standard error.
+void PrintGcStats(RuntimeContext &context) {
+  Gc &gc = context.GetGc();
+  const GcStats &stats = context.Stats();
+  std::cerr << "gc-stats: collector=" << gc.Name()
+            << " collections=" << stats.num_collections
+            << " minor_collections=" << stats.num_minor_collections
+            << " pauses=" << stats.num_pauses
+            << " total_pause_us=" << stats.total_pause_ns / 1000
+            << " max_pause_us=" << stats.max_pause_ns / 1000
+            << " pages=" << gc.PagesName()
+            << " huge_kb=" << gc.HugePageBytes() / 1024 << "\n";
+}
+
+// Stops the profiler, if it runs, and writes the profile.
+void WriteProfile() {
+  if (profile_path == NULL) return;
+  if (StopProfiler(profile_path)) {
+    std::cerr << "Profile written to " << profile_path << "\n";
+  } else {
+    std::cerr << "Failed to write the profile to " << profile_path << "\n";
+  }
+}
+
+void HandleSnapshotSignal(int) {
+  RequestHeapSnapshot(SnapshotReason::Signal);
 }
 
 // Called by the garbage collector after each collection to report the
@@ -37,18 +62,101 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
 
-  // Initialize the garbage collector.
+  // Heap snapshots are taken on OutOfMemoryError and on SIGUSR1.
+  if (const char *path = getenv("L2_HEAP_SNAPSHOT")) {
+    SetHeapSnapshotPath(path);
+    signal(SIGUSR1, HandleSnapshotSignal);
+  }
+
+  // Initialize the garbage collector. L2_GC selects the collector (marksweep,
+  // semispace, refcount, bibop or hybrid), mark-sweep is the default.
+  // L2_GC_HUGE_PAGES backs the heap with huge pages, L2_GC_THREADS sets the
+  // number of marking and sweeping threads, L2_GC_CONCURRENT_SWEEP moves the
+  // sweep to a background thread, L2_GC_GENERATIONAL makes it collect young
+  // objects separately and L2_GC_INCREMENTAL=N makes the semispace collector
+  // copy incrementally, scanning N words per allocation. L2_GC_TRACE records an
+  // allocation trace to the given file, with the roots recorded at least every
+  // L2_GC_TRACE_ROOTS allocated words. L2_HEAP_IMAGE names the heap image
+  // that the program's checkpoint() writes or restores. L2_PERF_COUNTERS
+  // counts hardware events of the program and of the collector and prints
+  // them at exit. L2_STACK_SIZE sets the megabytes of stack the program runs
+  // on.
+  RuntimeOptions options;
+  if (const char *collector = getenv("L2_GC")) options.collector = collector;
+  options.heap_size_in_words = atoi(argv[1]);
+  options.huge_pages = getenv("L2_GC_HUGE_PAGES") != NULL;
+  if (const char *threads = getenv("L2_GC_THREADS")) {
+    options.gc_threads = atoi(threads);
+  }
+  options.concurrent_sweep = getenv("L2_GC_CONCURRENT_SWEEP") != NULL;
+  options.generational = getenv("L2_GC_GENERATIONAL") != NULL;
+  if (const char *scan_words = getenv("L2_GC_INCREMENTAL")) {
+    options.incremental_scan_words = atoi(scan_words);
+  }
+  if (const char *trace_path = getenv("L2_GC_TRACE")) {
+    options.trace_path = trace_path;
+  }
+  if (const char *roots_words = getenv("L2_GC_TRACE_ROOTS")) {
+    options.trace_roots_interval_words = atoi(roots_words);
+  }
+  if (const char *image_path = getenv("L2_HEAP_IMAGE")) {
+    options.image_path = image_path;
+  }
+  options.perf_counters = getenv("L2_PERF_COUNTERS") != NULL;
+  options.stack_size_bytes = kDefaultProgramStackBytes;
+  if (const char *stack_size = getenv("L2_STACK_SIZE")) {
+    options.stack_size_bytes = (size_t) atoi(stack_size) << 20;
+  }
+  print_gc_stats = getenv("L2_GC_STATS") != NULL;
+
+  // L2_PROFILE samples the program's stacks L2_PROFILE_HZ times per second
+  // of CPU time and writes them to the given file as folded stacks.
+  profile_path = getenv("L2_PROFILE");
 
-  // gc = new GcSemiSpace(/*frame_ptr=*/(intptr_t *)__builtin_frame_address(0),
-  //                      /*heap_sizein_words=*/atoi(argv[1]));
+  std::unique_ptr<RuntimeContext> context;
+  try {
+    context.reset(new RuntimeContext(options));
+  } catch (std::invalid_argument &e) {
+    std::cerr << e.what() << " Set L2_GC accordingly.\n";
+    exit(1);
+  } catch (std::runtime_error &e) {
+    std::cerr << e.what() << "\n";
+    exit(1);
+  }
 
-  gc = new GcMarkSweep(/*frame_ptr=*/(intptr_t *)__builtin_frame_address(0),
-                       /*heap_sizein_words=*/atoi(argv[1]));
+  if (profile_path != NULL) {
+    int hz = kDefaultProfileHz;
+    if (const char *profile_hz = getenv("L2_PROFILE_HZ")) hz = atoi(profile_hz);
+    if (!StartProfiler(hz)) {
+      std::cerr << "Failed to start the profiler\n";
+      profile_path = NULL;
+    }
+  }
 
-  // Run the L2 program.
-  std::cout << Entry() << "\n";
+  // Run the L2 program. Running out of memory still ends the program with
+  // an uncaught OutOfMemoryError, after the statistics are printed and the
+  // profile is written.
+  int32_t result;
+  try {
+    result = context->Run(Entry);
+  } catch (OutOfMemoryError &) {
+    WriteProfile();
+    if (print_gc_stats) PrintGcStats(*context);
+    if (context->Counters()) context->Counters()->Report(std::cerr);
+    throw;
+  } catch (StackOverflowError &e) {
+    WriteProfile();
+    if (print_gc_stats) PrintGcStats(*context);
+    if (context->Counters()) context->Counters()->Report(std::cerr);
+    std::cerr << e.what() << " Set L2_STACK_SIZE to more than "
+              << context->StackSize() / (1 << 20) << " megabytes.\n";
+    return 1;
+  }
+  WriteProfile();
+  std::cout << result << "\n";
   // printf("%d\n", Entry());
 
-  delete gc;
+  if (print_gc_stats) PrintGcStats(*context);
+  if (context->Counters()) context->Counters()->Report(std::cerr);
   return 0;
 }
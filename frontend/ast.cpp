@@ -76,6 +76,12 @@ void TypeDef::Visit(AstVisitor* visitor) const {
 void FunctionCall::Visit(AstVisitor* visitor) const {
   visitor->VisitFunctionCallExpr(*this);
 }
+void Spawn::Visit(AstVisitor* visitor) const {
+  visitor->VisitSpawnExpr(*this);
+}
+void Join::Visit(AstVisitor* visitor) const {
+  visitor->VisitJoinExpr(*this);
+}
 void Program::Visit(AstVisitor* visitor) const {
   visitor->VisitProgramExpr(*this);
 }
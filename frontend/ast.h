@@ -14,18 +14,19 @@
 // lop ∈ BinaryLogicalOperator ::= && | ||
 //
 // decl ∈ Declaration ::= type id
+// field ∈ Field ::= decl | weak type id
 // type ∈ Type
 //
 // stmt ∈ Statement ::= assign | cond | loop
 // block ∈ Block ::= decl... stmt...
 //
-// assign ∈ Assignment ::= p := ae | call
+// assign ∈ Assignment ::= p := ae | call | spawn call | join ae
 // cond ∈ Conditional ::= if re block1 block2
 // loop ∈ Loop ::= while re block
 // call ∈ FunctionCall ::= id(args...)
 //
 // fundef ∈ FunctionDef ::= def id(params...) type block ae
-// typedef ∈ TypeDef ::= struct type { decl... };
+// typedef ∈ TypeDef ::= struct type { field... };
 //
 // prog ∈ Program ::= typedef... fundef... block ae
 //
@@ -346,11 +347,15 @@ class Declaration final : public AstNode {
   using Block = std::vector<Declaration>;
 
   Declaration(TypeExpr && type,
-              Variable id)
-      : type_(std::move(type)), id_(std::move(id)) {}
+              Variable id,
+              bool weak = false)
+      : type_(std::move(type)), id_(std::move(id)), weak_(weak) {}
 
   const TypeExpr& type() const { return type_; }
   const Variable& id() const { return id_; }
+  // Whether this is a struct field that does not keep the struct it points
+  // to alive. The collector sets it to nil once nothing else does.
+  bool isWeak() const { return weak_; }
 
   void Visit(AstVisitor* visitor) const override;
 
@@ -358,6 +363,7 @@ class Declaration final : public AstNode {
   // The type and id of the declaration
   const TypeExpr type_;
   const Variable id_;
+  const bool weak_;
 };
 
 // block node for both decls and stmts
@@ -546,6 +552,36 @@ class FunctionCall final : public RhsExpr {
   std::vector<std::unique_ptr<const ArithmeticExpr>> arguments_;
 };
 
+// Runs a function call on a new thread. Evaluates to a handle of the thread
+// that 'join' takes.
+class Spawn final : public RhsExpr {
+ public:
+  explicit Spawn(std::unique_ptr<const FunctionCall> call)
+      : call_(std::move(call)) {}
+
+  const FunctionCall& call() const { return *call_; }
+
+  void Visit(AstVisitor* visitor) const override;
+
+ private:
+  std::unique_ptr<const FunctionCall> call_;
+};
+
+// Waits for the thread whose handle 'thread' evaluates to and evaluates to
+// the result of its function.
+class Join final : public RhsExpr {
+ public:
+  explicit Join(std::unique_ptr<const ArithmeticExpr> thread)
+      : thread_(std::move(thread)) {}
+
+  const ArithmeticExpr& thread() const { return *thread_; }
+
+  void Visit(AstVisitor* visitor) const override;
+
+ private:
+  std::unique_ptr<const ArithmeticExpr> thread_;
+};
+
 class Program final : public AstNode {
  public:
   Program(TypeDef::Block && type_defs,
@@ -582,6 +618,8 @@ using ProgramExprP = std::unique_ptr<const Program>;
 using TypeDefP = std::unique_ptr<const TypeDef>;
 using FunctionDefP = std::unique_ptr<const FunctionDef>;
 using FunctionCallP = std::unique_ptr<const FunctionCall>;
+using SpawnExprP = std::unique_ptr<const Spawn>;
+using JoinExprP = std::unique_ptr<const Join>;
 using StatementP = std::unique_ptr<const Statement>;
 using ArithmeticExprP = std::unique_ptr<const ArithmeticExpr>;
 using ArithmeticBinaryOpExprP =
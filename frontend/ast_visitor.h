@@ -30,6 +30,8 @@ class AstVisitor {
   virtual void VisitConditionalExpr(const Conditional& conditional) = 0;
   virtual void VisitLoopExpr(const Loop& loop) = 0;
   virtual void VisitFunctionCallExpr(const FunctionCall& call) = 0;
+  virtual void VisitSpawnExpr(const Spawn& spawn) = 0;
+  virtual void VisitJoinExpr(const Join& join) = 0;
   virtual void VisitFunctionDefExpr(const FunctionDef& def) = 0;
   virtual void VisitTypeDef(const TypeDef& def) = 0;
   virtual void VisitProgramExpr(const Program& program) = 0;
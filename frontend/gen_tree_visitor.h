@@ -148,6 +148,16 @@ class genTreeVisitor : public AstVisitor {
     output_ << ")";
   }
 
+  void VisitSpawnExpr(const Spawn& exp) override {
+    output_ << "spawn ";
+    exp.call().Visit(this);
+  }
+
+  void VisitJoinExpr(const Join& exp) override {
+    output_ << "join ";
+    exp.thread().Visit(this);
+  }
+
   void VisitFunctionDefExpr(const FunctionDef& exp) override {
     output_ << "def " << exp.function_name();
     output_ << "(";
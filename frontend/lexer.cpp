@@ -404,7 +404,9 @@ struct NFAInfo {
         {";", TokenType::Semicolon},   {":=", TokenType::Assign},
         {".", TokenType::Dot},         {"new", TokenType::New},
         {"nil", TokenType::Nil},       {"struct", TokenType::Struct},
-        {":", TokenType::HasType},     {",", TokenType::Comma}};
+        {":", TokenType::HasType},     {",", TokenType::Comma},
+        {"weak", TokenType::Weak},     {"spawn", TokenType::Spawn},
+        {"join", TokenType::Join}};
 
     for (auto &[s, tokType] : keywordAndPunct) {
       // create the NFA
@@ -552,6 +554,12 @@ struct NFAInfo {
         return Token::makeNil();
       case TokenType::Struct:
         return Token::makeStruct();
+      case TokenType::Weak:
+        return Token::makeWeak();
+      case TokenType::Spawn:
+        return Token::makeSpawn();
+      case TokenType::Join:
+        return Token::makeJoin();
       default:
         throw std::logic_error{
             "Unexpected token type. This should be unreachable."};
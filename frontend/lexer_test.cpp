@@ -55,6 +55,11 @@ TEST_CASE("Single-token tests", "[lexer]") {
   CHECK_THAT(Lexer{}.tokenize("new"), Equals(std::vector{Token::makeNew()}));
   CHECK_THAT(Lexer{}.tokenize("nil"), Equals(std::vector{Token::makeNil()}));
   CHECK_THAT(Lexer{}.tokenize("struct"), Equals(std::vector{Token::makeStruct()}));
+  CHECK_THAT(Lexer{}.tokenize("weak"), Equals(std::vector{Token::makeWeak()}));
+  CHECK_THAT(Lexer{}.tokenize("weakest"), Equals(std::vector{Token::makeId("weakest")}));
+  CHECK_THAT(Lexer{}.tokenize("spawn"), Equals(std::vector{Token::makeSpawn()}));
+  CHECK_THAT(Lexer{}.tokenize("join"), Equals(std::vector{Token::makeJoin()}));
+  CHECK_THAT(Lexer{}.tokenize("joined"), Equals(std::vector{Token::makeId("joined")}));
   CHECK_THAT(Lexer{}.tokenize("%foo"), Equals(std::vector{Token::makeType("%foo")}));
   CHECK_THAT(Lexer{}.tokenize("%foo %bar42 int%Q49uux"), Equals(std::vector{
         Token::makeType("%foo"),
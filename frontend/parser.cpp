@@ -317,6 +317,20 @@ AssignmentExprP Parser::parseAssignmentExprP() {
   auto lhs = parseAccessPath();
   matchToken(TokenType::Assign);
 
+  if (nextToken() && nextToken().value().type() == TokenType::Spawn) {
+    matchToken(TokenType::Spawn);
+    auto c = parseFunCall();
+    matchToken(TokenType::Semicolon);
+    return std::make_unique<const Assignment>(
+        std::move(lhs), std::make_unique<const Spawn>(std::move(c)));
+  } else if (nextToken() && nextToken().value().type() == TokenType::Join) {
+    matchToken(TokenType::Join);
+    auto ae = parseArithmeticExpr();
+    matchToken(TokenType::Semicolon);
+    return std::make_unique<const Assignment>(
+        std::move(lhs), std::make_unique<const Join>(std::move(ae)));
+  }
+
   // the one place we do LL(2)
   if (nextToken(1) && nextToken(2) &&
       nextToken(1).value().type() == TokenType::Id &&
@@ -347,6 +361,29 @@ Declaration::Block Parser::parseDecls() {
   return ret;
 }
 
+Declaration Parser::parseFieldDecl() {
+  if (nextToken() && nextToken().value().type() == TokenType::Weak) {
+    matchToken(TokenType::Weak);
+    auto t = TypeExpr{matchToken(TokenType::Type).stringValue()};
+    if (t.isIntType()) {
+      throw InvalidASTError("only pointer fields can be weak");
+    }
+    auto id = parseVariable();
+    matchToken(TokenType::Semicolon);
+    return Declaration(std::move(t), std::move(id), /*weak=*/true);
+  }
+  return parseDeclaration();
+}
+
+Declaration::Block Parser::parseFieldDecls() {
+  Declaration::Block ret;
+  while (nextToken() && (nextToken().value().type() == TokenType::Type ||
+                         nextToken().value().type() == TokenType::Weak)) {
+    ret.push_back(parseFieldDecl());
+  }
+  return ret;
+}
+
 StatementP Parser::parseStatementP() {
   // std::cout << "Parser::parseStatementP" << std::endl;
   if (nextToken() && nextToken().value().type() == TokenType::While) {
@@ -487,7 +524,7 @@ TypeDef Parser::parseTypeDef() {
     throw InvalidASTError();
   }
   matchToken(TokenType::LBrace);
-  auto decls = parseDecls();
+  auto decls = parseFieldDecls();
   matchToken(TokenType::RBrace);
   matchToken(TokenType::Semicolon);
 
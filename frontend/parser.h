@@ -42,6 +42,8 @@ class Parser final {
 
   Declaration parseDeclaration();
   Declaration::Block parseDecls();
+  Declaration parseFieldDecl();
+  Declaration::Block parseFieldDecls();
 
   // TypeExprP parseTypeExpe();
 
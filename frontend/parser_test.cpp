@@ -219,6 +219,74 @@ TEST_CASE("Type definition test", "[parser]") {
   REQUIRE(parsed_fdef->toString() == expected_fdef.toString());
 }
 
+TEST_CASE("Weak field test", "[parser]") {
+  // struct %entry { int key; weak %entry value; }; output 0;
+  auto parsed = Parser{std::vector<Token>{
+      Token::makeStruct(),
+      Token::makeType("%entry"),
+      Token::makeLBrace(),
+      Token::makeType("int"), Token::makeId("key"), Token::makeSemicolon(),
+      Token::makeWeak(), Token::makeType("%entry"), Token::makeId("value"),
+      Token::makeSemicolon(),
+      Token::makeRBrace(), Token::makeSemicolon(),
+      Token::makeOutput(), Token::makeNum(0), Token::makeSemicolon()}}
+  .parse();
+
+  REQUIRE(parsed->type_defs().size() == 1);
+  auto & fields = parsed->type_defs()[0].fields();
+  REQUIRE(fields.size() == 2);
+  CHECK(!fields[0].isWeak());
+  CHECK(fields[1].isWeak());
+  CHECK(fields[1].type().name() == "%entry");
+
+  // only pointer fields can be weak
+  auto weakInt = std::vector<Token>{
+      Token::makeStruct(), Token::makeType("%entry"), Token::makeLBrace(),
+      Token::makeWeak(), Token::makeType("int"), Token::makeId("key"),
+      Token::makeSemicolon(),
+      Token::makeRBrace(), Token::makeSemicolon(),
+      Token::makeOutput(), Token::makeNum(0), Token::makeSemicolon()};
+  REQUIRE_THROWS_AS(Parser{weakInt}.parse(), InvalidASTError);
+
+  // and only fields
+  auto weakLocal = std::vector<Token>{
+      Token::makeWeak(), Token::makeType("%entry"), Token::makeId("x"),
+      Token::makeSemicolon(),
+      Token::makeOutput(), Token::makeNum(0), Token::makeSemicolon()};
+  REQUIRE_THROWS(Parser{weakLocal}.parse());
+}
+
+TEST_CASE("Spawn and join test", "[parser]") {
+  // t := spawn f(1); r := join t; output r;
+  auto parsed = Parser{std::vector<Token>{
+      Token::makeId("t"), Token::makeAssign(), Token::makeSpawn(),
+      Token::makeId("f"), Token::makeLParen(), Token::makeNum(1),
+      Token::makeRParen(), Token::makeSemicolon(),
+      Token::makeId("r"), Token::makeAssign(), Token::makeJoin(),
+      Token::makeId("t"), Token::makeSemicolon(),
+      Token::makeOutput(), Token::makeId("r"), Token::makeSemicolon()}}
+  .parse();
+
+  auto & stmts = parsed->statements().stmts();
+  REQUIRE(stmts.size() == 2);
+  auto spawn = dynamic_cast<const Spawn*>(
+      &dynamic_cast<const Assignment&>(*stmts[0]).rhs());
+  REQUIRE(spawn != nullptr);
+  CHECK(spawn->call().callee_name() == "f");
+  CHECK(spawn->call().arguments().size() == 1);
+  auto join = dynamic_cast<const Join*>(
+      &dynamic_cast<const Assignment&>(*stmts[1]).rhs());
+  REQUIRE(join != nullptr);
+  CHECK(join->thread().toString() == "t");
+
+  // only function calls can be spawned
+  auto spawnExpr = std::vector<Token>{
+      Token::makeId("t"), Token::makeAssign(), Token::makeSpawn(),
+      Token::makeNum(1), Token::makeSemicolon(),
+      Token::makeOutput(), Token::makeNum(0), Token::makeSemicolon()};
+  REQUIRE_THROWS(Parser{spawnExpr}.parse());
+}
+
 TEST_CASE("Simple invalid parser tests", "[Parser{}]") {
   auto tok = std::vector<Token>{
       Token::makeId("x"), Token::makeArithOp(ArithOp::Plus),
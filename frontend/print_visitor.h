@@ -120,7 +120,7 @@ class PrintVisitor : public AstVisitor {
   }
 
   void VisitDeclarationExpr(const Declaration& exp) override {
-    output_ << "";
+    output_ << (exp.isWeak() ? "weak " : "");
     exp.type().Visit(this);
     output_ << " ";
     exp.id().Visit(this);
@@ -161,6 +161,16 @@ class PrintVisitor : public AstVisitor {
     output_ << ")";
   }
 
+  void VisitSpawnExpr(const Spawn& exp) override {
+    output_ << "spawn ";
+    exp.call().Visit(this);
+  }
+
+  void VisitJoinExpr(const Join& exp) override {
+    output_ << "join ";
+    exp.thread().Visit(this);
+  }
+
   void VisitFunctionDefExpr(const FunctionDef& exp) override {
     output_ << "def " << exp.function_name();
     output_ << "(";
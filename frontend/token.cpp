@@ -59,6 +59,12 @@ const char* tokenTypeToString(TokenType type_) {
       return "Struct";
     case TokenType::New:
       return "New";
+    case TokenType::Weak:
+      return "Weak";
+    case TokenType::Spawn:
+      return "Spawn";
+    case TokenType::Join:
+      return "Join";
     default:
       return "unknown or uninitialized token type";
   }
@@ -193,6 +199,9 @@ Token Token::makeDot() { return Token(TokenType::Dot); }
 Token Token::makeNil() { return Token(TokenType::Nil); }
 Token Token::makeStruct() { return Token(TokenType::Struct); }
 Token Token::makeNew() { return Token(TokenType::New); }
+Token Token::makeWeak() { return Token(TokenType::Weak); }
+Token Token::makeSpawn() { return Token(TokenType::Spawn); }
+Token Token::makeJoin() { return Token(TokenType::Join); }
 
 Token::Token(TokenType type) : type_(type) {}
 
@@ -43,7 +43,10 @@ enum class TokenType {
   Dot,
   Nil,
   Struct,
-  New
+  New,
+  Weak,
+  Spawn,
+  Join
 };
 
 // Give a string representation of given token type. Used for debugging
@@ -124,6 +127,9 @@ class Token final {
   static Token makeNew();
   static Token makeNil();
   static Token makeStruct();
+  static Token makeWeak();
+  static Token makeSpawn();
+  static Token makeJoin();
   // END static methods to build tokens in a type-safe manner
 
   // Equality operators
@@ -136,6 +136,21 @@ TEST_CASE("Builder methods", "[token]") {
     auto tok = Token::makeNew();
     REQUIRE(tok.type() == TokenType::New);
   }
+
+  SECTION("makeWeak()") {
+    auto tok = Token::makeWeak();
+    REQUIRE(tok.type() == TokenType::Weak);
+  }
+
+  SECTION("makeSpawn()") {
+    auto tok = Token::makeSpawn();
+    REQUIRE(tok.type() == TokenType::Spawn);
+  }
+
+  SECTION("makeJoin()") {
+    auto tok = Token::makeJoin();
+    REQUIRE(tok.type() == TokenType::Join);
+  }
 }
 
 TEST_CASE("equality", "[token]") {
@@ -171,6 +186,9 @@ TEST_CASE("equality", "[token]") {
                        Token::makeNil(),
                        Token::makeStruct(),
                        Token::makeNew(),
+                       Token::makeWeak(),
+                       Token::makeSpawn(),
+                       Token::makeJoin(),
                        Token::makeComma()};
   };
 
@@ -222,4 +240,7 @@ TEST_CASE("toString", "[token]") {
   CHECK(Token::makeNew().toString() == "<New>");
   CHECK(Token::makeNil().toString() == "<Nil>");
   CHECK(Token::makeStruct().toString() == "<Struct>");
+  CHECK(Token::makeWeak().toString() == "<Weak>");
+  CHECK(Token::makeSpawn().toString() == "<Spawn>");
+  CHECK(Token::makeJoin().toString() == "<Join>");
 }
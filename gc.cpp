@@ -1,6 +1,7 @@
 /* Author: Zihao Zhang */
 #include "gc.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
@@ -8,144 +9,504 @@
 #include <sstream>
 #include <iostream>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 
-using std::unordered_set;
+int32_t read_barrier_active = 0;
+int32_t write_barrier_active = 0;
+uint8_t card_table[(size_t) 1 << (32 - kCardShift)];
+int32_t card_marking_active = 0;
+
+// Set while the thread runs the collector, see Gc::InCollector
+static thread_local bool in_collector = false;
+
+bool Gc::InCollector() {
+  return in_collector;
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void Gc::start_pause() {
+  in_collector = true;
+  if (pause_listener != NULL) pause_listener->PauseStarted();
+  pause_start_ns = now_ns();
+}
+
+void Gc::end_pause(bool ends_collection) {
+  uint64_t pause_ns = now_ns() - pause_start_ns;
+  if (ends_collection) stats.num_collections++;
+  stats.num_pauses++;
+  stats.total_pause_ns += pause_ns;
+  if (pause_ns > stats.max_pause_ns) stats.max_pause_ns = pause_ns;
+  if (pause_listener != NULL) pause_listener->PauseEnded();
+  in_collector = false;
+}
+
+// Size of a huge page as configured in the kernel, 2 MB on most systems.
+static size_t huge_page_size() {
+  size_t size_kb = 0;
+  if (FILE *meminfo = fopen("/proc/meminfo", "r")) {
+    char line[128];
+    while (fgets(line, sizeof(line), meminfo)) {
+      if (sscanf(line, "Hugepagesize: %zu kB", &size_kb) == 1) break;
+    }
+    fclose(meminfo);
+  }
+  return size_kb != 0 ? size_kb * 1024 : 2 * 1024 * 1024;
+}
+
+intptr_t* Gc::map_heap(size_t num_words, bool huge_pages) {
+  size_t bytes = num_words * sizeof(intptr_t);
+
+  if (huge_pages) {
+    size_t page_size = huge_page_size();
+    size_t rounded_bytes = (bytes + page_size - 1) / page_size * page_size;
+
+    // Huge pages reserved by the administrator, e.g. through
+    // /proc/sys/vm/nr_hugepages. Fails if the pool is too small.
+    void *mapping = mmap(NULL, rounded_bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (mapping != MAP_FAILED) {
+      heap_pages = HeapPages::Huge;
+      heap_mapping = mapping;
+      heap_mapping_bytes = rounded_bytes;
+      return (intptr_t*) mapping;
+    }
+
+    // Transparent huge pages only cover huge page aligned ranges, so map one
+    // more huge page than needed and unmap what sticks out on both ends.
+    size_t mapped_bytes = rounded_bytes + page_size;
+    mapping = mmap(NULL, mapped_bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping != MAP_FAILED) {
+      uintptr_t start = (uintptr_t) mapping;
+      uintptr_t aligned = (start + page_size - 1) / page_size * page_size;
+      if (aligned > start) munmap(mapping, aligned - start);
+      size_t tail_bytes = start + mapped_bytes - (aligned + rounded_bytes);
+      if (tail_bytes > 0) munmap((void*) (aligned + rounded_bytes), tail_bytes);
+
+      heap_mapping = (void*) aligned;
+      heap_mapping_bytes = rounded_bytes;
+      if (madvise(heap_mapping, rounded_bytes, MADV_HUGEPAGE) == 0) {
+        heap_pages = HeapPages::TransparentHuge;
+      }
+      return (intptr_t*) heap_mapping;
+    }
+  }
+
+  heap_pages = HeapPages::Small;
+  return (intptr_t*) malloc(bytes);
+}
+
+void Gc::unmap_heap(intptr_t *heap) {
+  if (heap_mapping != NULL) {
+    munmap(heap_mapping, heap_mapping_bytes);
+    heap_mapping = NULL;
+  } else {
+    free(heap);
+  }
+}
+
+const char* Gc::PagesName() const {
+  switch (heap_pages) {
+    case HeapPages::TransparentHuge: return "thp";
+    case HeapPages::Huge: return "hugetlb";
+    default: return "4k";
+  }
+}
+
+size_t Gc::HugePageBytes() const {
+  if (heap_pages == HeapPages::Huge) return heap_mapping_bytes;
+  if (heap_pages != HeapPages::TransparentHuge) return 0;
+
+  // The kernel reports the huge pages of every mapping in /proc/self/smaps.
+  // The heap may have been merged with an adjacent mapping, so look for the
+  // mapping that contains it.
+  size_t huge_kb = 0;
+  FILE *smaps = fopen("/proc/self/smaps", "r");
+  if (smaps == NULL) return 0;
+
+  uintptr_t heap_start = (uintptr_t) heap_mapping;
+  bool in_heap = false;
+  char line[256];
+  while (fgets(line, sizeof(line), smaps)) {
+    unsigned long long start, end;
+    size_t kb;
+    if (sscanf(line, "%llx-%llx ", &start, &end) == 2) {
+      in_heap = start <= heap_start && heap_start < end;
+    } else if (in_heap && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+      huge_kb = kb;
+      break;
+    }
+  }
+  fclose(smaps);
+  return huge_kb * 1024;
+}
+
+void Gc::stack_walk(intptr_t *curr_frame_ptr,
+                    std::vector<intptr_t*> &root_set) const {
+  root_set.clear();
+  walk_frames(curr_frame_ptr, base_frame_ptr, root_set);
+  for (const ThreadStack &stack : thread_stacks) {
+    walk_frames(stack.top_frame_ptr, stack.base_frame_ptr, root_set);
+  }
+  for (auto &roots : external_roots) {
+    for (size_t i = 0; i < roots.second; i++) {
+      root_set.push_back(roots.first + i);
+    }
+  }
+}
+
+void Gc::walk_frames(intptr_t *curr_frame_ptr, intptr_t *end_frame_ptr,
+                     std::vector<intptr_t*> &root_set) const {
+  FrameLayout::ForEachRootSlot(
+      curr_frame_ptr, end_frame_ptr,
+      [&](intptr_t *slot) { root_set.push_back(slot); });
+}
+
+intptr_t* Gc::alloc_weak_object(uint32_t tag, uint32_t weak_bits,
+                                intptr_t *curr_frame_ptr) {
+  intptr_t *obj_ptr = AllocTyped(tag, curr_frame_ptr);
+  weak_objects.push_back({obj_ptr, weak_bits});
+  return obj_ptr;
+}
+
+void Gc::update_weak_fields(
+    const std::function<intptr_t*(intptr_t*)> &survivor) {
+  size_t num_kept = 0;
+  for (size_t i = 0; i < weak_objects.size(); i++) {
+    intptr_t *obj_ptr = survivor(weak_objects[i].obj_ptr);
+    if (obj_ptr == NULL) continue;
+
+    uint32_t bits = weak_objects[i].weak_bits >> 1;
+    for (int field = 0; bits != 0; field++, bits >>= 1) {
+      if ((bits & 1) && obj_ptr[field] != 0) {
+        obj_ptr[field] = (intptr_t) survivor((intptr_t*) obj_ptr[field]);
+      }
+    }
+    weak_objects[num_kept++] = {obj_ptr, weak_objects[i].weak_bits};
+  }
+  weak_objects.resize(num_kept);
+}
+
+/*----------------------------------------------------------------------------*/
+
+GcSemiSpace::GcSemiSpace(intptr_t *frame_ptr, int heap_size_in_words,
+                         bool huge_pages, int incremental_scan_words)
+    : incremental_scan_words(incremental_scan_words) {
+  // See end_collection
+  flip_free_words = incremental_scan_words > 0 ? heap_size_in_words / 4 : 0;
 
-GcSemiSpace::GcSemiSpace(intptr_t *frame_ptr, int heap_size_in_words) {
   // Initialize GC data structures and allocate space for the heap here
   base_frame_ptr = frame_ptr;
   heap_size = heap_size_in_words;
-  heap_space = (intptr_t*) malloc(heap_size * 4);
+  heap_space = map_heap(heap_size, huge_pages);
   from_space = heap_space;
   to_space = heap_space + heap_size / 2;
   from_size = heap_size / 2;
   to_size = heap_size / 2;
   bump_ptr = from_space;
+  atomic_ptr = from_space + heap_size / 2;
+}
+
+GcSemiSpace::~GcSemiSpace() {
+  if (in_collection) __atomic_fetch_sub(&read_barrier_active, 1, __ATOMIC_RELAXED);
+  unmap_heap(heap_space);
 }
 
 intptr_t* GcSemiSpace::Alloc(int32_t num_words, intptr_t *curr_frame_ptr) {
   intptr_t *obj_ptr;
 
-  if (num_words + 1 <= from_size) {
-    obj_ptr = bump_ptr + 1;
-    bump_ptr = bump_ptr + num_words + 1;
-    from_size = from_size - num_words - 1;
-    obj_map.insert(std::pair<intptr_t*, int>(obj_ptr, num_words));
+  if (incremental_scan_words > 0 &&
+      (in_collection || num_words + 1 > from_size - flip_free_words)) {
+    return alloc_incremental(num_words, curr_frame_ptr);
+  }
 
-  } else {
-    bump_ptr = to_space;
-    stack_walk(curr_frame_ptr);
-    copy_space_on_rootset();
-    ReportGCStats(num_obj_copied, num_word_copied);
-    num_obj_copied = 0;
-    num_word_copied = 0;
-
-    if (num_words + 1 <= from_size) {
-      obj_ptr = bump_ptr + 1;
-      bump_ptr = bump_ptr + num_words + 1;
-      from_size = from_size - num_words -1;
-      obj_map.insert(std::pair<intptr_t*, int>(obj_ptr, num_words));
-    } else {
-      throw OutOfMemoryError();
-    }
+  if (num_words + 1 > from_size) {
+    collect(curr_frame_ptr);
+    if (num_words + 1 > from_size) throw OutOfMemoryError();
   }
 
+  obj_ptr = bump_ptr + 1;
+  bump_ptr = bump_ptr + num_words + 1;
+  from_size = from_size - num_words - 1;
+  *(obj_ptr - 1) = HeaderLayout::ProvisionalHeader(num_words);
+
   return obj_ptr;
 }
 
-void GcSemiSpace::stack_walk(intptr_t *curr_frame_ptr) {
-  root_set.clear();
-  intptr_t *aiw_ptr, *liw_ptr;
+intptr_t* GcSemiSpace::AllocAtomic(uint32_t tag, intptr_t *curr_frame_ptr) {
+  // An incremental collection allocates from the end of the to space
+  if (incremental_scan_words > 0) return AllocTyped(tag, curr_frame_ptr);
+
+  int num_words = tag >> 24;
+  if (num_words + 1 > from_size) {
+    collect(curr_frame_ptr);
+    if (num_words + 1 > from_size) throw OutOfMemoryError();
+  }
 
-  while (curr_frame_ptr != base_frame_ptr) {
-    aiw_ptr = curr_frame_ptr - 1;
-    info_word_bit_mask(*aiw_ptr, curr_frame_ptr, 2);
+  atomic_ptr = atomic_ptr - num_words - 1;
+  from_size = from_size - num_words - 1;
+  *atomic_ptr = tag;
+  return atomic_ptr + 1;
+}
+
+intptr_t* GcSemiSpace::AllocWeak(uint32_t tag, uint32_t weak_bits,
+                                 intptr_t *curr_frame_ptr) {
+  // The program could load a weak field of a copy before the collection
+  // has decided whether to clear it
+  if (incremental_scan_words > 0) {
+    return Gc::AllocWeak(tag, weak_bits, curr_frame_ptr);
+  }
+  return alloc_weak_object(tag, weak_bits, curr_frame_ptr);
+}
 
-    liw_ptr = curr_frame_ptr - 2;
-    info_word_bit_mask(*liw_ptr, curr_frame_ptr, -3);
+intptr_t* GcSemiSpace::AllocBuffer(int32_t min_words, int32_t *num_words,
+                                   intptr_t *curr_frame_ptr) {
+  // Objects allocated during an incremental collection go to the end of the
+  // to space, one at a time
+  if (incremental_scan_words > 0) return NULL;
 
-    curr_frame_ptr = (intptr_t*) *curr_frame_ptr;
+  if (min_words > from_size) {
+    collect(curr_frame_ptr);
+    if (min_words > from_size) throw OutOfMemoryError();
   }
+
+  // The copying loop only scans copies, it never walks the objects in the
+  // from space, so the end of a buffer does not have to look like an object
+  *num_words = std::min(*num_words, from_size);
+  intptr_t *buffer = bump_ptr;
+  bump_ptr = bump_ptr + *num_words;
+  from_size = from_size - *num_words;
+  return buffer;
 }
 
-void GcSemiSpace::info_word_bit_mask(int info_word, intptr_t *curr_frame_ptr, 
-                                                    int word_offset) {
-  int is_ptr, bit_num = 0;
-  while (info_word != 0) {
-    // mask out the right most bit of info word
-    is_ptr = info_word & 0x0001;
-  
-    if (is_ptr == 1)  {
-      if (word_offset > 0) {
-        // if it is a argument info word
-        root_set.push_back(curr_frame_ptr + word_offset + bit_num);
-      } else {
-        // if it is a local info word
-        root_set.push_back(curr_frame_ptr + word_offset - bit_num);
-      }
+void GcSemiSpace::collect(intptr_t *curr_frame_ptr) {
+  start_pause();
+  bump_ptr = to_space;
+  stack_walk(curr_frame_ptr, root_set);
+  copy_space_on_rootset();
+  end_pause();
+  ReportGCStats(num_obj_copied, num_word_copied);
+  num_obj_copied = 0;
+  num_word_copied = 0;
+}
+
+const char* GcSemiSpace::Name() const {
+  return "semispace";
+}
+
+intptr_t* GcSemiSpace::ReadBarrier(intptr_t *slot) {
+  intptr_t *obj_ptr = (intptr_t*) *slot;
+  if (in_collection && obj_ptr > from_space &&
+      obj_ptr <= from_space + heap_size / 2) {
+    // heal the field, so that the next load does not copy again
+    forward_slot(slot);
+    obj_ptr = (intptr_t*) *slot;
+  }
+  return obj_ptr;
+}
+
+intptr_t* GcSemiSpace::alloc_incremental(int32_t num_words,
+                                         intptr_t *curr_frame_ptr) {
+  if (in_collection) {
+    start_pause();
+    scan_copies(incremental_scan_words);
+    end_pause(/*ends_collection=*/false);
+  }
+
+  if (!in_collection && num_words + 1 > from_size - flip_free_words) {
+    // The pause of a flip only depends on the number of roots
+    start_pause();
+    flip(curr_frame_ptr);
+    end_pause();
+  }
+
+  if (in_collection ? num_words + 1 > incremental_free_words()
+                    : num_words + 1 > from_size) {
+    // The program allocated faster than the collection scanned, or most
+    // objects survived: finish the collection in one pause, and collect
+    // once more if that did not free enough space.
+    start_pause();
+    if (in_collection) scan_copies(INT32_MAX);
+    bool flipped = false;
+    if (num_words + 1 > from_size) {
+      flip(curr_frame_ptr);
+      if (in_collection) scan_copies(INT32_MAX);
+      flipped = true;
     }
+    end_pause(flipped);
+
+    if (num_words + 1 > from_size) throw OutOfMemoryError();
+  }
 
-    bit_num++;
-    info_word >>= 1;
+  intptr_t *obj_ptr;
+  if (in_collection) {
+    // Objects allocated during a collection are not scanned by it, they
+    // only point to copied objects.
+    top_ptr = top_ptr - num_words - 1;
+    obj_ptr = top_ptr + 1;
+  } else {
+    obj_ptr = bump_ptr + 1;
+    bump_ptr = bump_ptr + num_words + 1;
+    from_size = from_size - num_words - 1;
   }
+  *(obj_ptr - 1) = HeaderLayout::ProvisionalHeader(num_words);
+
+  return obj_ptr;
 }
 
-void GcSemiSpace::copy_space_on_rootset() {
-  intptr_t *from_obj_ptr, *root_ptr, *tmp_space, *to_obj_ptr;
-  int num_words;
+int GcSemiSpace::incremental_free_words() const {
+  return (int) (top_ptr - bump_ptr) - uncopied_words;
+}
 
+void GcSemiSpace::flip(intptr_t *curr_frame_ptr) {
+  uncopied_words = heap_size / 2 - from_size;
+  bump_ptr = to_space;
+  scan_ptr = to_space;
+  top_ptr = to_space + heap_size / 2;
+  in_collection = true;
+  __atomic_fetch_add(&read_barrier_active, 1, __ATOMIC_RELAXED);
+
+  // The program only sees copied objects from now on, starting with the
+  // objects on its stack.
+  stack_walk(curr_frame_ptr, root_set);
   for (unsigned int i = 0; i < root_set.size(); i++) {
-    root_ptr = root_set[i];
-    from_obj_ptr = (intptr_t*) *root_ptr;
+    queue_slot(root_set[i]);
+  }
+  while (!prefetch_fifo.empty()) forward_slot(prefetch_fifo.pop());
+  if (scan_ptr == bump_ptr) end_collection();
+}
 
-    if (from_obj_ptr == NULL) continue;
+void GcSemiSpace::scan_copies(int max_words) {
+  int scanned_words = 0;
+  while (scan_ptr < bump_ptr || !prefetch_fifo.empty()) {
+    if (scan_ptr < bump_ptr && scanned_words < max_words) {
+      intptr_t *next_ptr = copy_space_on_struct(scan_ptr + 1);
+      scanned_words += next_ptr - scan_ptr;
+      scan_ptr = next_ptr;
+    } else if (!prefetch_fifo.empty()) {
+      // The program may change the queued fields before the next increment
+      forward_slot(prefetch_fifo.pop());
+    } else {
+      break;
+    }
+  }
+
+  if (scan_ptr == bump_ptr) end_collection();
+}
 
-    auto j = obj_map.find(from_obj_ptr);
+void GcSemiSpace::end_collection() {
+  in_collection = false;
+  __atomic_fetch_sub(&read_barrier_active, 1, __ATOMIC_RELAXED);
 
-    if (j != obj_map.end()) {
-      num_words = j->second;
+  // Until a collection has copied everything that survives, the rest of the
+  // from space has to stay reserved for copies. The next collection starts
+  // when half of the space not taken by the survivors of this one has been
+  // allocated, so that the other half is left for the objects allocated
+  // during the collection even if everything survives.
+  flip_free_words = (heap_size / 2 - (int) num_word_copied) / 2;
 
-      if (isCopied(from_obj_ptr)) {
-        // update stack root pointer to forwarding pointer
-        to_obj_ptr = (intptr_t*) *(from_obj_ptr - 1);
-        *root_ptr = (intptr_t) to_obj_ptr;
+  ReportGCStats(num_obj_copied, num_word_copied);
+  num_obj_copied = 0;
+  num_word_copied = 0;
 
-      } else {
-        memcpy(bump_ptr, from_obj_ptr - 1, 4 * (num_words + 1));
-
-        num_obj_copied++;
-        num_word_copied = num_word_copied + num_words + 1;
-
-        to_obj_ptr = bump_ptr + 1;
-        new_map.insert(std::pair<intptr_t*, int>(to_obj_ptr, num_words));
-        bump_ptr = bump_ptr + num_words + 1;
-        to_size = to_size - num_words - 1;
-       
-        *root_ptr = (intptr_t) to_obj_ptr;
-
-        add_forwarding_ptr(from_obj_ptr, to_obj_ptr);
-      
-        // if struct fields are pointers, copy them as well
-        copy_space_on_struct(to_obj_ptr);
-      }
+  // The program allocates between the copies and the objects allocated
+  // during the collection until the next one.
+  from_size = top_ptr - bump_ptr;
+  to_size = heap_size / 2;
+
+  intptr_t *tmp_space = from_space;
+  from_space = to_space;
+  to_space = tmp_space;
+  atomic_ptr = from_space + heap_size / 2;
+}
+
+void GcSemiSpace::copy_space_on_rootset() {
+  intptr_t *scan_ptr = bump_ptr, *tmp_space;
+  to_atomic_ptr = to_space + heap_size / 2;
+
+  for (unsigned int i = 0; i < root_set.size(); i++) {
+    queue_slot(root_set[i]);
+  }
 
+  // Scan the copied objects until every reachable object has been copied.
+  // Slots are only forwarded once they come out of the prefetch FIFO, by
+  // which time the header of the object they point to should be cached.
+  while (scan_ptr < bump_ptr || !prefetch_fifo.empty()) {
+    if (scan_ptr < bump_ptr) {
+      scan_ptr = copy_space_on_struct(scan_ptr + 1);
     } else {
-      std::cerr << "Error: rootset: Can not find such pointer on heap!"
-                << std::endl;
-      exit(0);
+      forward_slot(prefetch_fifo.pop());
     }
   }
 
-  // swap from and to
-  obj_map = new_map;
-  new_map.clear();
+  // The weak fields of the copies still point to the from space
+  update_weak_fields([this](intptr_t *obj_ptr) {
+    return isCopied(obj_ptr) ? (intptr_t*) *(obj_ptr - 1) : NULL;
+  });
 
+  // swap from and to
   from_size = to_size;
   to_size = heap_size / 2;
 
   tmp_space = from_space;
   from_space = to_space;
   to_space = tmp_space;
+  atomic_ptr = to_atomic_ptr;
+}
+
+void GcSemiSpace::queue_slot(intptr_t *slot) {
+  intptr_t *obj_ptr = (intptr_t*) *slot;
+  if (obj_ptr == NULL) return;
+  // During an incremental collection the program stores pointers to copies
+  if (in_collection && obj_ptr > to_space &&
+      obj_ptr <= to_space + heap_size / 2) {
+    return;
+  }
+
+  prefetch_fifo.push(slot, obj_ptr - 1);
+  if (prefetch_fifo.full()) forward_slot(prefetch_fifo.pop());
+}
+
+void GcSemiSpace::forward_slot(intptr_t *slot) {
+  intptr_t *from_obj_ptr = (intptr_t*) *slot, *to_obj_ptr;
+
+  if (from_obj_ptr <= from_space || from_obj_ptr > from_space + heap_size / 2) {
+    std::cerr << "Error: Can not find such pointer on heap!" << std::endl;
+    exit(0);
+  }
+
+  if (isCopied(from_obj_ptr)) {
+    // update the slot to the forwarding pointer
+    *slot = *(from_obj_ptr - 1);
+    return;
+  }
+
+  int num_words = HeaderLayout::NumFields(*(from_obj_ptr - 1));
+  num_obj_copied++;
+  num_word_copied = num_word_copied + num_words + 1;
+  uncopied_words = uncopied_words - num_words - 1;
+  to_size = to_size - num_words - 1;
+
+  if (from_obj_ptr > atomic_ptr) {
+    // a pointer-free object, its copy is not scanned
+    to_atomic_ptr = to_atomic_ptr - num_words - 1;
+    memcpy(to_atomic_ptr, from_obj_ptr - 1,
+           sizeof(intptr_t) * (num_words + 1));
+    to_obj_ptr = to_atomic_ptr + 1;
+  } else {
+    memcpy(bump_ptr, from_obj_ptr - 1, sizeof(intptr_t) * (num_words + 1));
+    to_obj_ptr = bump_ptr + 1;
+    bump_ptr = bump_ptr + num_words + 1;
+  }
+
+  *slot = (intptr_t) to_obj_ptr;
+  add_forwarding_ptr(from_obj_ptr, to_obj_ptr);
 }
 
 bool GcSemiSpace::isCopied(intptr_t *obj_ptr) {
@@ -165,283 +526,1775 @@ void GcSemiSpace::add_forwarding_ptr(intptr_t *obj_ptr,
   *head_ptr = (intptr_t) forwarding_ptr;
 }
 
-void GcSemiSpace::copy_space_on_struct(intptr_t *obj_ptr) {
-  intptr_t *head_ptr = obj_ptr - 1;
-  int head = *head_ptr;
-  int num_fields = head >> 24;
-  int bitvector = (head << 8) >> 9;
-  int last_bit;
-  intptr_t *from_field_ptr, *to_field_ptr;
-  int num_words;
-
-  for (int i = 0; i < num_fields; i++) {
-    last_bit = bitvector & 0x0001;
-
-    if (last_bit == 1) {
-      // that field is a pointer, copy that field
-      from_field_ptr = (intptr_t*) *(obj_ptr + i);
-      if (from_field_ptr == 0) {
-        bitvector >>= 1;
-        continue;
-      }
-      
-      auto it = obj_map.find(from_field_ptr);
-      if (it != obj_map.end()) {
-        num_words = it->second;
-      } else {
-        std::cerr << "Error: struct: Can not find such pointer on heap!"
-                  << std::endl;
-        exit(0);
-      }
+intptr_t* GcSemiSpace::copy_space_on_struct(intptr_t *obj_ptr) {
+  uint32_t head = *(obj_ptr - 1);
+  // copy the objects the pointer fields point to
+  HeaderLayout::ForEachPointerSlot(
+      obj_ptr, head, [&](intptr_t *slot) { queue_slot(slot); });
 
-      if (isCopied(from_field_ptr)) {
-        // update field pointer
-        head_ptr = from_field_ptr - 1;
-        *(obj_ptr + i) = *head_ptr;
-      } else {
-        // copy
-        memcpy(bump_ptr, from_field_ptr - 1, 4*(num_words + 1));
+  return obj_ptr + HeaderLayout::NumFields(head);
+}
 
-        num_obj_copied++;
-        num_word_copied = num_word_copied + num_words + 1;
+/*----------------------------------------------------------------------------*/
 
-        to_field_ptr = bump_ptr + 1;
-        *(obj_ptr + i) = (intptr_t) to_field_ptr;
-         
-        add_forwarding_ptr(from_field_ptr, to_field_ptr);
+GcThreadPool::GcThreadPool(int num_threads) {
+  for (int worker = 1; worker < num_threads; worker++) {
+    threads.emplace_back(&GcThreadPool::worker_loop, this, worker);
+  }
+}
 
-        new_map.insert(std::pair<intptr_t*, int>(to_field_ptr, num_words));
-        bump_ptr = bump_ptr + num_words + 1;
-        to_size = to_size - num_words - 1;
+GcThreadPool::~GcThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  start_cv.notify_all();
+  for (auto &thread : threads) thread.join();
+}
 
-        // recursively check its fields
-        copy_space_on_struct(to_field_ptr);
-      }
-    }
-    bitvector >>= 1;
+void GcThreadPool::Run(const std::function<void(int)> &task) {
+  if (threads.empty()) {
+    task(0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    this->task = &task;
+    num_running = threads.size();
+    generation++;
+  }
+  start_cv.notify_all();
+
+  task(0);
+
+  std::unique_lock<std::mutex> guard(lock);
+  done_cv.wait(guard, [this] { return num_running == 0; });
+  this->task = NULL;
+}
+
+void GcThreadPool::worker_loop(int worker) {
+  in_collector = true;
+  uint64_t last_generation = 0;
+  std::unique_lock<std::mutex> guard(lock);
+
+  while (true) {
+    start_cv.wait(guard, [&] {
+      return stopping || generation != last_generation;
+    });
+    if (stopping) return;
+    last_generation = generation;
+
+    guard.unlock();
+    (*task)(worker);
+    guard.lock();
+
+    if (--num_running == 0) done_cv.notify_one();
   }
 }
 
 /*----------------------------------------------------------------------------*/
 
-GcMarkSweep::GcMarkSweep(intptr_t *frame_ptr, int heap_size_in_words) {
+// Header words of free blocks, see the comment on the members of GcMarkSweep.
+static inline bool is_free_block(intptr_t head) {
+  return (head & 0x0001) == 0;
+}
+
+static inline int free_block_size(intptr_t head) {
+  return (uint32_t) head >> 1;
+}
+
+static inline intptr_t free_block_head(int size) {
+  return (intptr_t) size << 1;
+}
+
+static inline int obj_size(intptr_t head) {
+  return HeaderLayout::SizeWords(head);
+}
+
+static inline int block_size(intptr_t head) {
+  return is_free_block(head) ? free_block_size(head) : obj_size(head);
+}
+
+// Bitmaps with one bit per heap word.
+static inline bool test_bit(const std::vector<uint32_t> &bits, size_t index) {
+  return bits[index / 32] & (1u << (index % 32));
+}
+
+static inline void set_bit(std::vector<uint32_t> &bits, size_t index) {
+  bits[index / 32] |= 1u << (index % 32);
+}
+
+static inline void clear_bit(std::vector<uint32_t> &bits, size_t index) {
+  bits[index / 32] &= ~(1u << (index % 32));
+}
+
+// Sets the bit and returns whether it was clear, atomically since several
+// threads may mark objects whose header words share a bitmap word.
+static inline bool test_and_set_bit(std::vector<uint32_t> &bits, size_t index) {
+  uint32_t bit = 1u << (index % 32);
+  uint32_t *word = &bits[index / 32];
+  if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) return false;
+  return (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) == 0;
+}
+
+GcMarkSweep::GcMarkSweep(intptr_t *frame_ptr, int heap_size_in_words,
+                         bool huge_pages, int num_threads,
+                         bool concurrent_sweep, bool generational)
+    : threads(new GcThreadPool(num_threads > 1 ? num_threads : 1)),
+      mark_workers(new MarkWorker[threads->Size()]),
+      generational(generational) {
   // Initialize GC data structures and allocate space for the heap here
   base_frame_ptr = frame_ptr;
   heap_size = heap_size_in_words;
-  heap_space = (intptr_t*) malloc(heap_size * 4);
+  heap_space = map_heap(heap_size, huge_pages);
   free_size = heap_size;
-  free_list.push_back(std::make_pair(heap_space, free_size));
-  free_map.insert(std::make_pair(heap_space, free_list.begin()));
-}
+  mark_bits.resize((heap_size + 31) / 32);
+  start_bits.resize((heap_size + 31) / 32);
+  atomic_bits.resize((heap_size + 31) / 32);
+
+  // Marking never allocates, see GC_MARK_STACK_CAPACITY
+  for (int worker = 0; worker < threads->Size(); worker++) {
+    mark_workers[worker].mark_stack.reserve(GC_MARK_STACK_CAPACITY);
+    mark_workers[worker].shared.reserve(GC_MARK_STACK_CAPACITY);
+  }
 
-intptr_t* GcMarkSweep::Alloc(int32_t num_words, intptr_t *curr_frame_ptr) {
-  intptr_t *obj_ptr;
-  // Try to find a memory block large enough for 'num_words'
-  auto block_iter = find_free_block(num_words);
+  // The whole heap starts out as a single free block in the first chunk
+  chunks.resize((heap_size + kChunkWords - 1) / kChunkWords);
+  chunk_states.reset(new std::atomic<uint8_t>[chunks.size()]);
+  for (size_t c = 0; c < chunks.size(); c++) {
+    chunk_states[c] = kSwept;
+    chunks[c].published = true;
+  }
+  num_published = chunks.size();
+  chunks_merged = true;
 
-  if (block_iter != free_list.end()) {
-    // Allocate memory for the object
-    obj_ptr = allocate_memory(block_iter, num_words);
-  } else {
-    // Prepare the root set by walking the stack
-    stack_walk(curr_frame_ptr);
-    // Turn the root set into a hashset
-    // Recursively track all object fields, if pointer add to hashset.
-    unordered_set<intptr_t*> root_hashset = get_root_hashset();
-
-    /*** Mark and Sweep ***/
-    // For every block in obj_list, check it exists in the root hashset. If not,
-    // delete the block from obj_list and return its space to free_list.
-    for (auto iter = obj_list.begin(); iter != obj_list.end();) {
-      if (root_hashset.find(iter->first) == root_hashset.end()) {
-        free_list.push_front(std::make_pair(iter->first - 1, iter->second + 1));
-        free_map.insert(std::make_pair(iter->first - 1, free_list.begin()));
-        free_size += iter->second + 1;
-        auto tmp = iter++;
-        obj_list.erase(tmp);
-      } else {
-        iter++;
-      }
-    }
- 
-    // Report Gc status
-    for (auto iter = obj_list.begin(); iter != obj_list.end(); iter++) {
-      num_obj_left++;
-      num_word_left += iter->second + 1;
-    }
-    ReportGCStats(num_obj_left, num_word_left);
-    num_obj_left = 0;
-    num_word_left = 0;
+  chunks[0].free_list = heap_space;
+  *heap_space = free_block_head(heap_size);
+  *(heap_space + 1) = 0;
+  set_bit(start_bits, 0);
 
-    // No enough space after Gc. Throw 'OutOfMemoryError' because memory ran out
-    if (free_size < num_words) throw OutOfMemoryError();
+  if (generational) {
+    __atomic_fetch_add(&card_marking_active, 1, __ATOMIC_RELAXED);
+  }
+  if (generational && sizeof(intptr_t) == 4) {
+    cards = card_table;
+  } else if (generational) {
+    uintptr_t first_card = (uintptr_t) heap_space >> kCardShift;
+    uintptr_t last_card = (uintptr_t) (heap_space + heap_size - 1) >> kCardShift;
+    own_cards.resize(last_card - first_card + 1);
+    cards = own_cards.data() - first_card;
+  }
 
-    // Try to find a memory block large enough again after garbage collection
-    block_iter = find_free_block(num_words);
+  if (concurrent_sweep) {
+    sweeper = std::thread(&GcMarkSweep::sweeper_loop, this);
+  }
+}
 
-    if (block_iter != free_list.end()) {;
-      // Allocate memory for the object
-      obj_ptr = allocate_memory(block_iter, num_words);
-    } else {
-      // Coalesce free memory
-      coalesce_free_list();
-      // Try find available space again after coalsecing
-      block_iter = find_free_block(num_words);
-
-      if (block_iter != free_list.end()) {
-        // Allocate memory for the object
-        obj_ptr = allocate_memory(block_iter, num_words);
-      } else {
-        // No enough space after coalesce.
-        // Throw 'OutOfMemoryError' due to external fregamentation
-        throw OutOfMemoryError();
-      }
+GcMarkSweep::~GcMarkSweep() {
+  if (sweeper.joinable()) {
+    {
+      std::lock_guard<std::mutex> guard(sweeper_lock);
+      sweeper_stopping = true;
     }
+    sweeper_cv.notify_one();
+    sweeper.join();
+  }
+  if (generational) {
+    __atomic_fetch_sub(&card_marking_active, 1, __ATOMIC_RELAXED);
   }
+  unmap_heap(heap_space);
+}
 
-  return obj_ptr;
+intptr_t* GcMarkSweep::Alloc(int32_t num_words, intptr_t *curr_frame_ptr) {
+  int32_t size = num_words + 1;
+  intptr_t *block = allocate_collecting(size, &size, curr_frame_ptr);
+  *block = HeaderLayout::ProvisionalHeader(num_words);
+  return block + 1;
 }
 
-std::list<std::pair<intptr_t*, int>>::iterator 
-  GcMarkSweep::find_free_block(int num_words) {
-  // First fit algorithm
-  int target_size = num_words + 1;
-  for (auto iter = free_list.begin(); iter != free_list.end(); iter++) {
-    if (iter->second >= target_size) return iter;
+intptr_t* GcMarkSweep::allocate_collecting(int32_t min_words,
+                                           int32_t *num_words,
+                                           intptr_t *curr_frame_ptr) {
+  // Try to find a memory block large enough for 'min_words'. When this
+  // fails, the whole heap has been swept.
+  intptr_t *block = allocate_memory(min_words, num_words);
+
+  if (block == NULL) {
+    bool major = !generational || major_next;
+    collect(curr_frame_ptr, major);
+
+    // Try to find a memory block large enough again after garbage collection.
+    // Abutting free blocks are merged once the whole heap has been swept, so
+    // if there is no such block the heap is either full or too fragmented.
+    block = allocate_memory(min_words, num_words);
+    if (block == NULL && !major) {
+      // the old objects kept by the minor collection may be garbage
+      collect(curr_frame_ptr, /*major=*/true);
+      block = allocate_memory(min_words, num_words);
+    }
+    if (block == NULL) throw OutOfMemoryError();
   }
-  return free_list.end();
+
+  return block;
 }
 
-intptr_t* GcMarkSweep::allocate_memory(std::list<std::pair<intptr_t*, int>>
-                                         ::iterator block_iter,
-                                       int32_t num_words) {
-  // Allocate memory
-  intptr_t *obj_ptr = block_iter->first + 1;
+void GcMarkSweep::collect(intptr_t *curr_frame_ptr, bool major) {
+  start_pause();
+  // Prepare the root set by walking the stack
+  stack_walk(curr_frame_ptr, root_set);
+
+  if (generational && major) {
+    // All objects are young again, and nothing old points to them
+    std::fill(mark_bits.begin(), mark_bits.end(), 0);
+    clear_cards();
+    num_old_obj = 0;
+    num_old_words = 0;
+  } else if (generational) {
+    scan_dirty_cards();
+  }
+
+  /*** Mark and Sweep ***/
+  // Set the mark bit of every reachable object, then return the space of
+  // every unmarked object to the free lists.
+  mark_from_roots();
+  update_weak_fields([this](intptr_t *obj_ptr) {
+    return test_bit(mark_bits, obj_ptr - 1 - heap_space) ? obj_ptr : NULL;
+  });
+  if (major) {
+    sweep();
+  } else {
+    sweep_young();
+    stats.num_minor_collections++;
+  }
+
+  end_pause();
 
-  int leftover_size = block_iter->second - (num_words + 1);
-  intptr_t *leftover_ptr = block_iter->first + num_words + 1;
-  // Erase the used block
-  free_list.erase(block_iter);
-  free_map.erase(block_iter->first);
-  // Put back the remaining free block into the free_list.
-  if (leftover_size != 0) {
-    free_list.push_front(std::make_pair(leftover_ptr, leftover_size));
-    free_map.insert(std::make_pair(leftover_ptr, free_list.begin()));
+  // Report Gc status
+  if (generational) {
+    // The survivors are old from now on. Minor collections go on as long as
+    // they leave a quarter of the heap free.
+    num_old_obj += num_obj_left;
+    num_old_words += num_word_left;
+    major_next = !major && free_size < heap_size / 4;
+    ReportGCStats(num_old_obj, num_old_words);
+  } else {
+    ReportGCStats(num_obj_left, num_word_left);
   }
-  // Decrease free size
-  free_size -= num_words + 1;
-  // Put allocated block into obj_list
-  obj_list.push_front(std::make_pair(obj_ptr, num_words));
+  num_obj_left = 0;
+  num_word_left = 0;
+}
 
+intptr_t* GcMarkSweep::AllocAtomic(uint32_t tag, intptr_t *curr_frame_ptr) {
+  intptr_t *obj_ptr = Alloc(tag >> 24, curr_frame_ptr);
+  *(obj_ptr - 1) = tag;
+  set_bit(atomic_bits, obj_ptr - 1 - heap_space);
   return obj_ptr;
 }
 
-void GcMarkSweep::stack_walk(intptr_t *curr_frame_ptr) {
-  root_set.clear();
-  intptr_t *aiw_ptr, *liw_ptr;
+intptr_t* GcMarkSweep::AllocWeak(uint32_t tag, uint32_t weak_bits,
+                                 intptr_t *curr_frame_ptr) {
+  return alloc_weak_object(tag, weak_bits, curr_frame_ptr);
+}
+
+intptr_t* GcMarkSweep::AllocBuffer(int32_t min_words, int32_t *num_words,
+                                   intptr_t *curr_frame_ptr) {
+  intptr_t *buffer = allocate_collecting(min_words, num_words, curr_frame_ptr);
+  // The runtime lays out objects all over the buffer, which must not be
+  // taken for the pointer-free objects that were there before
+  for (int32_t i = 1; i < *num_words; i++) {
+    clear_bit(atomic_bits, buffer + i - heap_space);
+  }
+  return buffer;
+}
 
-  while (curr_frame_ptr != base_frame_ptr) {
-    aiw_ptr = curr_frame_ptr - 1;
-    info_word_bit_mask(*aiw_ptr, curr_frame_ptr, 2);
+void GcMarkSweep::FillBuffer(intptr_t *begin, intptr_t *end) {
+  if (begin < end) *begin = free_block_head(end - begin);
+}
 
-    liw_ptr = curr_frame_ptr - 2;
-    info_word_bit_mask(*liw_ptr, curr_frame_ptr, -3);
+const char* GcMarkSweep::Name() const {
+  return "marksweep";
+}
 
-    curr_frame_ptr = (intptr_t*) *curr_frame_ptr;
-  }
+void GcMarkSweep::WriteBarrier(intptr_t *slot, intptr_t *value) {
+  *slot = (intptr_t) value;
+  if (cards != NULL) cards[(uintptr_t) slot >> kCardShift] = 1;
 }
 
-void GcMarkSweep::info_word_bit_mask(int info_word, intptr_t *curr_frame_ptr,
-                        int word_offset) {
-  int is_ptr, bit_num = 0;
-  while (info_word != 0) {
-    // mask out the right most bit of info word
-    is_ptr = info_word & 0x0001;
-  
-    if (is_ptr == 1)  {
-      if (word_offset > 0) {
-        // if it is a argument info word
-        root_set.push_back(curr_frame_ptr + word_offset + bit_num);
-      } else {
-        // if it is a local info word
-        root_set.push_back(curr_frame_ptr + word_offset - bit_num);
+intptr_t* GcMarkSweep::allocate_memory(int32_t min_words,
+                                       int32_t *num_words) {
+  if (num_published == chunks.size()) {
+    if (!chunks_merged) merge_chunks();
+    if (min_words > free_size) return NULL;
+  }
+
+  // First fit algorithm
+  for (size_t c = first_alloc_chunk; c < chunks.size(); c++) {
+    Chunk &chunk = chunks[c];
+    if (!chunk.published) publish_chunk(c);
+    if (chunk.free_list == NULL && c == first_alloc_chunk) {
+      // free lists only grow in a sweep
+      first_alloc_chunk++;
+      continue;
+    }
+
+    intptr_t **link = &chunk.free_list;
+    for (intptr_t *block = chunk.free_list; block != NULL;
+         link = (intptr_t**) (block + 1), block = *link) {
+      int block_size = free_block_size(*block);
+      if (block_size < min_words) continue;
+
+      // Only the first object of a run has its start bit set, so the objects
+      // after it have to start in its chunk, where the sweep walks to them
+      int target_size = std::min(*num_words, block_size);
+      intptr_t *block_end = block + block_size;
+      intptr_t *end_chunk = heap_space + (block_end - 1 - heap_space) /
+                                             kChunkWords * kChunkWords;
+      if (target_size > min_words && block_end - target_size < end_chunk) {
+        target_size = std::max<int>(min_words, block_end - end_chunk);
+      }
+
+      // The object may end up in the chunks the block reaches into, which
+      // have to be swept before that.
+      for (size_t next = c + 1;
+           num_published != chunks.size() && next < chunks.size() &&
+           chunk_end(next - 1) < block + block_size;
+           next++) {
+        if (!chunks[next].published) publish_chunk(next);
+      }
+
+      // Cut the object from the end of the block so that the block keeps its
+      // place in the free list. A leftover of a single word cannot hold the
+      // link to the next block, it stays in the heap as a free block header
+      // and is merged with its neighbours by the next sweep.
+      int leftover_size = block_size - target_size;
+      if (leftover_size < 2) *link = (intptr_t*) *(block + 1);
+      if (leftover_size != 0) *block = free_block_head(leftover_size);
+
+      // Decrease free size
+      free_size -= target_size;
+
+      intptr_t *run = block + leftover_size;
+      set_bit(start_bits, run - heap_space);
+      clear_bit(atomic_bits, run - heap_space);
+      if (generational) {
+        // both the chunk of the block and the one of the run have to be
+        // swept by the next minor collection
+        chunk.has_young = true;
+        chunks[(run - heap_space) / kChunkWords].has_young = true;
       }
+      *num_words = target_size;
+      return run;
     }
+  }
+
+  // All chunks are published now, merging their free blocks may make room
+  if (!chunks_merged) {
+    merge_chunks();
+    return allocate_memory(min_words, num_words);
+  }
+  return NULL;
+}
+
+void GcMarkSweep::mark_from_roots() {
+  num_shared = 0;
+  num_idle = 0;
+  threads->Run([this](int worker) { mark_worker(worker); });
 
-    bit_num++;
-    info_word >>= 1;
+  for (int worker = 0; worker < threads->Size(); worker++) {
+    num_obj_left += mark_workers[worker].live_objects;
+    num_word_left += mark_workers[worker].live_words;
+    mark_workers[worker].live_objects = 0;
+    mark_workers[worker].live_words = 0;
   }
 }
 
-unordered_set<intptr_t*> GcMarkSweep::get_root_hashset() {
-    unordered_set<intptr_t*> root_hashset;
+void GcMarkSweep::mark_worker(int worker) {
+  MarkWorker &self = mark_workers[worker];
+  size_t num_workers = threads->Size();
 
-    for (unsigned int i = 0; i < root_set.size(); i++) {
-      intptr_t *root_ptr = root_set[i];
-      intptr_t *obj_ptr = (intptr_t*) *root_ptr;
+  // Every worker starts from its own share of the roots
+  size_t first_root = root_set.size() * worker / num_workers;
+  size_t last_root = root_set.size() * (worker + 1) / num_workers;
+  for (size_t i = first_root; i < last_root; i++) {
+    intptr_t *obj_ptr = (intptr_t*) *root_set[i];
+    if (obj_ptr != NULL) mark_obj(self, obj_ptr);
+  }
 
-      if (obj_ptr == NULL) continue;
+  while (true) {
+    trace_grey_objects(self);
+    if (steal_grey_objects(worker)) continue;
 
-      root_hashset.insert(obj_ptr);
-      trace_obj_fields(obj_ptr, root_hashset);
+    // Wait until another worker shares grey objects, or until all workers
+    // are idle. Idle workers hold no grey objects, so then marking is done.
+    num_idle++;
+    while (num_shared == 0 && num_idle != (int) num_workers) {
+      std::this_thread::yield();
     }
-
-    return root_hashset;
+    if (num_shared == 0) return;
+    num_idle--;
+  }
 }
 
-void GcMarkSweep::trace_obj_fields(intptr_t* obj_ptr, 
-                                   unordered_set<intptr_t*> &root_hashset) {
-  intptr_t *head_ptr = obj_ptr - 1;
-  int head = *head_ptr;
-  int num_fields = head >> 24;
-  int bitvector = (head << 8) >> 9;
-  int last_bit;
-  intptr_t *field_ptr;
-
-  for (int i = 0; i < num_fields; i++) {
-    last_bit = bitvector & 0x0001;
-
-    if (last_bit == 1) {
-      // that field is a pointer, add it to root_hashset
-      field_ptr = (intptr_t*) *(obj_ptr + i);
-      if (field_ptr == NULL) {
-        bitvector >>= 1;
-        continue;
+void GcMarkSweep::trace_grey_objects(MarkWorker &self) {
+  // Marked objects move from the mark stack through the prefetch FIFO before
+  // their fields are traced, by which time their header should be cached.
+  while (!self.mark_stack.empty() || !self.prefetch_fifo.empty()) {
+    while (!self.mark_stack.empty() && !self.prefetch_fifo.full()) {
+      intptr_t *obj_ptr = self.mark_stack.back();
+      self.mark_stack.pop_back();
+      self.prefetch_fifo.push(obj_ptr, obj_ptr - 1);
+    }
+
+    intptr_t *obj_ptr = self.prefetch_fifo.pop();
+    uint32_t head = *(obj_ptr - 1);
+    self.live_objects++;
+    self.live_words += HeaderLayout::SizeWords(head);
+
+    HeaderLayout::ForEachChild(
+        obj_ptr, head, [&](intptr_t *child) { mark_obj(self, child); });
+
+    // Share half of a long mark stack with the idle workers
+    if (self.mark_stack.size() >= 64 && threads->Size() > 1 && num_idle > 0) {
+      std::lock_guard<std::mutex> guard(self.lock);
+      if (self.shared.empty()) {
+        size_t half = self.mark_stack.size() / 2;
+        self.shared.assign(self.mark_stack.begin(),
+                           self.mark_stack.begin() + half);
+        self.mark_stack.erase(self.mark_stack.begin(),
+                              self.mark_stack.begin() + half);
+        num_shared += half;
       }
-      root_hashset.insert(field_ptr);
-      // recursively check its fields
-      trace_obj_fields(field_ptr, root_hashset);
     }
+  }
+}
 
-    bitvector >>= 1;
+bool GcMarkSweep::steal_grey_objects(int worker) {
+  MarkWorker &self = mark_workers[worker];
+  int num_workers = threads->Size();
+
+  for (int i = 0; i < num_workers && num_shared > 0; i++) {
+    MarkWorker &victim = mark_workers[(worker + i) % num_workers];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (victim.shared.empty()) continue;
+
+    // Take half, or all of a worker's own objects
+    size_t count = &victim == &self ? victim.shared.size()
+                                    : (victim.shared.size() + 1) / 2;
+    self.mark_stack.insert(self.mark_stack.end(), victim.shared.end() - count,
+                           victim.shared.end());
+    victim.shared.resize(victim.shared.size() - count);
+    num_shared -= count;
+    return true;
   }
+
+  return false;
 }
 
+void GcMarkSweep::mark_obj(MarkWorker &worker, intptr_t *obj_ptr) {
+  if (!try_mark(obj_ptr)) return;
+  size_t index = obj_ptr - 1 - heap_space;
+  if (test_bit(atomic_bits, index)) {
+    // nothing to trace, and the object is not even read
+    worker.live_objects++;
+    worker.live_words += block_words_at(index);
+    return;
+  }
+  if (worker.mark_stack.size() < GC_MARK_STACK_CAPACITY) {
+    worker.mark_stack.push_back(obj_ptr);
+  } else {
+    // the stack is full, trace what the object reaches without it
+    mark_reversing(worker, obj_ptr);
+  }
+}
 
-void GcMarkSweep::coalesce_free_list() {
-  // For every block in the free_list, check if its next abutting block is free.
-  // If so, merge this block with its next abutting block. Else, check next
-  // block in the free_list.
-  std::cout << "Before coalesce: "
-            << "free size = " << free_size
-            << ", #free block = " << free_list.size() 
-            << std::endl;
+bool GcMarkSweep::try_mark(intptr_t *obj_ptr) {
+  size_t index = obj_ptr - 1 - heap_space;
+  if (threads->Size() == 1) {
+    // no other thread is marking, so the mark bit can be set without the
+    // cost of an atomic instruction
+    if (test_bit(mark_bits, index)) return false;
+    set_bit(mark_bits, index);
+    return true;
+  }
+  return test_and_set_bit(mark_bits, index);
+}
 
-  for (auto iter = free_list.begin(); iter != free_list.end();) {
-    intptr_t* abutting_block_addr = iter->first + iter->second;
+size_t GcMarkSweep::block_words_at(size_t index) const {
+  size_t next = index + 1;
+  if (next >= (size_t) heap_size) return heap_size - index;
+  size_t word = next / 32;
+  uint32_t bits = start_bits[word] & (~0u << (next % 32));
+  while (bits == 0 && ++word < start_bits.size()) bits = start_bits[word];
+  if (bits == 0) return heap_size - index;
+  return word * 32 + __builtin_ctz(bits) - index;
+}
 
-    if (free_map.find(abutting_block_addr) != free_map.end()) {
-      auto abutting_block_iter = free_map[abutting_block_addr];
-      iter->second += abutting_block_iter->second;
-      free_map.erase(abutting_block_addr);
-      free_list.erase(abutting_block_iter);
+void GcMarkSweep::mark_reversing(MarkWorker &worker, intptr_t *obj_ptr) {
+  // The mark bits of the fields share bitmap words with the mark bits of
+  // other objects, which other threads may be setting
+  bool atomic = threads->Size() > 1;
+  auto field_bit = [&](intptr_t *field) {
+    size_t index = field - heap_space;
+    uint32_t bits = __atomic_load_n(&mark_bits[index / 32], __ATOMIC_RELAXED);
+    return (bits & (1u << (index % 32))) != 0;
+  };
+  auto flip_field_bit = [&](intptr_t *field) {
+    size_t index = field - heap_space;
+    uint32_t bit = 1u << (index % 32);
+    if (atomic) {
+      __atomic_fetch_xor(&mark_bits[index / 32], bit, __ATOMIC_RELAXED);
     } else {
-      iter++;
+      mark_bits[index / 32] ^= bit;
     }
+  };
+
+  // 'prev' is the object the traversal came from, whose field on the way
+  // to 'curr' points back to the object before it
+  intptr_t *prev = NULL, *curr = obj_ptr;
+  int field = 0;
+  worker.live_objects++;
+  worker.live_words += obj_size(*(curr - 1));
+
+  while (true) {
+    uint32_t head = *(curr - 1);
+    int num_fields = std::min((int) HeaderLayout::NumFields(head), 23);
+    uint32_t bitvector = HeaderLayout::PointerBits(head);
+
+    // Look for the next pointer field to an object that is not marked yet
+    intptr_t *child = NULL;
+    for (; field < num_fields; field++) {
+      if ((bitvector & (1u << field)) == 0) continue;
+      intptr_t *field_ptr = (intptr_t*) *(curr + field);
+      if (field_ptr == NULL || !try_mark(field_ptr)) continue;
+      size_t index = field_ptr - 1 - heap_space;
+      if (test_bit(atomic_bits, index)) {
+        // nothing to go down into
+        worker.live_objects++;
+        worker.live_words += block_words_at(index);
+        continue;
+      }
+      child = field_ptr;
+      break;
+    }
+
+    if (child != NULL) {
+      // Go down into the child, leaving the way back in the field
+      flip_field_bit(curr + field);
+      *(curr + field) = (intptr_t) prev;
+      prev = curr;
+      curr = child;
+      field = 0;
+      worker.live_objects++;
+      worker.live_words += obj_size(*(curr - 1));
+      continue;
+    }
+
+    if (prev == NULL) return;
+
+    // Go back up, restoring the field of 'prev' that led to 'curr'
+    int prev_field = 0;
+    while (!field_bit(prev + prev_field)) prev_field++;
+    flip_field_bit(prev + prev_field);
+    intptr_t *next_prev = (intptr_t*) *(prev + prev_field);
+    *(prev + prev_field) = (intptr_t) curr;
+    curr = prev;
+    prev = next_prev;
+    field = prev_field + 1;
   }
+}
+
+void GcMarkSweep::sweep() {
+  for (size_t c = 0; c < chunks.size(); c++) {
+    chunk_states[c] = kUnswept;
+    chunks[c].published = false;
+  }
+  num_published = 0;
+  chunks_merged = false;
+  free_size = 0;
+  first_alloc_chunk = 0;
+  next_chunk = 0;
+
+  if (sweeper.joinable()) {
+    // The allocator publishes the chunks as it reaches them
+    {
+      std::lock_guard<std::mutex> guard(sweeper_lock);
+      sweep_requested = true;
+    }
+    sweeper_cv.notify_one();
+  } else {
+    threads->Run([this](int) { sweep_chunks(); });
+    publish_all_chunks();
+    merge_chunks();
+  }
+}
+
+void GcMarkSweep::sweep_young() {
+  for (size_t c = 0; c < chunks.size(); c++) {
+    if (chunks[c].has_young) chunk_states[c] = kUnswept;
+  }
+  next_chunk = 0;
+  threads->Run([this](int) { sweep_chunks(); });
+
+  // The other chunks have not changed since their last sweep
+  free_size = 0;
+  for (const Chunk &chunk : chunks) free_size += chunk.free_words;
+  first_alloc_chunk = 0;
+  merge_chunks();
+}
+
+void GcMarkSweep::scan_dirty_cards() {
+  const ptrdiff_t kCardWords = ((ptrdiff_t) 1 << kCardShift) / sizeof(intptr_t);
+  // An object that reaches into a card starts at most this many words
+  // before it: 255 fields and the header
+  const size_t kMaxObjectWords = 256;
+  uintptr_t first_card = (uintptr_t) heap_space >> kCardShift;
+  uintptr_t last_card = (uintptr_t) (heap_space + heap_size - 1) >> kCardShift;
+
+  for (uintptr_t card = first_card; card <= last_card; card++) {
+    if (cards[card] == 0) continue;
+    // The first and the last card may cover memory of another heap in
+    // card_table, they stay dirty and are scanned every time
+    if (card != first_card && card != last_card) cards[card] = 0;
+
+    // The words of the heap in the card
+    ptrdiff_t card_start =
+        ((intptr_t*) (card << kCardShift) - heap_space);
+    size_t start = std::max<ptrdiff_t>(card_start, 0);
+    size_t end = std::min<ptrdiff_t>(card_start + kCardWords, heap_size);
+    size_t from = start >= kMaxObjectWords ? start - kMaxObjectWords + 1 : 0;
+
+    // The marked objects are the old ones
+    for (size_t word = from / 32; word * 32 < end; word++) {
+      uint32_t bits = mark_bits[word];
+      if (word == from / 32) bits &= ~0u << (from % 32);
+      for (; bits != 0; bits &= bits - 1) {
+        size_t index = word * 32 + __builtin_ctz(bits);
+        if (index >= end) break;
+        if (test_bit(atomic_bits, index)) continue;
+        int head = *(heap_space + index);
+        if (index + obj_size(head) <= start) continue;
+
+        HeaderLayout::ForEachPointerSlot(
+            heap_space + index + 1, head,
+            [&](intptr_t *slot) { root_set.push_back(slot); });
+      }
+    }
+  }
+}
+
+void GcMarkSweep::clear_cards() {
+  // See scan_dirty_cards about the first and the last card
+  uintptr_t first_card = (uintptr_t) heap_space >> kCardShift;
+  uintptr_t last_card = (uintptr_t) (heap_space + heap_size - 1) >> kCardShift;
+  if (last_card > first_card + 1) {
+    memset(cards + first_card + 1, 0, last_card - first_card - 1);
+  }
+}
+
+void GcMarkSweep::sweep_chunks() {
+  for (size_t c = next_chunk++; c < chunks.size(); c = next_chunk++) {
+    uint8_t unswept = kUnswept;
+    if (chunk_states[c].compare_exchange_strong(unswept, kSweeping)) {
+      sweep_chunk(c);
+      chunk_states[c] = kSwept;
+    }
+  }
+}
+
+void GcMarkSweep::publish_chunk(size_t chunk_num) {
+  uint8_t unswept = kUnswept;
+  if (chunk_states[chunk_num].compare_exchange_strong(unswept, kSweeping)) {
+    sweep_chunk(chunk_num);
+    chunk_states[chunk_num] = kSwept;
+  } else {
+    while (chunk_states[chunk_num] != kSwept) std::this_thread::yield();
+  }
+
+  chunks[chunk_num].published = true;
+  free_size += chunks[chunk_num].free_words;
+  num_published++;
+}
+
+void GcMarkSweep::publish_all_chunks() {
+  for (size_t c = 0; c < chunks.size(); c++) {
+    if (!chunks[c].published) publish_chunk(c);
+  }
+}
+
+void GcMarkSweep::merge_chunks() {
+  // Free blocks at the end of a chunk may abut free blocks at the start of
+  // the next chunks. 'carry' is the last free block seen so far that may be
+  // extended, 'carry_chunk' the chunk it belongs to. The blocks recorded by
+  // the sweep may have been allocated from since, so they are checked again.
+  Chunk *carry_chunk = NULL;
+  intptr_t *carry = NULL;
+  chunks_merged = true;
+
+  for (Chunk &chunk : chunks) {
+    if (!chunk.has_blocks) continue;
+
+    intptr_t *first = chunk.first_free;
+    if (carry != NULL && first != NULL && is_free_block(*first)
+        && carry + free_block_size(*carry) == first) {
+      int carry_size = free_block_size(*carry);
+      int first_size = free_block_size(*first);
+
+      // Free blocks are on their chunk's free list if they have at least
+      // two words, 'first' is its head then
+      if (first_size >= 2) chunk.free_list = (intptr_t*) *(first + 1);
+      clear_bit(start_bits, first - heap_space);
+      *carry = free_block_head(carry_size + first_size);
+      // the words now belong to the chunk of the carry, minor collections
+      // add up the free words of chunks they have not swept
+      carry_chunk->free_words += first_size;
+      chunk.free_words -= first_size;
+
+      if (carry_size < 2) {
+        intptr_t **link = &carry_chunk->free_list;
+        while (*link != NULL) link = (intptr_t**) (*link + 1);
+        *link = carry;
+        *(carry + 1) = 0;
+      }
+
+      // the merged block may reach into the next chunk as well
+      if (chunk.last_free == first) {
+        // it was the only block of the chunk
+        chunk.has_blocks = false;
+        chunk.first_free = chunk.last_free = NULL;
+        continue;
+      }
+      chunk.first_free = NULL;
+    }
+
+    carry = chunk.last_free;
+    if (carry != NULL && !is_free_block(*carry)) carry = NULL;
+    carry_chunk = &chunk;
+  }
+}
+
+intptr_t* GcMarkSweep::chunk_end(size_t chunk_num) {
+  return heap_space + std::min((chunk_num + 1) * kChunkWords,
+                               (size_t) heap_size);
+}
+
+intptr_t* GcMarkSweep::first_block_in_chunk(size_t chunk_num) {
+  size_t first_word = chunk_num * kChunkWords / 32;
+  size_t last_word = (chunk_end(chunk_num) - heap_space + 31) / 32;
+
+  for (size_t i = first_word; i < last_word; i++) {
+    if (start_bits[i] != 0) {
+      return heap_space + i * 32 + __builtin_ctz(start_bits[i]);
+    }
+  }
+  return NULL;
+}
+
+void GcMarkSweep::sweep_chunk(size_t chunk_num) {
+  Chunk &chunk = chunks[chunk_num];
+  chunk.free_list = chunk.first_free = chunk.last_free = NULL;
+  chunk.has_blocks = false;
+  chunk.has_young = false;
+  chunk.free_words = 0;
+
+  intptr_t *end_of_chunk = chunk_end(chunk_num);
+  intptr_t *block = first_block_in_chunk(chunk_num);
+  if (block == NULL || block >= end_of_chunk) return;
+
+  chunk.has_blocks = true;
+  intptr_t **link = &chunk.free_list;
+  bool first_block = true;
+
+  while (block < end_of_chunk) {
+    // Skip over the live objects, clearing their mark bits for the next
+    // collection unless they stay marked as old objects
+    size_t index = block - heap_space;
+    if (!is_free_block(*block) && test_bit(mark_bits, index)) {
+      if (!generational) clear_bit(mark_bits, index);
+      block += obj_size(*block);
+      first_block = false;
+      continue;
+    }
+
+    // Merge the run of dead objects and free blocks starting here into a
+    // single free block. Only blocks that start in this chunk are merged,
+    // the ones in the next chunk belong to another thread.
+    intptr_t *end = block + block_size(*block);
+    while (end < end_of_chunk) {
+      index = end - heap_space;
+      if (!is_free_block(*end) && test_bit(mark_bits, index)) break;
+      clear_bit(start_bits, index);
+      end += block_size(*end);
+    }
+
+    int size = end - block;
+    *block = free_block_head(size);
+    chunk.free_words += size;
+    if (size >= 2) {
+      *link = block;
+      link = (intptr_t**) (block + 1);
+    }
+    if (first_block) chunk.first_free = block;
+    if (end >= end_of_chunk) chunk.last_free = block;
+    first_block = false;
+    block = end;
+  }
+
+  *link = NULL;
+}
+
+void GcMarkSweep::sweeper_loop() {
+  in_collector = true;
+  std::unique_lock<std::mutex> guard(sweeper_lock);
+
+  while (true) {
+    sweeper_cv.wait(guard, [this] {
+      return sweep_requested || sweeper_stopping;
+    });
+    if (sweeper_stopping) return;
+    sweep_requested = false;
+
+    guard.unlock();
+    sweep_chunks();
+    guard.lock();
+  }
+}
+
+/*----------------------------------------------------------------------------*/
+
+// Layout of the count word of GcRefCount: the count above kCountShift, then
+// whether the stack scan in progress found the object on the stack, whether
+// the object is in the zero count table, whether it is buffered as a cycle
+// candidate, and its color.
+enum RcColor { kBlack = 0, kGray = 1, kWhite = 2, kPurple = 3 };
+static const uintptr_t kColorMask = 3;
+static const uintptr_t kBuffered = 4;
+static const uintptr_t kInZct = 8;
+static const uintptr_t kOnStack = 16;
+static const int kCountShift = 5;
+
+static uintptr_t &count_word(intptr_t *obj_ptr) {
+  return *(uintptr_t*) (obj_ptr - 2);
+}
+
+static uintptr_t ref_count(intptr_t *obj_ptr) {
+  return count_word(obj_ptr) >> kCountShift;
+}
+
+static RcColor color(intptr_t *obj_ptr) {
+  return (RcColor) (count_word(obj_ptr) & kColorMask);
+}
+
+static void set_color(intptr_t *obj_ptr, RcColor color) {
+  count_word(obj_ptr) = (count_word(obj_ptr) & ~kColorMask) | color;
+}
+
+static bool test_flag(intptr_t *obj_ptr, uintptr_t flag) {
+  return (count_word(obj_ptr) & flag) != 0;
+}
+
+static void set_flag(intptr_t *obj_ptr, uintptr_t flag, bool value) {
+  if (value) count_word(obj_ptr) |= flag;
+  else count_word(obj_ptr) &= ~flag;
+}
+
+// Objects without pointer fields cannot be part of a cycle.
+static bool may_be_cyclic(intptr_t *obj_ptr) {
+  return HeaderLayout::PointerBits(*(obj_ptr - 1)) != 0;
+}
+
+// Calls 'visit' with every non-NULL pointer field of 'obj_ptr'.
+template <typename Visit>
+static void for_each_child(intptr_t *obj_ptr, Visit visit) {
+  HeaderLayout::ForEachChild(obj_ptr, *(obj_ptr - 1), visit);
+}
+
+GcRefCount::GcRefCount(intptr_t *frame_ptr, int heap_size_in_words,
+                       bool huge_pages) {
+  base_frame_ptr = frame_ptr;
+  heap_size = heap_size_in_words;
+  heap_space = map_heap(heap_size, huge_pages);
+  bump_ptr = heap_space;
+  heap_end = heap_space + heap_size;
+  free_lists.assign(kMaxBlockWords + 1, NULL);
+  __atomic_fetch_add(&write_barrier_active, 1, __ATOMIC_RELAXED);
+}
+
+GcRefCount::~GcRefCount() {
+  __atomic_fetch_sub(&write_barrier_active, 1, __ATOMIC_RELAXED);
+  unmap_heap(heap_space);
+}
+
+intptr_t* GcRefCount::Alloc(int32_t num_words, intptr_t *curr_frame_ptr) {
+  // New objects go to the zero count table, so it fills up at the rate of
+  // allocation and the stack is scanned every kZctCapacity allocations.
+  if (zct.size() >= kZctCapacity) {
+    collect(curr_frame_ptr, candidates.size() >= kCandidatesCapacity);
+  }
+
+  intptr_t *obj_ptr = allocate_memory(num_words);
+  if (obj_ptr == NULL) {
+    collect(curr_frame_ptr, /*with_cycles=*/true);
+    obj_ptr = allocate_memory(num_words);
+  }
+  if (obj_ptr == NULL) {
+    start_pause();
+    merge_free_blocks();
+    end_pause(/*ends_collection=*/false);
+    obj_ptr = allocate_memory(num_words);
+    if (obj_ptr == NULL) throw OutOfMemoryError();
+  }
+
+  count_word(obj_ptr) = kInZct;
+  zct.push_back(obj_ptr);
+  *(obj_ptr - 1) = HeaderLayout::ProvisionalHeader(num_words);
+
+  num_live_objects++;
+  num_live_words += num_words + 1;
+  return obj_ptr;
+}
+
+const char* GcRefCount::Name() const {
+  return "refcount";
+}
+
+void GcRefCount::WriteBarrier(intptr_t *slot, intptr_t *value) {
+  intptr_t *old_value = (intptr_t*) *slot;
+  // Increment first, in case both are the same object
+  if (value != NULL) increment(value);
+  *slot = (intptr_t) value;
+  if (old_value != NULL) decrement(old_value);
+}
+
+intptr_t* GcRefCount::allocate_memory(int32_t num_words) {
+  int block_size = num_words + 2;
+
+  intptr_t *block = free_lists[block_size];
+  if (block != NULL) {
+    free_lists[block_size] = (intptr_t*) *block;
+    return block + 2;
+  }
+
+  if (heap_end - bump_ptr >= block_size) {
+    block = bump_ptr;
+    bump_ptr += block_size;
+    return block + 2;
+  }
+
+  // Split a larger block, the rest has to be large enough for an object
+  // without fields
+  for (int size = block_size + 2; size <= kMaxBlockWords; size++) {
+    block = free_lists[size];
+    if (block == NULL) continue;
+    free_lists[size] = (intptr_t*) *block;
+    add_free_block(block + block_size, size - block_size);
+    return block + 2;
+  }
+
+  // The same rule for the large blocks. The heap walk finds the size of an
+  // object from its header, so a block cannot be handed out whole with a
+  // word to spare; those are skipped.
+  for (intptr_t **link = &large_blocks; *link != NULL;
+       link = (intptr_t**) *link) {
+    block = *link;
+    int size = block[1] >> 1;
+    if (size < block_size + 2) continue;
+    *link = (intptr_t*) *block;
+    add_free_block(block + block_size, size - block_size);
+    return block + 2;
+  }
+  return NULL;
+}
+
+void GcRefCount::free_object(intptr_t *obj_ptr) {
+  int num_words = HeaderLayout::NumFields(*(obj_ptr - 1));
+  add_free_block(obj_ptr - 2, num_words + 2);
+
+  num_live_objects--;
+  num_live_words -= num_words + 1;
+}
+
+void GcRefCount::add_free_block(intptr_t *block, int size) {
+  intptr_t **list = size <= kMaxBlockWords ? &free_lists[size] : &large_blocks;
+  block[0] = (intptr_t) *list;
+  block[1] = (intptr_t) size << 1;
+  *list = block;
+}
+
+void GcRefCount::merge_free_blocks() {
+  free_lists.assign(kMaxBlockWords + 1, NULL);
+  large_blocks = NULL;
+
+  intptr_t *block = heap_space;
+  while (block < bump_ptr) {
+    if (block[1] & 1) {
+      block += ((uint32_t) block[1] >> 24) + 2;
+      continue;
+    }
+
+    intptr_t *end = block;
+    while (end < bump_ptr && (end[1] & 1) == 0) end += end[1] >> 1;
+    if (end == bump_ptr) {
+      // give the free blocks at the end back to the never allocated part
+      bump_ptr = block;
+    } else {
+      add_free_block(block, end - block);
+    }
+    block = end;
+  }
+}
+
+void GcRefCount::collect(intptr_t *curr_frame_ptr, bool with_cycles) {
+  start_pause();
+
+  // Count the references on the stack now, and uncount those of the last
+  // scan. Objects the program dropped from the stack since then end up in
+  // the zero count table or become cycle candidates.
+  stack_walk(curr_frame_ptr, root_set);
+  new_stack_refs.clear();
+  for (intptr_t *slot : root_set) {
+    intptr_t *obj_ptr = (intptr_t*) *slot;
+    if (obj_ptr == NULL) continue;
+    increment(obj_ptr);
+    set_flag(obj_ptr, kOnStack, true);
+    new_stack_refs.push_back(obj_ptr);
+  }
+  for (intptr_t *obj_ptr : stack_refs) decrement(obj_ptr);
+  stack_refs.swap(new_stack_refs);
+
+  release_zct();
+  for (intptr_t *obj_ptr : stack_refs) set_flag(obj_ptr, kOnStack, false);
+  if (with_cycles) collect_cycles();
+
+  end_pause();
+  ReportGCStats(num_live_objects, num_live_words);
+}
+
+void GcRefCount::increment(intptr_t *obj_ptr) {
+  count_word(obj_ptr) += (uintptr_t) 1 << kCountShift;
+  set_color(obj_ptr, kBlack);
+}
+
+void GcRefCount::decrement(intptr_t *obj_ptr) {
+  count_word(obj_ptr) -= (uintptr_t) 1 << kCountShift;
+
+  if (ref_count(obj_ptr) == 0) {
+    // The stack may still refer to it
+    if (!test_flag(obj_ptr, kInZct)) {
+      set_flag(obj_ptr, kInZct, true);
+      zct.push_back(obj_ptr);
+    }
+  } else {
+    // The reference that is gone may have been the last one from outside a
+    // cycle
+    possible_cycle_root(obj_ptr);
+  }
+}
+
+void GcRefCount::possible_cycle_root(intptr_t *obj_ptr) {
+  if (color(obj_ptr) == kPurple || !may_be_cyclic(obj_ptr)) return;
+  set_color(obj_ptr, kPurple);
+  if (!test_flag(obj_ptr, kBuffered)) {
+    set_flag(obj_ptr, kBuffered, true);
+    candidates.push_back(obj_ptr);
+  }
+}
+
+void GcRefCount::release_zct() {
+  // Freeing an object decrements the objects it points to, which may add
+  // them to the table.
+  while (!zct.empty()) {
+    intptr_t *obj_ptr = zct.back();
+    zct.pop_back();
+    set_flag(obj_ptr, kInZct, false);
+    if (ref_count(obj_ptr) != 0) {
+      // Only referred to from the heap, perhaps only from a cycle. New
+      // objects the program dropped from the stack before any stack scan
+      // saw them are only found this way.
+      if (!test_flag(obj_ptr, kOnStack)) possible_cycle_root(obj_ptr);
+      continue;
+    }
+
+    for_each_child(obj_ptr, [this](intptr_t *child) { decrement(child); });
+    set_color(obj_ptr, kBlack);
+    // A buffered object is freed when the candidates are processed
+    if (!test_flag(obj_ptr, kBuffered)) free_object(obj_ptr);
+  }
+}
+
+void GcRefCount::collect_cycles() {
+  size_t num_roots = 0;
+  for (intptr_t *obj_ptr : candidates) {
+    if (color(obj_ptr) == kPurple && ref_count(obj_ptr) > 0) {
+      mark_gray(obj_ptr);
+      candidates[num_roots++] = obj_ptr;
+    } else {
+      set_flag(obj_ptr, kBuffered, false);
+      if (color(obj_ptr) == kBlack && ref_count(obj_ptr) == 0) {
+        free_object(obj_ptr);
+      }
+    }
+  }
+  candidates.resize(num_roots);
+
+  for (intptr_t *obj_ptr : candidates) scan(obj_ptr);
+
+  // The garbage is only freed at the end, since freeing an object
+  // overwrites its count word while other white objects may still point to
+  // it.
+  garbage.clear();
+  for (intptr_t *obj_ptr : candidates) {
+    set_flag(obj_ptr, kBuffered, false);
+    collect_white(obj_ptr);
+  }
+  candidates.clear();
+  for (intptr_t *obj_ptr : garbage) free_object(obj_ptr);
+}
+
+void GcRefCount::mark_gray(intptr_t *obj_ptr) {
+  if (color(obj_ptr) == kGray) return;
+  set_color(obj_ptr, kGray);
+  work_list.push_back(obj_ptr);
+
+  while (!work_list.empty()) {
+    intptr_t *gray = work_list.back();
+    work_list.pop_back();
+    for_each_child(gray, [this](intptr_t *child) {
+      count_word(child) -= (uintptr_t) 1 << kCountShift;
+      if (color(child) != kGray) {
+        set_color(child, kGray);
+        work_list.push_back(child);
+      }
+    });
+  }
+}
+
+void GcRefCount::scan(intptr_t *obj_ptr) {
+  work_list.push_back(obj_ptr);
+
+  while (!work_list.empty()) {
+    intptr_t *gray = work_list.back();
+    work_list.pop_back();
+    if (color(gray) != kGray) continue;
+
+    if (ref_count(gray) > 0) {
+      // Referred to from outside the subgraph, so is everything it reaches
+      scan_black(gray);
+    } else {
+      set_color(gray, kWhite);
+      for_each_child(gray, [this](intptr_t *child) {
+        work_list.push_back(child);
+      });
+    }
+  }
+}
+
+void GcRefCount::scan_black(intptr_t *obj_ptr) {
+  // Uses its own work list, since scan's may still hold gray objects
+  black_list.push_back(obj_ptr);
+  set_color(obj_ptr, kBlack);
+
+  while (!black_list.empty()) {
+    intptr_t *black = black_list.back();
+    black_list.pop_back();
+    for_each_child(black, [this](intptr_t *child) {
+      count_word(child) += (uintptr_t) 1 << kCountShift;
+      if (color(child) != kBlack) {
+        set_color(child, kBlack);
+        black_list.push_back(child);
+      }
+    });
+  }
+}
+
+void GcRefCount::collect_white(intptr_t *obj_ptr) {
+  if (color(obj_ptr) != kWhite || test_flag(obj_ptr, kBuffered)) return;
+  set_color(obj_ptr, kBlack);
+  work_list.push_back(obj_ptr);
+
+  while (!work_list.empty()) {
+    intptr_t *white = work_list.back();
+    work_list.pop_back();
+    garbage.push_back(white);
+    for_each_child(white, [this](intptr_t *child) {
+      if (color(child) == kWhite && !test_flag(child, kBuffered)) {
+        set_color(child, kBlack);
+        work_list.push_back(child);
+      }
+    });
+  }
+}
+
+
+/*----------------------------------------------------------------------------*/
+
+GcBibop::GcBibop(intptr_t *frame_ptr, int heap_size_in_words,
+                 bool huge_pages) {
+  base_frame_ptr = frame_ptr;
+  heap_size = heap_size_in_words;
+  heap_space = map_heap(heap_size, huge_pages);
+  mark_bits.resize((heap_size + 31) / 32);
+
+  // Pages are a power of two words so that the page of an object is found
+  // with a shift. The words after the last whole page are not used.
+  page_shift = 0;
+  while ((1 << page_shift) < kMaxPageWords) page_shift++;
+  while (page_shift > 2 && (heap_size >> page_shift) < kMinPages) page_shift--;
+  page_words = 1 << page_shift;
+  pages.resize(heap_size >> page_shift);
+  num_free_pages = pages.size();
+}
+
+GcBibop::~GcBibop() {
+  unmap_heap(heap_space);
+}
+
+intptr_t* GcBibop::Alloc(int32_t num_words, intptr_t *curr_frame_ptr) {
+  intptr_t *obj_ptr = allocate_headered(num_words);
+  if (obj_ptr == NULL) {
+    collect(curr_frame_ptr);
+    obj_ptr = allocate_headered(num_words);
+    if (obj_ptr == NULL) throw OutOfMemoryError();
+  }
+  return obj_ptr;
+}
+
+intptr_t* GcBibop::AllocTyped(uint32_t tag, intptr_t *curr_frame_ptr) {
+  int num_fields = tag >> 24;
+  if (num_fields > page_words / 4) return Gc::AllocTyped(tag, curr_frame_ptr);
+
+  // A struct without fields still needs a slot for its own address
+  int slot_words = std::max(num_fields, 1);
+  intptr_t *obj_ptr = allocate_slot(tag, tag, slot_words);
+  if (obj_ptr == NULL) {
+    collect(curr_frame_ptr);
+    obj_ptr = allocate_slot(tag, tag, slot_words);
+    if (obj_ptr == NULL) throw OutOfMemoryError();
+  }
+  return obj_ptr;
+}
+
+intptr_t GcBibop::HeaderOf(intptr_t *obj_ptr) const {
+  const Page &page = page_of(obj_ptr);
+  return page.tag != 0 ? page.tag : *(obj_ptr - 1);
+}
+
+const char* GcBibop::Name() const {
+  return "bibop";
+}
+
+intptr_t* GcBibop::allocate_slot(uint32_t size_class, uint32_t tag,
+                                 int slot_words) {
+  // Programs mostly allocate a few types in a row, so the last size class
+  // saves most lookups
+  if (size_class != last_size_class || last_partial == NULL) {
+    last_size_class = size_class;
+    last_partial = &partial_pages[size_class];
+  }
+  std::vector<size_t> &partial = *last_partial;
+  if (partial.empty()) {
+    long page_num = take_free_pages(1);
+    if (page_num < 0) return NULL;
+
+    Page &page = pages[page_num];
+    page.kind = kSmallPage;
+    page.tag = tag;
+    page.slot_words = slot_words;
+    // Link the slots in address order
+    intptr_t *page_start = heap_space + (page_num << page_shift);
+    int num_slots = page_words / slot_words;
+    page.free_slots = NULL;
+    for (int i = num_slots - 1; i >= 0; i--) {
+      intptr_t *slot = page_start + i * slot_words;
+      *slot = (intptr_t) page.free_slots;
+      page.free_slots = slot;
+    }
+    partial.push_back(page_num);
+  }
+
+  Page &page = pages[partial.back()];
+  intptr_t *slot = page.free_slots;
+  page.free_slots = (intptr_t*) *slot;
+  if (page.free_slots == NULL) partial.pop_back();
+
+  // The fields of an object without a header are traced as soon as it is
+  // allocated, so they must not hold the pointers of a dead object.
+  memset(slot, 0, slot_words * sizeof(intptr_t));
+  return slot;
+}
+
+intptr_t* GcBibop::allocate_headered(int32_t num_words) {
+  int block_words = num_words + 1;
+  intptr_t *block;
+  if (block_words <= page_words / 2) {
+    block = allocate_slot((uint32_t) block_words << 1, 0, block_words);
+    if (block == NULL) return NULL;
+  } else {
+    int num_pages = (block_words + page_words - 1) / page_words;
+    long page_num = take_free_pages(num_pages);
+    if (page_num < 0) return NULL;
+
+    pages[page_num].kind = kLargePage;
+    pages[page_num].tag = 0;
+    pages[page_num].slot_words = num_pages;
+    for (int i = 1; i < num_pages; i++) pages[page_num + i].kind = kLargeTail;
+    block = heap_space + (page_num << page_shift);
+  }
+
+  *block = HeaderLayout::ProvisionalHeader(num_words);
+  return block + 1;
+}
+
+long GcBibop::take_free_pages(int num_pages) {
+  if (num_pages > num_free_pages) return -1;
+
+  while (first_free_page < pages.size() &&
+         pages[first_free_page].kind != kFreePage) {
+    first_free_page++;
+  }
+
+  size_t run_start = first_free_page;
+  for (size_t p = first_free_page; p < pages.size(); p++) {
+    if (pages[p].kind != kFreePage) {
+      run_start = p + 1;
+    } else if (p + 1 - run_start == (size_t) num_pages) {
+      num_free_pages -= num_pages;
+      return run_start;
+    }
+  }
+  return -1;
+}
+
+void GcBibop::free_page(size_t page_num) {
+  pages[page_num] = Page();
+  num_free_pages++;
+  if (page_num < first_free_page) first_free_page = page_num;
+}
+
+void GcBibop::collect(intptr_t *curr_frame_ptr) {
+  start_pause();
+  // Prepare the root set by walking the stack
+  stack_walk(curr_frame_ptr, root_set);
+
+  for (intptr_t *root : root_set) {
+    if (*root != 0) mark_obj((intptr_t*) *root);
+  }
+
+  while (!mark_stack.empty()) {
+    intptr_t *obj_ptr = mark_stack.back();
+    mark_stack.pop_back();
+
+    const Page &page = page_of(obj_ptr);
+    uint32_t head = page.tag != 0 ? page.tag : *(obj_ptr - 1);
+
+    num_obj_left++;
+    num_word_left += HeaderLayout::NumFields(head) + (page.tag != 0 ? 0 : 1);
+
+    HeaderLayout::ForEachChild(
+        obj_ptr, head, [&](intptr_t *child) { mark_obj(child); });
+  }
+
+  sweep();
+  end_pause();
+
+  // Report Gc status
+  ReportGCStats(num_obj_left, num_word_left);
+  num_obj_left = 0;
+  num_word_left = 0;
+}
+
+void GcBibop::mark_obj(intptr_t *obj_ptr) {
+  size_t index = obj_ptr - heap_space;
+  if (test_bit(mark_bits, index)) return;
+  set_bit(mark_bits, index);
+  mark_stack.push_back(obj_ptr);
+}
+
+void GcBibop::sweep() {
+  for (auto &size_class : partial_pages) size_class.second.clear();
+
+  // Pages are visited from the end so that the partial pages are used in
+  // address order
+  for (size_t p = pages.size(); p-- > 0;) {
+    Page &page = pages[p];
+    intptr_t *page_start = heap_space + (p << page_shift);
+
+    if (page.kind == kLargePage) {
+      size_t index = page_start + 1 - heap_space;
+      if (test_bit(mark_bits, index)) {
+        clear_bit(mark_bits, index);
+      } else {
+        int num_pages = page.slot_words;
+        for (int i = 0; i < num_pages; i++) free_page(p + i);
+      }
+    } else if (page.kind == kSmallPage) {
+      // Headered objects start one word into their slot
+      int obj_offset = page.tag != 0 ? 0 : 1;
+      int num_slots = page_words / page.slot_words;
+      bool has_live = false;
+      page.free_slots = NULL;
+      for (int i = num_slots - 1; i >= 0; i--) {
+        intptr_t *slot = page_start + i * page.slot_words;
+        size_t index = slot + obj_offset - heap_space;
+        if (test_bit(mark_bits, index)) {
+          clear_bit(mark_bits, index);
+          has_live = true;
+        } else {
+          *slot = (intptr_t) page.free_slots;
+          page.free_slots = slot;
+        }
+      }
+
+      if (!has_live) {
+        free_page(p);
+      } else if (page.free_slots != NULL) {
+        uint32_t size_class =
+            page.tag != 0 ? page.tag : (uint32_t) page.slot_words << 1;
+        partial_pages[size_class].push_back(p);
+      }
+    }
+  }
+}
+
+
+/*----------------------------------------------------------------------------*/
+
+GcHybrid::GcHybrid(intptr_t *frame_ptr, int heap_size_in_words,
+                   bool huge_pages) {
+  base_frame_ptr = frame_ptr;
+  heap_size = heap_size_in_words;
+  heap_space = map_heap(heap_size, huge_pages);
+  heap_end = heap_space + heap_size;
+  from_space = heap_space;
+  to_space = heap_space + heap_size / 2;
+  bump_ptr = from_space;
+  alloc_end = to_space;
+
+  size_t bitmap_words = (heap_size + 31) / 32;
+  mark_bits.resize(bitmap_words);
+  live_bits.resize(bitmap_words);
+  live_before.resize(bitmap_words);
+}
+
+GcHybrid::~GcHybrid() {
+  unmap_heap(heap_space);
+}
+
+intptr_t* GcHybrid::Alloc(int32_t num_words, intptr_t *curr_frame_ptr) {
+  intptr_t *obj_ptr = allocate_memory(num_words);
+  if (obj_ptr == NULL) {
+    collect(curr_frame_ptr, num_words);
+    obj_ptr = allocate_memory(num_words);
+    if (obj_ptr == NULL) throw OutOfMemoryError();
+  }
+
+  *(obj_ptr - 1) = HeaderLayout::ProvisionalHeader(num_words);
+  return obj_ptr;
+}
+
+intptr_t* GcHybrid::AllocBuffer(int32_t min_words, int32_t *num_words,
+                                intptr_t *curr_frame_ptr) {
+  intptr_t *obj_ptr = allocate_memory(min_words - 1);
+  if (obj_ptr == NULL) {
+    collect(curr_frame_ptr, min_words - 1);
+    obj_ptr = allocate_memory(min_words - 1);
+    if (obj_ptr == NULL) throw OutOfMemoryError();
+  }
+
+  // The buffer goes on as far as the current block does
+  int32_t extra_words =
+      std::min<intptr_t>(*num_words - min_words, alloc_end - bump_ptr);
+  bump_ptr += extra_words;
+  if (mode == kMarkSweep) free_words -= extra_words;
+  *num_words = min_words + extra_words;
+  return obj_ptr - 1;
+}
+
+void GcHybrid::FillBuffer(intptr_t *begin, intptr_t *end) {
+  if (begin < end) *begin = free_block_head(end - begin);
+}
+
+const char* GcHybrid::Name() const {
+  return "hybrid";
+}
+
+intptr_t* GcHybrid::allocate_memory(int32_t num_words) {
+  int target_size = num_words + 1;
+  if (alloc_end - bump_ptr < target_size) {
+    if (mode == kCopying) return NULL;
+
+    // Give up the rest of the current block. It stays in the heap as a free
+    // block and goes back to the free list if it can be linked.
+    int leftover_size = alloc_end - bump_ptr;
+    if (leftover_size > 0) *bump_ptr = free_block_head(leftover_size);
+    if (leftover_size >= 2) {
+      *(bump_ptr + 1) = (intptr_t) free_list;
+      free_list = bump_ptr;
+    }
+    bump_ptr = alloc_end = NULL;
+
+    // First fit algorithm
+    intptr_t **link = &free_list;
+    intptr_t *block = free_list;
+    while (block != NULL && free_block_size(*block) < target_size) {
+      link = (intptr_t**) (block + 1);
+      block = *link;
+    }
+    if (block == NULL) return NULL;
+    *link = (intptr_t*) *(block + 1);
+    bump_ptr = block;
+    alloc_end = block + free_block_size(*block);
+  }
+
+  intptr_t *obj_ptr = bump_ptr + 1;
+  bump_ptr += target_size;
+  if (mode == kMarkSweep) free_words -= target_size;
+  return obj_ptr;
+}
+
+void GcHybrid::collect(intptr_t *curr_frame_ptr, int32_t num_words) {
+  start_pause();
+  // Prepare the root set by walking the stack
+  stack_walk(curr_frame_ptr, root_set);
+  size_t target_size = num_words + 1;
+
+  if (mode == kCopying) {
+    size_t used_words = std::max<size_t>(bump_ptr - from_space, 1);
+    copy_from_roots();
+    survival = (survival + (double) num_word_left / used_words) / 2;
+
+    // With much of the semispace surviving, mark-sweep collects less often,
+    // having the whole heap for the program
+    if (survival > kMaxCopySurvival ||
+        (size_t) (alloc_end - bump_ptr) < target_size) {
+      switch_to_mark_sweep();
+      if ((size_t) (alloc_end - bump_ptr) < target_size &&
+          from_space != heap_space && (size_t) heap_size / 2 < target_size) {
+        // Only the free blocks on both sides of the copies together are
+        // large enough
+        if (alloc_end > bump_ptr) {
+          *bump_ptr = free_block_head(alloc_end - bump_ptr);
+        }
+        bump_ptr = slide();
+        alloc_end = heap_end;
+        free_list = NULL;
+      }
+    }
+  } else {
+    // The unallocated part of the current block is a free block
+    if (alloc_end > bump_ptr) *bump_ptr = free_block_head(alloc_end - bump_ptr);
+    size_t used_words = std::max<size_t>(heap_size - free_words, 1);
+
+    mark_from_roots();
+    size_t largest_block = sweep();
+    survival = (survival + (double) num_word_left / used_words) / 2;
+    double unusable = free_words == 0
+        ? 0 : 1 - (double) largest_block / free_words;
+    fragmentation = (fragmentation + unusable) / 2;
+
+    // Switch back to copying only if the live objects would leave most of a
+    // semispace free, otherwise the next copying collection would switch
+    // right back
+    bool copying_pays =
+        num_word_left + target_size <= heap_size / 2 * kMaxCopySurvival &&
+        (survival < kMinSweepSurvival || fragmentation > kMaxFragmentation);
+    if (copying_pays) {
+      mode = kCopying;
+      from_space = heap_space;
+      to_space = heap_space + heap_size / 2;
+      bump_ptr = slide();
+      alloc_end = to_space;
+      survival = fragmentation = 0;
+    } else if (largest_block < target_size &&
+               num_word_left + target_size <= (size_t) heap_size) {
+      // The object only fits once the free blocks are joined
+      bump_ptr = slide();
+      alloc_end = heap_end;
+      free_list = NULL;
+    }
+  }
+
+  end_pause();
+
+  // Report Gc status
+  ReportGCStats(num_obj_left, num_word_left);
+  num_obj_left = 0;
+  num_word_left = 0;
+}
+
+void GcHybrid::copy_from_roots() {
+  intptr_t *scan_ptr = to_space;
+  bump_ptr = to_space;
+
+  for (intptr_t *root : root_set) {
+    if (*root != 0) forward_slot(root);
+  }
+
+  // Scan the copies in breadth-first order until everything reachable has
+  // been copied
+  while (scan_ptr < bump_ptr) {
+    uint32_t head = *scan_ptr;
+    intptr_t *obj_ptr = scan_ptr + 1;
+
+    HeaderLayout::ForEachPointerSlot(obj_ptr, head, [&](intptr_t *slot) {
+      if (*slot != 0) forward_slot(slot);
+    });
+    scan_ptr = obj_ptr + HeaderLayout::NumFields(head);
+  }
+
+  // swap from and to
+  intptr_t *tmp_space = from_space;
+  from_space = to_space;
+  to_space = tmp_space;
+  alloc_end = from_space + heap_size / 2;
+}
+
+void GcHybrid::forward_slot(intptr_t *slot) {
+  intptr_t *from_obj_ptr = (intptr_t*) *slot;
+  intptr_t head = *(from_obj_ptr - 1);
+
+  // A copied object's header is the address of its copy
+  if (is_free_block(head)) {
+    *slot = head;
+    return;
+  }
+
+  int size = obj_size(head);
+  memcpy(bump_ptr, from_obj_ptr - 1, sizeof(intptr_t) * size);
+  intptr_t *to_obj_ptr = bump_ptr + 1;
+  bump_ptr += size;
+
+  num_obj_left++;
+  num_word_left += size;
+
+  *(from_obj_ptr - 1) = (intptr_t) to_obj_ptr;
+  *slot = (intptr_t) to_obj_ptr;
+}
+
+void GcHybrid::switch_to_mark_sweep() {
+  mode = kMarkSweep;
+  survival = fragmentation = 0;
+
+  // The copies are at the start of the from space, everything around them
+  // is free. The program goes on allocating after the copies.
+  free_list = NULL;
+  if (from_space != heap_space) {
+    *heap_space = free_block_head(from_space - heap_space);
+    *(heap_space + 1) = (intptr_t) NULL;
+    free_list = heap_space;
+  }
+  alloc_end = heap_end;
+  free_words = heap_end - bump_ptr + (from_space - heap_space);
+}
+
+void GcHybrid::mark_from_roots() {
+  for (intptr_t *root : root_set) {
+    if (*root != 0) mark_obj((intptr_t*) *root);
+  }
+
+  while (!mark_stack.empty()) {
+    intptr_t *obj_ptr = mark_stack.back();
+    mark_stack.pop_back();
+
+    uint32_t head = *(obj_ptr - 1);
+
+    num_obj_left++;
+    num_word_left += HeaderLayout::SizeWords(head);
+
+    HeaderLayout::ForEachChild(
+        obj_ptr, head, [&](intptr_t *child) { mark_obj(child); });
+  }
+}
+
+void GcHybrid::mark_obj(intptr_t *obj_ptr) {
+  size_t index = obj_ptr - 1 - heap_space;
+  if (test_bit(mark_bits, index)) return;
+  set_bit(mark_bits, index);
+  mark_stack.push_back(obj_ptr);
+}
+
+size_t GcHybrid::sweep() {
+  free_list = NULL;
+  intptr_t **link = &free_list;
+  free_words = 0;
+  size_t largest_block = 0;
+
+  intptr_t *block = heap_space;
+  while (block < heap_end) {
+    size_t index = block - heap_space;
+    if (!is_free_block(*block) && test_bit(mark_bits, index)) {
+      clear_bit(mark_bits, index);
+      block += obj_size(*block);
+      continue;
+    }
+
+    // Merge the run of dead objects and free blocks starting here
+    intptr_t *end = block + block_size(*block);
+    while (end < heap_end &&
+           (is_free_block(*end) || !test_bit(mark_bits, end - heap_space))) {
+      end += block_size(*end);
+    }
+
+    size_t size = end - block;
+    *block = free_block_head(size);
+    free_words += size;
+    largest_block = std::max(largest_block, size);
+    if (size >= 2) {
+      *link = block;
+      link = (intptr_t**) (block + 1);
+    }
+    block = end;
+  }
+
+  *link = NULL;
+  bump_ptr = alloc_end = NULL;
+  return largest_block;
+}
+
+intptr_t* GcHybrid::slide() {
+  // Set the bits of all words of the live objects and count them
+  std::fill(live_bits.begin(), live_bits.end(), 0);
+  for (intptr_t *block = heap_space; block < heap_end;
+       block += block_size(*block)) {
+    if (is_free_block(*block)) continue;
+    size_t index = block - heap_space;
+    for (int i = 0; i < obj_size(*block); i++) set_bit(live_bits, index + i);
+  }
+  uint32_t num_live_words = 0;
+  for (size_t i = 0; i < live_bits.size(); i++) {
+    live_before[i] = num_live_words;
+    num_live_words += __builtin_popcount(live_bits[i]);
+  }
+
+  // Point the roots and the fields to the new addresses before anything
+  // moves, then move the objects. An object never moves past the start of
+  // the next one.
+  for (intptr_t *root : root_set) {
+    if (*root != 0) *root = (intptr_t) slid_address((intptr_t*) *root);
+  }
+  for (intptr_t *block = heap_space; block < heap_end;
+       block += block_size(*block)) {
+    if (is_free_block(*block)) continue;
+    HeaderLayout::ForEachPointerSlot(block + 1, *block, [&](intptr_t *slot) {
+      if (*slot != 0) *slot = (intptr_t) slid_address((intptr_t*) *slot);
+    });
+  }
+  intptr_t *block = heap_space;
+  while (block < heap_end) {
+    int size = block_size(*block);
+    if (!is_free_block(*block)) {
+      memmove(slid_address(block + 1) - 1, block, sizeof(intptr_t) * size);
+    }
+    block += size;
+  }
+
+  free_words = heap_size - num_live_words;
+  return heap_space + num_live_words;
+}
 
-  std::cout << "After coalesce: "
-            << "free size = " << free_size
-            << ", #free block = " << free_list.size() 
-            << std::endl;
+intptr_t* GcHybrid::slid_address(intptr_t *obj_ptr) const {
+  size_t index = obj_ptr - 1 - heap_space;
+  uint32_t bits_before = live_bits[index / 32] & ((1u << (index % 32)) - 1);
+  return heap_space + live_before[index / 32] +
+         __builtin_popcount(bits_before) + 1;
 }
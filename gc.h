@@ -1,14 +1,20 @@
 /* Author: Zihao Zhang */
+#pragma once
+
 #include <stdint.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
-#include <map>
-#include <list>
 #include <stdexcept>
-	
+
 
 // Called by the garbage collector after each collection to report the
 // statistics about the heap after garbage collection.
@@ -19,14 +25,401 @@ struct OutOfMemoryError : public std::runtime_error {
   OutOfMemoryError() : runtime_error("Out of memory.") {}
 };
 
+// Number and duration of the collections a collector has run so far. An
+// incremental collection pauses the program many times, once per increment.
+struct GcStats {
+  size_t num_collections = 0;
+  // Collections that only collected the objects allocated since the last
+  // one, included in num_collections
+  size_t num_minor_collections = 0;
+  size_t num_pauses = 0;
+  uint64_t total_pause_ns = 0;
+  uint64_t max_pause_ns = 0;
+};
+
+// Number of incremental collections in progress in the process. The compiled
+// programs check it before every load of a pointer from the heap and call
+// 'read_barrier' with the address of the field while it is not zero.
+extern "C" int32_t read_barrier_active;
+
+// Number of collectors in the process that count references, plus the number
+// of allocation traces being recorded. The compiled programs store pointers
+// into the heap through 'write_barrier' while it is not zero.
+extern "C" int32_t write_barrier_active;
+
+// The address space is divided into cards of 2^kCardShift bytes. While
+// 'card_marking_active' is not zero, the compiled programs set the byte of
+// 'card_table' for the card of every heap field they store a pointer into,
+// which tells generational collections where old objects may point to young
+// ones. The table covers the 32-bit address space of the runtime; 64-bit
+// hosts store through Gc::WriteBarrier, and the collectors keep tables of
+// their own for them.
+const int kCardShift = 9;
+extern "C" uint8_t card_table[];
+
+// Number of generational collectors in the process, which are the only ones
+// that read the cards.
+extern "C" int32_t card_marking_active;
+
+// Told about the pauses of a collector, see Gc::SetPauseListener.
+class GcPauseListener {
+ public:
+  virtual ~GcPauseListener() {}
+  // Called on the thread that pauses, before the pause is timed
+  virtual void PauseStarted() = 0;
+  // Called on the same thread once the pause is timed
+  virtual void PauseEnded() = 0;
+};
+
+// The parts of tracing that do not depend on how a collector allocates and
+// reclaims memory: finding the pointers in an object and in the stack. The
+// collectors call them with their own visitors, which are inlined, so a
+// collector built on them runs the same code as one that decodes the words
+// itself.
+
+// Layout of a struct: a header word (see TypeInfo::tag) with the number of
+// fields in bits 24-31 and a bit per pointer field, starting at bit 1,
+// followed by the fields.
+struct HeaderLayout {
+  static uint32_t NumFields(uint32_t head) { return head >> 24; }
+  // Bit i is set if field i holds a pointer
+  static uint32_t PointerBits(uint32_t head) { return (head >> 1) & 0x7fffff; }
+  // Words of the object including its header
+  static uint32_t SizeWords(uint32_t head) { return NumFields(head) + 1; }
+
+  // Header of a new object of 'num_fields' fields without pointers. The L2
+  // program overwrites it with the type information of the object; until
+  // then it still has to describe the object's size in case a collection
+  // happens first.
+  static intptr_t ProvisionalHeader(int32_t num_fields) {
+    return (intptr_t) num_fields << 24 | 1;
+  }
+
+  // Calls 'visit' with the address of every pointer field of the object at
+  // 'obj_ptr' whose header word is 'head', nil or not.
+  template <typename Visit>
+  static void ForEachPointerSlot(intptr_t *obj_ptr, uint32_t head,
+                                 Visit visit) {
+    uint32_t num_fields = NumFields(head);
+    uint32_t bits = PointerBits(head);
+    for (uint32_t i = 0; i < num_fields && bits != 0; i++, bits >>= 1) {
+      if (bits & 1) visit(obj_ptr + i);
+    }
+  }
+
+  // Calls 'visit' with every pointer field of the object that is not nil.
+  template <typename Visit>
+  static void ForEachChild(intptr_t *obj_ptr, uint32_t head, Visit visit) {
+    ForEachPointerSlot(obj_ptr, head, [&](intptr_t *slot) {
+      if (*slot != 0) visit((intptr_t*) *slot);
+    });
+  }
+};
+
+// Layout of the L2 stack frames:
+//
+//   fp[2 + i]   argument i
+//   fp[1]       return address
+//   fp[0]       saved frame pointer of the caller
+//   fp[-1]      argument info word, a bit per pointer argument
+//   fp[-2]      local info word, a bit per pointer local
+//   fp[-3 - i]  local i
+struct FrameLayout {
+  // Calls 'visit' with the address of every pointer argument and local of
+  // the frame 'frame_ptr'.
+  template <typename Visit>
+  static void ForEachFrameSlot(intptr_t *frame_ptr, Visit visit) {
+    uint32_t arg_info = *(frame_ptr - 1);
+    for (int bit_num = 0; arg_info != 0; bit_num++, arg_info >>= 1) {
+      if (arg_info & 1) visit(frame_ptr + 2 + bit_num);
+    }
+
+    uint32_t local_info = *(frame_ptr - 2);
+    for (int bit_num = 0; local_info != 0; bit_num++, local_info >>= 1) {
+      if (local_info & 1) visit(frame_ptr - 3 - bit_num);
+    }
+  }
+
+  // Calls ForEachFrameSlot for the frames from 'curr_frame_ptr' down to
+  // 'end_frame_ptr', which is not visited.
+  template <typename Visit>
+  static void ForEachRootSlot(intptr_t *curr_frame_ptr,
+                              intptr_t *end_frame_ptr, Visit visit) {
+    while (curr_frame_ptr != end_frame_ptr) {
+      ForEachFrameSlot(curr_frame_ptr, visit);
+      curr_frame_ptr = (intptr_t*) *curr_frame_ptr;
+    }
+  }
+};
+
+// Kind of pages backing a collector's heap.
+enum class HeapPages {
+  // Normal pages from malloc.
+  Small,
+  // Normal pages advised with MADV_HUGEPAGE, which the kernel may replace by
+  // huge pages. See Gc::HugePageBytes for how much of the heap it did.
+  TransparentHuge,
+  // Huge pages from the hugetlbfs pool, reserved up front.
+  Huge,
+};
+
+// Interface shared by the collectors so that the runtime can choose one when
+// the program starts.
+class Gc {
+ public:
+  virtual ~Gc() {}
+
+  // See GcSemiSpace::Alloc.
+  virtual intptr_t* Alloc(int32_t num_words, intptr_t *curr_frame_ptr) = 0;
+
+  // Allocates an object of the struct type whose header word is 'tag' (see
+  // TypeInfo::tag) and returns its address. The default allocates the
+  // object with Alloc and stores the tag in its header; collectors that know
+  // the layout of an object from where it is allocated may leave the header
+  // out.
+  virtual intptr_t* AllocTyped(uint32_t tag, intptr_t *curr_frame_ptr) {
+    intptr_t *obj_ptr = Alloc(tag >> 24, curr_frame_ptr);
+    *(obj_ptr - 1) = tag;
+    return obj_ptr;
+  }
+
+  // Allocates an object like AllocTyped for a struct type without pointer
+  // fields. The collectors never have to look inside such objects, and may
+  // keep them apart from the others so that tracing skips them. The default
+  // allocates them like any other struct.
+  virtual intptr_t* AllocAtomic(uint32_t tag, intptr_t *curr_frame_ptr) {
+    return AllocTyped(tag, curr_frame_ptr);
+  }
+
+  // Allocates an object like AllocTyped for a struct type with weak fields.
+  // 'weak_bits' has a bit set for every weak field, laid out like the
+  // pointer bitmap of 'tag', which leaves the weak fields out. Once tracing
+  // finds the object a weak field points to unreachable, the collector sets
+  // the field to nil. The default keeps weak fields like the other pointer
+  // fields.
+  virtual intptr_t* AllocWeak(uint32_t tag, uint32_t weak_bits,
+                              intptr_t *curr_frame_ptr) {
+    return AllocTyped(tag | weak_bits, curr_frame_ptr);
+  }
+
+  // An object allocated with AllocWeak, and the bits of its weak fields
+  struct WeakObject {
+    intptr_t *obj_ptr;
+    uint32_t weak_bits;
+  };
+  // The objects whose weak fields the collector clears. Includes objects
+  // that died since the last collection.
+  const std::vector<WeakObject>& WeakObjects() const { return weak_objects; }
+
+  // Returns a thread-local allocation buffer of at least 'min_words' and at
+  // most '*num_words' words and stores its size in '*num_words', collecting
+  // first if fewer than 'min_words' words are free. The runtime carves the
+  // objects of one thread out of it without calling the collector, laid out
+  // like the objects of Alloc. A buffer is given up at the next collection.
+  // Throws OutOfMemoryError like Alloc. The default returns NULL, for
+  // collectors that do not hand out buffers.
+  virtual intptr_t* AllocBuffer(int32_t min_words, int32_t *num_words,
+                                intptr_t *curr_frame_ptr) {
+    return NULL;
+  }
+
+  // Makes the words from 'begin' up to 'end', the part of a buffer that has
+  // not been allocated yet, look like free space to a collection that walks
+  // the heap. The runtime calls it for the buffers of all threads before a
+  // collection can run, and the thread may go on allocating from 'begin'
+  // afterwards. The default does nothing, for collectors that never walk
+  // the space they hand buffers out from.
+  virtual void FillBuffer(intptr_t *begin, intptr_t *end) {}
+
+  // Returns the header word of the object 'obj_ptr', or what describes its
+  // layout if it has no header.
+  virtual intptr_t HeaderOf(intptr_t *obj_ptr) const { return *(obj_ptr - 1); }
+
+  // Name of the collector, used when reporting statistics.
+  virtual const char* Name() const = 0;
+
+  // Returns the pointer in the heap field 'slot', after making it point to
+  // an object the collector is done moving. The default is for collectors
+  // that do not move objects while the program runs.
+  virtual intptr_t* ReadBarrier(intptr_t *slot) { return (intptr_t*) *slot; }
+
+  // Stores 'value' in the heap field 'slot'. The default is for collectors
+  // that do not need to know about the stores of the program.
+  virtual void WriteBarrier(intptr_t *slot, intptr_t *value) {
+    *slot = (intptr_t) value;
+  }
+
+  // Sets the frame pointer of the frame right below the L2 program's 'Entry'
+  // frame, where stack walks stop. A runtime context sets it every time it
+  // runs a program.
+  void SetBaseFramePtr(intptr_t *frame_ptr) { base_frame_ptr = frame_ptr; }
+
+  // The stack of another thread of the program: the frame pointer of its
+  // innermost L2 frame and the one of the frame right below its first.
+  struct ThreadStack {
+    intptr_t *top_frame_ptr;
+    intptr_t *base_frame_ptr;
+  };
+  // Sets the stacks of the other threads of the program, which stack walks
+  // go through after the stack of the calling thread. The runtime sets them
+  // while the other threads are stopped.
+  void SetThreadStacks(std::vector<ThreadStack> stacks) {
+    thread_stacks = std::move(stacks);
+  }
+  // The stacks set by SetThreadStacks, empty outside of a stopped world.
+  const std::vector<ThreadStack>& ThreadStacks() const {
+    return thread_stacks;
+  }
+
+  // Registers the 'num_slots' words at 'slots', outside of the heap and the
+  // stack, as roots. They hold pointers to objects or nil. Stack walks add
+  // them after the stacks, so every collector keeps their objects alive and
+  // updates them when it moves the objects. A host holds its objects in
+  // them, see HeapRoots in runtime.h.
+  void AddExternalRoots(intptr_t *slots, size_t num_slots) {
+    external_roots[slots] = num_slots;
+  }
+  // Forgets the slots registered at 'slots'.
+  void RemoveExternalRoots(intptr_t *slots) { external_roots.erase(slots); }
+  // The ranges registered with AddExternalRoots, by their first slot.
+  const std::unordered_map<intptr_t*, size_t>& ExternalRoots() const {
+    return external_roots;
+  }
+
+  const GcStats& Stats() const { return stats; }
+
+  // Sets the listener told about the start and the end of every pause, NULL
+  // for none.
+  void SetPauseListener(GcPauseListener *listener) {
+    pause_listener = listener;
+  }
+
+  // Whether the calling thread is running the collector: in a pause, or as
+  // one of the helper threads that mark and sweep. Safe to call from a signal
+  // handler, the profiler reads it for its [gc] frames.
+  static bool InCollector();
+
+  // Pages backing the heap, and their name for reports: "4k", "thp" or
+  // "hugetlb".
+  HeapPages Pages() const { return heap_pages; }
+  const char* PagesName() const;
+
+  // Number of bytes of the heap currently backed by huge pages.
+  size_t HugePageBytes() const;
+
+ protected:
+  intptr_t *base_frame_ptr = NULL;
+  GcStats stats;
+
+  // The objects with weak fields that may still be alive, for the
+  // collectors that override AllocWeak
+  std::vector<WeakObject> weak_objects;
+
+  // Allocates an object with AllocTyped and remembers its weak fields.
+  intptr_t* alloc_weak_object(uint32_t tag, uint32_t weak_bits,
+                              intptr_t *curr_frame_ptr);
+  // Called after tracing. 'survivor' returns the address of an object after
+  // the collection, or NULL if it was found unreachable. Forgets the
+  // unreachable objects with weak fields, and in the others sets every weak
+  // field to the address of the object it points to, or to nil.
+  void update_weak_fields(
+      const std::function<intptr_t*(intptr_t*)> &survivor);
+
+  // Allocates the memory for a heap of 'num_words' words. If 'huge_pages' is
+  // true it first tries to reserve huge pages, then to get transparent huge
+  // pages, and falls back to normal pages when neither is available.
+  intptr_t* map_heap(size_t num_words, bool huge_pages);
+  // Releases the heap returned by map_heap.
+  void unmap_heap(intptr_t *heap);
+
+  // Walks the stack from the frame 'curr_frame_ptr' down to base_frame_ptr,
+  // and the stacks of the other threads, and fills 'root_set' with the
+  // addresses of the slots that hold pointers, followed by the external
+  // roots.
+  void stack_walk(intptr_t *curr_frame_ptr,
+                  std::vector<intptr_t*> &root_set) const;
+
+  // Called at the start and the end of every pause to measure it.
+  // 'ends_collection' is false for the pauses that only do part of a
+  // collection.
+  void start_pause();
+  void end_pause(bool ends_collection = true);
+
+ private:
+  uint64_t pause_start_ns;
+  GcPauseListener *pause_listener = NULL;
+
+  std::vector<ThreadStack> thread_stacks;
+  // Number of slots of every range of AddExternalRoots by its first slot
+  std::unordered_map<intptr_t*, size_t> external_roots;
+
+  // Adds the pointer slots of the frames from 'curr_frame_ptr' down to
+  // 'end_frame_ptr' to 'root_set'
+  void walk_frames(intptr_t *curr_frame_ptr, intptr_t *end_frame_ptr,
+                   std::vector<intptr_t*> &root_set) const;
+
+  HeapPages heap_pages = HeapPages::Small;
+  void *heap_mapping = NULL;
+  size_t heap_mapping_bytes = 0;
+};
+
+// Number of objects the collectors have in flight between discovering a
+// pointer to an object and reading the object's header. Can be overridden
+// with -DGC_PREFETCH_DISTANCE=N, 0 disables prefetching.
+#ifndef GC_PREFETCH_DISTANCE
+#define GC_PREFETCH_DISTANCE 8
+#endif
+
+// Small FIFO used by the tracing loops of both collectors. Every item put
+// into it comes with the address of an object header, which is prefetched so
+// that it has likely arrived in the cache by the time the item comes out
+// GC_PREFETCH_DISTANCE items later.
+class PrefetchFifo {
+ public:
+  bool empty() const { return count == 0; }
+
+  // True when the FIFO holds more than GC_PREFETCH_DISTANCE items; the oldest
+  // one should be popped before pushing another one.
+  bool full() const { return count > GC_PREFETCH_DISTANCE; }
+
+  void push(intptr_t *item, intptr_t *head_ptr) {
+    __builtin_prefetch(head_ptr);
+    items[(head + count) % kCapacity] = item;
+    count++;
+  }
+
+  intptr_t* pop() {
+    intptr_t *item = items[head];
+    head = (head + 1) % kCapacity;
+    count--;
+    return item;
+  }
+
+ private:
+  static const unsigned kCapacity = GC_PREFETCH_DISTANCE + 1;
+  intptr_t *items[kCapacity];
+  unsigned head = 0, count = 0;
+};
+
 // Implements a semispace garbage collector for L2 programs.
-class GcSemiSpace {
+class GcSemiSpace : public Gc {
  public:
   // The 'frame_ptr' argument should be the frame pointer for the stack frame of
   // 'main', i.e., the stack frame immediately before the stack frame of 'Entry'
-  // for the L2 program. The 'heap_size' argument is the number of desired words
-  // in the heap; it should be a positive even number.
-  GcSemiSpace(intptr_t *frame_ptr, int heap_size_in_words);
+  // for the L2 program, or NULL if it is set later with SetBaseFramePtr. The
+  // 'heap_size' argument is the number of desired words in the heap; it
+  // should be a positive even number. If 'huge_pages' is true the heap is
+  // backed by huge pages when the system has them.
+  //
+  // With a positive 'incremental_scan_words' the collector copies
+  // incrementally, see README.md. Every allocation then scans that many words
+  // of the to space at most, which bounds its pause, and the program has to
+  // call read_barrier for the pointers it loads from the heap.
+  GcSemiSpace(intptr_t *frame_ptr, int heap_size_in_words,
+              bool huge_pages = false, int incremental_scan_words = 0);
+
+  // Releases the heap.
+  ~GcSemiSpace();
 
   // Allocates num_words+1 words on the heap and returns the address of the
   // second word. The first word (at a negative offset from the returned
@@ -38,14 +431,32 @@ class GcSemiSpace {
   // walking the stack.
   //
   // Throws 'OutOfMemoryError' if the heap runs out of memory.
-  intptr_t* Alloc(int32_t num_words, intptr_t *curr_frame_ptr);
+  intptr_t* Alloc(int32_t num_words, intptr_t *curr_frame_ptr) override;
+
+  // Allocates a pointer-free struct from the end of the from space, unless
+  // the collector copies incrementally.
+  intptr_t* AllocAtomic(uint32_t tag, intptr_t *curr_frame_ptr) override;
+
+  // Allocates a struct whose weak fields are cleared by the collections,
+  // unless the collector copies incrementally, which keeps them like the
+  // other fields.
+  intptr_t* AllocWeak(uint32_t tag, uint32_t weak_bits,
+                      intptr_t *curr_frame_ptr) override;
+
+  // Hands out the buffer from the bump pointer, unless the collector copies
+  // incrementally.
+  intptr_t* AllocBuffer(int32_t min_words, int32_t *num_words,
+                        intptr_t *curr_frame_ptr) override;
+
+  const char* Name() const override;
+
+  // Copies the object 'slot' points to if it is still in the from space.
+  intptr_t* ReadBarrier(intptr_t *slot) override;
 
  private:
   // Your private methods for functionality such as garbage
   // collection, stack walking, and copying live data should go here
 
-  intptr_t *base_frame_ptr;
-
   int heap_size;
   intptr_t *heap_space, *from_space, *to_space;
 
@@ -53,36 +464,122 @@ class GcSemiSpace {
   int to_size;
   intptr_t *bump_ptr;
 
-  std::map<intptr_t*, int> obj_map;
-  std::map<intptr_t*, int> new_map;
+  // Pointer-free objects are allocated from the end of the from space down
+  // to 'atomic_ptr', and copied from the end of the to space down to
+  // 'to_atomic_ptr', where the loop that scans the copies never gets to
+  // them. 'from_size' is the space between 'bump_ptr' and 'atomic_ptr'.
+  intptr_t *atomic_ptr, *to_atomic_ptr;
+
+  // Incremental copying. During a collection, copies are made from the start
+  // of the to space up to 'bump_ptr' and scanned up to 'scan_ptr', and new
+  // objects are allocated from 'top_ptr' down.
+  int incremental_scan_words;
+  // Free words of the semispace left when an incremental collection starts
+  int flip_free_words;
+  bool in_collection = false;
+  intptr_t *scan_ptr = NULL, *top_ptr = NULL;
+  // Words of the from space that may still have to be copied
+  int uncopied_words = 0;
+
+  // Stack slots and fields that point to objects which still have to be
+  // copied or forwarded
+  PrefetchFifo prefetch_fifo;
 
   // memory locations (on stack) of a pointer (to heap)
   std::vector<intptr_t*> root_set;
 
   // Variables needed for Gc Stat Report
-  size_t num_obj_copied, num_word_copied;
+  size_t num_obj_copied = 0, num_word_copied = 0;
 
-  // Walk the stack and fill the root set
-  void stack_walk(intptr_t *curr_frame_ptr);
-  // Helper function that read the info words
-  void info_word_bit_mask(int info_word, intptr_t *curr_frame_ptr,
-                          int word_offset);
+  // Copies everything reachable from the stack in one pause
+  void collect(intptr_t *curr_frame_ptr);
 
+  // Copies everything reachable from the root set to the to space, in
+  // breadth-first order: the copied objects are scanned from the start of
+  // the to space for pointers to objects that still have to be copied.
   void copy_space_on_rootset();
-  void copy_space_on_struct(intptr_t *obj_ptr);
+  // Queues the pointer fields of the copied object 'obj_ptr' and returns the
+  // address of the object after it
+  intptr_t* copy_space_on_struct(intptr_t *obj_ptr);
+  // Queues the slot holding a pointer to a from space object
+  void queue_slot(intptr_t *slot);
+  // Points 'slot' to the copy of the object it points to, copying the
+  // object first if it has not been copied yet
+  void forward_slot(intptr_t *slot);
   bool isCopied(intptr_t *obj_ptr);
   void add_forwarding_ptr(intptr_t *obj_ptr, intptr_t *forwarding_ptr);
+
+  // Allocation while collecting incrementally
+  intptr_t* alloc_incremental(int32_t num_words, intptr_t *curr_frame_ptr);
+  // Words the program can allocate during the current collection without
+  // leaving too little room for the objects that are still to be copied
+  int incremental_free_words() const;
+  // Copies the objects the roots point to and starts a collection
+  void flip(intptr_t *curr_frame_ptr);
+  // Scans copies until 'max_words' words have been scanned, and ends the
+  // collection once there is nothing left to scan
+  void scan_copies(int max_words);
+  void end_collection();
+};
+
+
+// Threads that run the parallel phases of a collection. The thread that
+// starts a phase takes part in it as worker 0, the other workers wait for
+// the next phase between collections.
+class GcThreadPool {
+ public:
+  explicit GcThreadPool(int num_threads);
+  ~GcThreadPool();
+
+  int Size() const { return (int) threads.size() + 1; }
+
+  // Calls 'task' with every worker number from 0 to Size() - 1, each on its
+  // own thread, and returns when all calls have returned.
+  void Run(const std::function<void(int)> &task);
+
+ private:
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::condition_variable start_cv, done_cv;
+  const std::function<void(int)> *task = NULL;
+  // Number of phases started so far and number of workers still running
+  // the current one
+  uint64_t generation = 0;
+  int num_running = 0;
+  bool stopping = false;
+
+  void worker_loop(int worker);
 };
 
+// Number of grey objects the mark stack of each marking thread of
+// GcMarkSweep holds. The stacks are allocated with the collector, so marking
+// never allocates memory; the objects found while a stack is full are marked
+// by pointer reversal instead. Can be overridden with
+// -DGC_MARK_STACK_CAPACITY=N.
+#ifndef GC_MARK_STACK_CAPACITY
+#define GC_MARK_STACK_CAPACITY 4096
+#endif
 
 // Implements a mark-sweep garbage collector for L2 programs.
-class GcMarkSweep {
+class GcMarkSweep : public Gc {
  public:
   // The 'frame_ptr' argument should be the frame pointer for the stack frame of
   // 'main', i.e., the stack frame immediately before the stack frame of 'Entry'
-  // for the L2 program. The 'heap_size' argument is the number of desired words
-  // in the heap; it should be a positive even number.
-  GcMarkSweep(intptr_t *frame_ptr, int heap_size_in_words);
+  // for the L2 program, or NULL if it is set later with SetBaseFramePtr. The
+  // 'heap_size' argument is the number of desired words in the heap; it
+  // should be a positive even number. If 'huge_pages' is true the heap is
+  // backed by huge pages when the system has them. 'num_threads' threads
+  // mark and sweep the heap, the thread calling Alloc being one of them. If
+  // 'concurrent_sweep' is true the heap is swept by a background thread
+  // after the collection instead of during it. If 'generational' is true
+  // most collections only collect the objects allocated since the last one,
+  // see README.md.
+  GcMarkSweep(intptr_t *frame_ptr, int heap_size_in_words,
+              bool huge_pages = false, int num_threads = 1,
+              bool concurrent_sweep = false, bool generational = false);
+
+  // Releases the heap.
+  ~GcMarkSweep();
 
   // Allocates num_words+1 words on the heap and returns the address of the
   // second word. The first word (at a negative offset from the returned
@@ -94,58 +591,547 @@ class GcMarkSweep {
   // walking the stack.
   //
   // Throws 'OutOfMemoryError' if the heap runs out of memory.
-  intptr_t* Alloc(int32_t num_words, intptr_t *curr_frame_ptr);
+  intptr_t* Alloc(int32_t num_words, intptr_t *curr_frame_ptr) override;
+
+  // Allocates a pointer-free struct, which marking never pushes on a mark
+  // stack or reads.
+  intptr_t* AllocAtomic(uint32_t tag, intptr_t *curr_frame_ptr) override;
+
+  // Allocates a struct whose weak fields are cleared between marking and
+  // sweeping.
+  intptr_t* AllocWeak(uint32_t tag, uint32_t weak_bits,
+                      intptr_t *curr_frame_ptr) override;
+
+  // Hands out the buffer from the end of a free block, like an object.
+  intptr_t* AllocBuffer(int32_t min_words, int32_t *num_words,
+                        intptr_t *curr_frame_ptr) override;
+  void FillBuffer(intptr_t *begin, intptr_t *end) override;
+
+  const char* Name() const override;
+
+  // Stores 'value' in 'slot' and dirties the card of the slot.
+  void WriteBarrier(intptr_t *slot, intptr_t *value) override;
 
  private:
-  intptr_t *base_frame_ptr;
+  // The heap is parsable: it is a sequence of blocks that each start with a
+  // header word. An object header has its lowest bit set and the number of
+  // fields in its top 8 bits (see TypeInfo::tag), a free block header has its
+  // lowest bit clear and the length of the block in words, header included,
+  // in the remaining bits. Free blocks of at least two words hold the address
+  // of the next free block in their second word.
+  //
+  // The heap is divided into chunks of kChunkWords words that are swept in
+  // parallel. A block belongs to the chunk that holds its header, even if it
+  // extends into the next chunks, and every chunk has its own free list.
+  //
+  // After a collection every chunk is unswept. The chunks are swept during
+  // the pause, or with 'concurrent_sweep' by a background thread after it.
+  // The allocator only uses swept chunks; when it reaches a chunk that has
+  // not been swept yet it sweeps the chunk itself, or waits for the
+  // background thread to finish it.
+
+  static const int kChunkWords = 1 << 15;
+
+  enum ChunkState : uint8_t { kUnswept, kSweeping, kSwept };
+
+  struct Chunk {
+    // Free blocks of at least two words in address order
+    intptr_t *free_list = NULL;
+    // Set by the sweep: the first and the last block of the chunk if they
+    // are free
+    intptr_t *first_free = NULL, *last_free = NULL;
+    // Whether any block starts in the chunk
+    bool has_blocks = false;
+    // Words in free blocks after the sweep
+    size_t free_words = 0;
+    // Whether the allocator has counted the chunk's free words in free_size
+    bool published = false;
+    // Whether objects have been allocated in the chunk, or from its free
+    // blocks, since the last collection
+    bool has_young = false;
+  };
+
+  // Marking state of one marking thread. Grey objects are pushed on the
+  // private 'mark_stack'; when it grows long, half of it is moved to
+  // 'shared', where idle threads can steal it. Both hold at most
+  // GC_MARK_STACK_CAPACITY objects.
+  struct alignas(64) MarkWorker {
+    std::vector<intptr_t*> mark_stack;
+    // Objects taken from the mark stack whose headers are being prefetched
+    PrefetchFifo prefetch_fifo;
+    std::mutex lock;
+    std::vector<intptr_t*> shared;
+    // Objects and words traced by this worker
+    size_t live_objects = 0, live_words = 0;
+  };
+
   // Size of the allocated heap
   int heap_size;
   // Pointer to the allocated heap
   intptr_t *heap_space;
   
-  // Total currently available memory size  
+  // Total currently available memory size in the published chunks
   int free_size;
-  // A free list that manages free memory
-  std::list<std::pair<intptr_t*, int>> free_list;
-  // A object list that keeps track of allocated object
-  std::list<std::pair<intptr_t*, int>> obj_list;
-  // A map that map heap adress to a block in the free_list
-  std::unordered_map<intptr_t*, std::list<std::pair<intptr_t*, int>>::iterator> free_map;
+  std::vector<Chunk> chunks;
+  // ChunkState of every chunk, shared with the sweeping threads
+  std::unique_ptr<std::atomic<uint8_t>[]> chunk_states;
+  // Number of published chunks, and whether the free blocks that abut across
+  // chunk boundaries have been merged since all chunks were published
+  size_t num_published = 0;
+  bool chunks_merged = false;
+  // Chunks before this one are published and have an empty free list
+  size_t first_alloc_chunk = 0;
+
+  // One mark bit per heap word, set for the header words of reachable objects
+  std::vector<uint32_t> mark_bits;
+  // One bit per heap word, set for the header word of every block
+  std::vector<uint32_t> start_bits;
+  // One bit per heap word, set for the header word of the objects allocated
+  // with AllocAtomic and clear for the other objects
+  std::vector<uint32_t> atomic_bits;
+
+  std::unique_ptr<GcThreadPool> threads;
+  // One per thread
+  std::unique_ptr<MarkWorker[]> mark_workers;
+  // Number of objects in the 'shared' stacks of all workers, and number of
+  // workers that have run out of objects to trace
+  std::atomic<size_t> num_shared;
+  std::atomic<int> num_idle;
+  // Next chunk for the sweeping threads to try
+  std::atomic<size_t> next_chunk;
+
+  // The background sweeper, when 'concurrent_sweep' is set. It sleeps until
+  // a collection starts a new round of sweeping.
+  std::thread sweeper;
+  std::mutex sweeper_lock;
+  std::condition_variable sweeper_cv;
+  bool sweep_requested = false, sweeper_stopping = false;
+
+  std::vector<intptr_t*> root_set;
+
+  // Variables needed for Gc Stat Report
+  size_t num_obj_left = 0, num_word_left = 0;
+
+  // Generational collection. Mark bits stay set after a collection, so the
+  // marked objects are the old ones and the unmarked ones are the objects
+  // allocated since the last collection. A minor collection marks the young
+  // objects reachable from the stack and from the old objects on dirty
+  // cards, and sweeps the chunks that have young objects. A major collection
+  // clears the mark bits first and sweeps the whole heap.
+  bool generational;
+  // Whether the next collection has to be a major one
+  bool major_next = false;
+  // Card bytes of the heap, biased so that the card of an address is
+  // cards[address >> kCardShift]; 'card_table' in 32-bit processes
+  uint8_t *cards = NULL;
+  std::vector<uint8_t> own_cards;
+  // Old objects and their words, including the dead ones left by minor
+  // collections
+  size_t num_old_obj = 0, num_old_words = 0;
+
+  // Helper function that allocates at least 'min_words' and at most
+  // '*num_words' words from the end of the first free block that is large
+  // enough, stores their number in '*num_words' and returns the first one,
+  // which is the header of the first object. Returns NULL if there is no
+  // such block. Runs of more than 'min_words' words stay in one chunk.
+  intptr_t* allocate_memory(int32_t min_words, int32_t *num_words);
+
+  // Allocates like allocate_memory, collecting first if that fails. Throws
+  // OutOfMemoryError if there is still no room.
+  intptr_t* allocate_collecting(int32_t min_words, int32_t *num_words,
+                                intptr_t *curr_frame_ptr);
+
+  // Marks the reachable objects, all of them or, for a minor collection,
+  // the young ones, and sweeps.
+  void collect(intptr_t *curr_frame_ptr, bool major);
+
+  // Adds the pointer fields of the old objects on dirty cards to the root
+  // set, and clears the cards.
+  void scan_dirty_cards();
+  void clear_cards();
+
+  // Sweeps the chunks that have young objects, during the pause.
+  void sweep_young();
+
+  // Helper function that marks every object reachable from the root set,
+  // using all threads
+  void mark_from_roots();
+
+  // Marks the objects reachable from worker 'worker's share of the root set,
+  // then helps the other workers until no grey objects are left
+  void mark_worker(int worker);
+
+  // Traces the grey objects of 'worker' until it has none left
+  void trace_grey_objects(MarkWorker &worker);
+
+  // Moves grey objects from the shared stack of some worker, trying
+  // 'worker's own first, to the mark stack of 'worker'. Returns false if
+  // all shared stacks are empty.
+  bool steal_grey_objects(int worker);
+
+  // Helper function that atomically sets the mark bit of 'obj_ptr' and
+  // pushes it on the mark stack of 'worker' if it was not marked yet
+  void mark_obj(MarkWorker &worker, intptr_t *obj_ptr);
+
+  // Sets the mark bit of 'obj_ptr' and returns whether it was clear.
+  bool try_mark(intptr_t *obj_ptr);
+
+  // Number of words of the block whose header word is at 'index', found
+  // from where the next block starts without reading the header
+  size_t block_words_at(size_t index) const;
+
+  // Marks everything reachable from the marked object 'obj_ptr' that is not
+  // marked yet without a stack (Deutsch-Schorr-Waite). The way back from an
+  // object is kept in the pointer field the traversal left it through, and
+  // which field that is in the mark bit of the field's word, so this needs
+  // no memory besides the heap and the mark bitmap.
+  void mark_reversing(MarkWorker &worker, intptr_t *obj_ptr);
+
+  // Helper function that marks all chunks unswept and sweeps them, during
+  // the pause with all threads or after it in the background.
+  void sweep();
+
+  // Claims and sweeps unswept chunks until none are left. Called by the
+  // sweeping threads.
+  void sweep_chunks();
+
+  // Makes chunk 'chunk_num' available to the allocator, sweeping it first if
+  // nobody has claimed it yet or waiting until it has been swept.
+  void publish_chunk(size_t chunk_num);
+
+  // Publishes all chunks that have not been published yet.
+  void publish_all_chunks();
+
+  // Merges the free blocks that abut across chunk boundaries. Only called
+  // when all chunks are published.
+  void merge_chunks();
+
+  // Scans the blocks of chunk 'chunk_num', turns unmarked objects into free
+  // blocks, merges abutting free blocks and rebuilds the chunk's free list.
+  void sweep_chunk(size_t chunk_num);
+
+  // Returns the first block that starts in chunk 'chunk_num', NULL if none.
+  intptr_t* first_block_in_chunk(size_t chunk_num);
+
+  // Address right after the end of chunk 'chunk_num'.
+  intptr_t* chunk_end(size_t chunk_num);
+
+  void sweeper_loop();
+};
+
+
+// Reference-counting collector. The counts only include the references from
+// other objects: the program stores pointers into objects through
+// write_barrier, which updates the counts, and the references from the stack
+// are counted at periodic stack scans instead (deferred reference counting).
+// Objects whose count drops to zero wait in a zero count table until a stack
+// scan shows that the stack does not refer to them either. Garbage cycles are
+// found by trial deletion, starting from the objects whose count was
+// decremented to a nonzero value. No collection touches more of the heap than
+// the objects it frees, the candidates for cycles and what they point to.
+class GcRefCount : public Gc {
+ public:
+  // See GcSemiSpace::GcSemiSpace.
+  GcRefCount(intptr_t *frame_ptr, int heap_size_in_words,
+             bool huge_pages = false);
+
+  // Releases the heap.
+  ~GcRefCount();
+
+  // Allocates num_words+1 words on the heap and returns the address of the
+  // second word, see GcSemiSpace::Alloc. The objects are preceded by one more
+  // word that holds their reference count.
+  //
+  // Throws 'OutOfMemoryError' if the heap runs out of memory.
+  intptr_t* Alloc(int32_t num_words, intptr_t *curr_frame_ptr) override;
+
+  const char* Name() const override;
+
+  // Counts the reference to 'value' and uncounts the one it replaces.
+  void WriteBarrier(intptr_t *slot, intptr_t *value) override;
+
+ private:
+  // Every block starts with the count word of its object, followed by the
+  // object's header and fields. A free block has the address of the next
+  // free block in its first word and its length in words shifted left by one
+  // in the second, where an object header has its lowest bit set. Free blocks
+  // are kept in one list per size, and those larger than any object in one
+  // more list; the heap up to 'bump_ptr' is parsable.
+  //
+  // The count word holds the count, the color of the object for trial
+  // deletion and whether the object is buffered as a candidate for a garbage
+  // cycle or is in the zero count table; see the helpers in gc.cpp.
+
+  // Largest block: 255 fields, the header and the count word
+  static const int kMaxBlockWords = 257;
+  // Sizes of the zero count table and of the buffer of cycle candidates that
+  // trigger a collection
+  static const size_t kZctCapacity = 4096;
+  static const size_t kCandidatesCapacity = 4096;
+
+  int heap_size;
+  intptr_t *heap_space;
+  // Never allocated part at the end of the heap
+  intptr_t *bump_ptr, *heap_end;
+  // Free blocks by size in words
+  std::vector<intptr_t*> free_lists;
+  // Free blocks larger than kMaxBlockWords
+  intptr_t *large_blocks = NULL;
+
+  // Objects whose count has dropped to zero or that are new
+  std::vector<intptr_t*> zct;
+  // Objects whose count has been decremented to a nonzero value
+  std::vector<intptr_t*> candidates;
+  // Objects the stack referred to at the last stack scan, each counted once
+  // per reference
+  std::vector<intptr_t*> stack_refs, new_stack_refs;
+  // Work lists of the trial deletion and the objects it found to be garbage
+  std::vector<intptr_t*> work_list, black_list, garbage;
+
+  std::vector<intptr_t*> root_set;
+
+  // Variables needed for Gc Stat Report
+  size_t num_live_objects = 0, num_live_words = 0;
+
+  // Takes a block for an object of 'num_words' words from the free lists or
+  // the end of the heap. Returns NULL if there is none.
+  intptr_t* allocate_memory(int32_t num_words);
+  // Puts the block of the object 'obj_ptr' on its free list.
+  void free_object(intptr_t *obj_ptr);
+  // Puts the free block 'block' of 'size' words on its free list.
+  void add_free_block(intptr_t *block, int size);
+  // Merges the free blocks that abut and rebuilds the free lists. Only
+  // needed when the heap is fragmented, since it walks the whole heap.
+  void merge_free_blocks();
+
+  // Counts the references on the stack, uncounts the ones of the previous
+  // stack scan and frees the objects that nothing refers to, including the
+  // garbage cycles if 'with_cycles' is true.
+  void collect(intptr_t *curr_frame_ptr, bool with_cycles);
+
+  void increment(intptr_t *obj_ptr);
+  void decrement(intptr_t *obj_ptr);
+  // Buffers 'obj_ptr' as a candidate for the trial deletion
+  void possible_cycle_root(intptr_t *obj_ptr);
+  // Frees the objects in the zero count table whose count is still zero, and
+  // uncounts their references to other objects.
+  void release_zct();
+
+  // Trial deletion: subtracts the references between the objects reachable
+  // from the candidates, restores the counts of the objects that are still
+  // referred to from elsewhere, and frees the rest.
+  void collect_cycles();
+  void mark_gray(intptr_t *obj_ptr);
+  void scan(intptr_t *obj_ptr);
+  void scan_black(intptr_t *obj_ptr);
+  void collect_white(intptr_t *obj_ptr);
+};
+
+
+// Mark-sweep collector with a big bag of pages (BiBoP) heap. The heap is
+// divided into pages, and every page holds objects of a single size. Small
+// structs allocated with AllocTyped get pages of their own type, whose
+// objects have no header word: their layout is the tag recorded for the
+// page. Larger structs and the objects allocated with Alloc keep their
+// header and share pages with the objects of the same size.
+class GcBibop : public Gc {
+ public:
+  // See GcSemiSpace::GcSemiSpace.
+  GcBibop(intptr_t *frame_ptr, int heap_size_in_words, bool huge_pages = false);
+
+  // Releases the heap.
+  ~GcBibop();
+
+  // Allocates num_words+1 words on the heap and returns the address of the
+  // second word, see GcSemiSpace::Alloc.
+  //
+  // Throws 'OutOfMemoryError' if the heap runs out of memory.
+  intptr_t* Alloc(int32_t num_words, intptr_t *curr_frame_ptr) override;
+
+  // Allocates a struct of at most a quarter of a page without a header word,
+  // other structs like the base class.
+  intptr_t* AllocTyped(uint32_t tag, intptr_t *curr_frame_ptr) override;
+
+  intptr_t HeaderOf(intptr_t *obj_ptr) const override;
+
+  const char* Name() const override;
+
+ private:
+  // Every page is free, holds small objects in slots of 'slot_words' words,
+  // or is part of the span of pages of one large object. The slots of
+  // headered objects start with the header word. Free slots are linked
+  // through their first word.
+  enum PageKind : uint8_t { kFreePage, kSmallPage, kLargePage, kLargeTail };
+
+  struct Page {
+    PageKind kind = kFreePage;
+    // Layout of the objects of a page without headers, 0 if they have one
+    uint32_t tag = 0;
+    // Words per slot, header included; for the first page of a large object
+    // the number of pages it spans
+    int slot_words = 0;
+    intptr_t *free_slots = NULL;
+  };
+
+  // Pages have at most kMaxPageWords words, fewer for small heaps so that
+  // they have at least kMinPages pages.
+  static const int kMaxPageWords = 256;
+  static const int kMinPages = 64;
+
+  int heap_size;
+  intptr_t *heap_space;
+  int page_words, page_shift;
+  std::vector<Page> pages;
+  int num_free_pages;
+  // Pages before this one are in use
+  size_t first_free_page = 0;
+  // Pages that have free slots, by size class: the tag of the objects of
+  // pages without headers and the slot size shifted left by one for the
+  // others.
+  std::unordered_map<uint32_t, std::vector<size_t>> partial_pages;
+  // The entry of partial_pages used by the last allocation
+  uint32_t last_size_class = 0;
+  std::vector<size_t> *last_partial = NULL;
+
+  // One mark bit per heap word, set for the first field of reachable objects
+  std::vector<uint32_t> mark_bits;
+  std::vector<intptr_t*> mark_stack;
+
+  std::vector<intptr_t*> root_set;
+
+  // Variables needed for Gc Stat Report
+  size_t num_obj_left = 0, num_word_left = 0;
+
+  const Page& page_of(intptr_t *obj_ptr) const {
+    return pages[(obj_ptr - heap_space) >> page_shift];
+  }
+
+  // Takes a cleared slot of 'slot_words' words from a page of size class
+  // 'size_class' whose objects have the layout 'tag', or 0 for headered
+  // objects. Returns NULL if there is no free slot or page.
+  intptr_t* allocate_slot(uint32_t size_class, uint32_t tag, int slot_words);
+  // Allocates a headered object from the slots or, if it is larger than
+  // half a page, from a span of free pages. Returns NULL if there is no
+  // room.
+  intptr_t* allocate_headered(int32_t num_words);
+  // Takes 'num_pages' consecutive free pages and returns the first, or -1 if
+  // there are none.
+  long take_free_pages(int num_pages);
+  void free_page(size_t page_num);
+
+  // Marks every object reachable from the stack and sweeps the pages.
+  void collect(intptr_t *curr_frame_ptr);
+  void mark_obj(intptr_t *obj_ptr);
+  // Rebuilds the free slot lists of the small pages, and frees the pages
+  // without marked objects and the spans of unmarked large objects.
+  void sweep();
+};
+
+
+// Collector that chooses between copying and mark-sweep while the program
+// runs. The heap starts out as two semispaces. When much of a semispace
+// survives its collections, the whole heap becomes a mark-sweep heap: the
+// survivors stay in place and the program allocates from the free blocks
+// between them. When little of the heap survives its collections, or the
+// free blocks are too fragmented, the live objects are slid to the start of
+// the heap and the collector copies again. Both modes trace from the roots
+// found by Gc::stack_walk and use the object headers and free blocks of the
+// other collectors.
+class GcHybrid : public Gc {
+ public:
+  // See GcSemiSpace::GcSemiSpace.
+  GcHybrid(intptr_t *frame_ptr, int heap_size_in_words,
+           bool huge_pages = false);
+
+  // Releases the heap.
+  ~GcHybrid();
+
+  // Allocates num_words+1 words on the heap and returns the address of the
+  // second word, see GcSemiSpace::Alloc.
+  //
+  // Throws 'OutOfMemoryError' if the heap runs out of memory.
+  intptr_t* Alloc(int32_t num_words, intptr_t *curr_frame_ptr) override;
+
+  // Hands out the buffer from the current block, like an object.
+  intptr_t* AllocBuffer(int32_t min_words, int32_t *num_words,
+                        intptr_t *curr_frame_ptr) override;
+  void FillBuffer(intptr_t *begin, intptr_t *end) override;
+
+  const char* Name() const override;
+
+ private:
+  enum Mode { kCopying, kMarkSweep };
+
+  // Copying collects a semispace, so it only beats mark-sweep while a small
+  // part of a semispace survives. The collector switches to mark-sweep when
+  // more than kMaxCopySurvival of the semispace survives, on average, and
+  // back to copying when less than kMinSweepSurvival of the used heap
+  // survives or more than kMaxFragmentation of the free words are outside
+  // the largest free block, and the live objects leave half of a semispace
+  // free. The averages start over at every switch.
+  static constexpr double kMaxCopySurvival = 0.5;
+  static constexpr double kMinSweepSurvival = 0.15;
+  static constexpr double kMaxFragmentation = 0.5;
+
+  int heap_size;
+  intptr_t *heap_space, *heap_end;
+  Mode mode = kCopying;
+
+  // The program allocates from 'bump_ptr' up to 'alloc_end': the rest of
+  // the from space while copying, and the current free block in mark-sweep
+  // mode.
+  intptr_t *bump_ptr, *alloc_end;
+  intptr_t *from_space, *to_space;
+
+  // Mark-sweep mode. The heap is a sequence of objects and free blocks, as
+  // in GcMarkSweep, except for the part of the current free block that has
+  // not been allocated yet. The free blocks of at least two words are
+  // linked through their second word. 'free_words' also counts the current
+  // free block and the free blocks too small to be linked.
+  intptr_t *free_list = NULL;
+  size_t free_words = 0;
+
+  // One mark bit per heap word, set for the header of reachable objects
+  std::vector<uint32_t> mark_bits;
+  std::vector<intptr_t*> mark_stack;
+
+  // Sliding: one bit per heap word, set for all words of the live objects,
+  // and the number of live words before each word of the bitmap. An
+  // object moves to the start of the heap plus the number of live words
+  // before it.
+  std::vector<uint32_t> live_bits;
+  std::vector<uint32_t> live_before;
+
+  // Averages over the collections since the last switch
+  double survival = 0, fragmentation = 0;
 
   std::vector<intptr_t*> root_set;
 
   // Variables needed for Gc Stat Report
-  size_t num_obj_left, num_word_left;
-
-  // Helper function that finds a free memory block larger or equal to
-  // 'num_words' + 1. If 'num_words' + 1 is greater than the available
-  // memory 'free_size', return an iterator pointing to the end of 'free_list'.
-  // If no available memory block is greater or equal to 'num_words' + 1,
-  // return an iterator pointing to the end of the 'free_list'.
-  std::list<std::pair<intptr_t*, int>>::iterator find_free_block(int num_words);
-
-  // Helper function that allocate 'num_words' + 1 space for the object.
-  // Update the free_list, obj_list and free_size. 
-  intptr_t* allocate_memory(std::list<std::pair<intptr_t*, int>>::
-                              iterator block_iter,
-                            int32_t num_words);
-
-  // Helper function that walks the stack and fills the root set
-  void stack_walk(intptr_t *curr_frame_ptr);
-
-  // Helper function that reads the info words
-  void info_word_bit_mask(int info_word, intptr_t *curr_frame_ptr,
-                          int word_offset);
-
-  // Helper function that turns the root set into a hashset
-  std::unordered_set<intptr_t*> get_root_hashset();
-
-  // Helper function that recursively traces all object fields,
-  // if pointer add to hashset.
-  void trace_obj_fields(intptr_t* obj_ptr, std::unordered_set<intptr_t*> &root_hashset);
-
-  // Helper function that coalesce free memory. Scan the freelist to find
-  // abutting free blocks, then merge the those blocks together into a single
-  // block.
-  void coalesce_free_list();
-};
\ No newline at end of file
+  size_t num_obj_left = 0, num_word_left = 0;
+
+  // Allocates from the current block, or in mark-sweep mode from the first
+  // free block that is large enough. Returns NULL if there is no room.
+  intptr_t* allocate_memory(int32_t num_words);
+
+  // Collects the heap in the current mode, and switches modes or slides the
+  // live objects together if that suits the program better or is the only
+  // way to make room for an object of 'num_words' words.
+  void collect(intptr_t *curr_frame_ptr, int32_t num_words);
+
+  // Copies everything reachable from the roots to the to space
+  void copy_from_roots();
+  void forward_slot(intptr_t *slot);
+  // Makes the semispaces around the copies free blocks
+  void switch_to_mark_sweep();
+
+  void mark_from_roots();
+  void mark_obj(intptr_t *obj_ptr);
+  // Merges the dead objects and free blocks into free blocks, rebuilds the
+  // free list and returns the size of the largest free block.
+  size_t sweep();
+  // Slides the live objects of the swept heap to the start of the heap, in
+  // address order, and returns the end of the last one.
+  intptr_t* slide();
+  intptr_t* slid_address(intptr_t *obj_ptr) const;
+};
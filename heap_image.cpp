@@ -0,0 +1,282 @@
+#include "heap_image.h"
+#include "gc.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const size_t kHeaderWords = 8;
+
+// Follows the forwarding pointer of an object copied by an incremental
+// collection, like heap snapshots do.
+intptr_t* current_copy(const Gc &gc, intptr_t *obj_ptr) {
+  intptr_t head = gc.HeaderOf(obj_ptr);
+  return (head & 1) == 0 ? (intptr_t*) head : obj_ptr;
+}
+
+// Bits of the fields of an object with the header word 'head' and the weak
+// bits 'weak_bits' that hold pointers, the bit of field i being bit i.
+uint32_t pointer_fields(uint32_t head, uint32_t weak_bits) {
+  return ((head | weak_bits) >> 1) & 0x7fffff;
+}
+
+}  // namespace
+
+bool WriteHeapImage(const std::string &path, const Gc &gc,
+                    intptr_t *frame_ptr, int32_t num_locals,
+                    uint32_t program_id) {
+  std::unordered_map<intptr_t*, uint32_t> weak_bits;
+  for (auto &weak : gc.WeakObjects()) {
+    weak_bits[weak.obj_ptr] = weak.weak_bits;
+  }
+
+  // Objects are numbered in breadth-first order from the locals, following
+  // the pointer bitmaps only. The weak fields are resolved once every
+  // object reachable without them is known.
+  std::unordered_map<intptr_t*, intptr_t> object_refs;
+  std::vector<intptr_t*> objects;
+  auto ref_of = [&](intptr_t *obj_ptr) -> intptr_t {
+    if (obj_ptr == NULL) return 0;
+    obj_ptr = current_copy(gc, obj_ptr);
+    auto inserted = object_refs.emplace(obj_ptr, (intptr_t) objects.size() + 1);
+    if (inserted.second) objects.push_back(obj_ptr);
+    return inserted.first->second;
+  };
+  auto weak_ref_of = [&](intptr_t *obj_ptr) -> intptr_t {
+    if (obj_ptr == NULL) return 0;
+    auto ref = object_refs.find(current_copy(gc, obj_ptr));
+    return ref == object_refs.end() ? 0 : ref->second;
+  };
+
+  uint32_t local_info = *(frame_ptr - 2);
+  std::vector<intptr_t> local_words;
+  for (int32_t i = 0; i < num_locals; i++) {
+    intptr_t value = *(frame_ptr - 3 - i);
+    bool is_pointer = i < 32 && (local_info >> i & 1);
+    local_words.push_back(is_pointer ? ref_of((intptr_t*) value) : value);
+  }
+
+  for (size_t i = 0; i < objects.size(); i++) {
+    HeaderLayout::ForEachPointerSlot(
+        objects[i], gc.HeaderOf(objects[i]),
+        [&](intptr_t *slot) { ref_of((intptr_t*) *slot); });
+  }
+
+  std::vector<intptr_t> object_words;
+  for (intptr_t *obj_ptr : objects) {
+    uint32_t head = gc.HeaderOf(obj_ptr);
+    auto weak = weak_bits.find(obj_ptr);
+    uint32_t weak_fields = weak == weak_bits.end() ? 0 : weak->second;
+    object_words.push_back((intptr_t) head);
+    object_words.push_back((intptr_t) weak_fields);
+
+    uint32_t strong = (head >> 1) & 0x7fffff;
+    uint32_t weak_only = (weak_fields >> 1) & ~strong;
+    for (uint32_t f = 0; f < head >> 24; f++) {
+      intptr_t value = obj_ptr[f];
+      if (f < 23 && (strong >> f & 1)) {
+        value = ref_of((intptr_t*) value);
+      } else if (f < 23 && (weak_only >> f & 1)) {
+        value = weak_ref_of((intptr_t*) value);
+      }
+      object_words.push_back(value);
+    }
+  }
+
+  // Written next to the image and renamed over it, so that a run that
+  // restores the image at the same time reads the old or the new one
+  std::string tmp_path = path + ".tmp";
+  FILE *out = fopen(tmp_path.c_str(), "wb");
+  if (out == NULL) return false;
+
+  intptr_t header[kHeaderWords] = {
+      kHeapImageMagic, kHeapImageVersion, (intptr_t) sizeof(intptr_t),
+      (intptr_t) program_id, num_locals, (intptr_t) local_info,
+      (intptr_t) objects.size(), (intptr_t) object_words.size()};
+  bool ok = fwrite(header, sizeof(header), 1, out) == 1;
+  for (auto *section : {&local_words, &object_words}) {
+    if (!section->empty()) {
+      ok = ok && fwrite(section->data(), sizeof(intptr_t), section->size(),
+                        out) == section->size();
+    }
+  }
+  ok = fclose(out) == 0 && ok;
+
+  if (ok) ok = rename(tmp_path.c_str(), path.c_str()) == 0;
+  if (!ok) unlink(tmp_path.c_str());
+  return ok;
+}
+
+namespace {
+
+// Frames laid out the way the code generator lays out L2 frames, whose
+// locals are the roots of the objects being restored. They sit on top of
+// the frame of the program's main block:
+//
+//   fp[1]                  return address, unused
+//   fp[0]                  frame pointer of the next frame
+//   fp[-1]                 argument info, no arguments
+//   fp[-2]                 local info, every local is a pointer
+//   fp[-3] .. fp[-34]      locals
+class RootFrames {
+ public:
+  RootFrames(size_t num_roots, intptr_t *main_frame_ptr)
+      : words(((num_roots + kRootsPerFrame - 1) / kRootsPerFrame) *
+                  kFrameWords, 0) {
+    intptr_t *next_frame_ptr = main_frame_ptr;
+    for (size_t f = words.size() / kFrameWords; f-- > 0;) {
+      intptr_t *fp = frame_ptr(f);
+      fp[0] = (intptr_t) next_frame_ptr;
+      fp[-1] = 0;
+      fp[-2] = (intptr_t) UINT32_MAX;
+      next_frame_ptr = fp;
+    }
+    top_frame_ptr = next_frame_ptr;
+  }
+
+  // Frame pointer of the innermost frame, for Alloc
+  intptr_t* top() { return top_frame_ptr; }
+
+  intptr_t& operator[](size_t i) {
+    return frame_ptr(i / kRootsPerFrame)[-3 - (int) (i % kRootsPerFrame)];
+  }
+
+ private:
+  static const size_t kRootsPerFrame = 32;
+  static const size_t kFrameWords = kRootsPerFrame + 4;
+
+  std::vector<intptr_t> words;
+  intptr_t *top_frame_ptr;
+
+  intptr_t* frame_ptr(size_t f) {
+    return words.data() + f * kFrameWords + kRootsPerFrame + 2;
+  }
+};
+
+// Checks that the image 'words' of 'size' words is complete and that every
+// reference in it names an object, and fills 'starts' with the position of
+// every object in the objects section.
+bool check_image(const intptr_t *words, size_t size, int32_t num_locals,
+                 uint32_t local_info, uint32_t program_id,
+                 std::vector<size_t> &starts) {
+  if (size < kHeaderWords || words[0] != kHeapImageMagic ||
+      words[1] != kHeapImageVersion || words[2] != sizeof(intptr_t) ||
+      (uint32_t) words[3] != program_id || words[4] != num_locals ||
+      (uint32_t) words[5] != local_info) {
+    return false;
+  }
+  size_t num_objects = words[6], num_object_words = words[7];
+  if (size != kHeaderWords + num_locals + num_object_words) return false;
+
+  const intptr_t *locals = words + kHeaderWords;
+  for (int32_t i = 0; i < num_locals && i < 32; i++) {
+    if ((local_info >> i & 1) && (uintptr_t) locals[i] > num_objects) {
+      return false;
+    }
+  }
+
+  const intptr_t *objects = locals + num_locals;
+  size_t pos = 0;
+  while (pos < num_object_words) {
+    if (num_object_words - pos < 2) return false;
+    uint32_t head = objects[pos];
+    uint32_t num_fields = head >> 24;
+    if ((head & 1) == 0 || num_object_words - pos - 2 < num_fields) {
+      return false;
+    }
+    uint32_t bitvector = pointer_fields(head, objects[pos + 1]);
+    for (uint32_t f = 0; f < num_fields && bitvector != 0; f++, bitvector >>= 1) {
+      if ((bitvector & 1) && (uintptr_t) objects[pos + 2 + f] > num_objects) {
+        return false;
+      }
+    }
+    starts.push_back(pos);
+    pos += 2 + num_fields;
+  }
+  return starts.size() == num_objects;
+}
+
+}  // namespace
+
+ImageRestore RestoreHeapImage(const std::string &path, Gc &gc,
+                              intptr_t *frame_ptr, int32_t num_locals,
+                              uint32_t program_id) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return ImageRestore::Missing;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0 ||
+      st.st_size % sizeof(intptr_t) != 0) {
+    close(fd);
+    return ImageRestore::Invalid;
+  }
+  void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return ImageRestore::Invalid;
+
+  const intptr_t *words = (const intptr_t*) mapping;
+  uint32_t local_info = *(frame_ptr - 2);
+  std::vector<size_t> starts;
+  if (!check_image(words, st.st_size / sizeof(intptr_t), num_locals,
+                   local_info, program_id, starts)) {
+    munmap(mapping, st.st_size);
+    return ImageRestore::Invalid;
+  }
+  const intptr_t *locals = words + kHeaderWords;
+  const intptr_t *objects = locals + num_locals;
+
+  // Allocate every object first, with its pointer fields nil, so that a
+  // collection never sees a field pointing to an object that has not been
+  // allocated. Until the end the objects are the roots of the frames on
+  // 'roots', so collections keep them and update their addresses.
+  RootFrames roots(starts.size(), frame_ptr);
+  try {
+    for (size_t i = 0; i < starts.size(); i++) {
+      const intptr_t *image_obj = objects + starts[i];
+      uint32_t head = image_obj[0], weak_bits = image_obj[1];
+      intptr_t *obj_ptr = weak_bits != 0
+          ? gc.AllocWeak(head, weak_bits, roots.top())
+          : gc.AllocTyped(head, roots.top());
+
+      uint32_t bitvector = pointer_fields(head, weak_bits);
+      for (uint32_t f = 0; f < head >> 24; f++) {
+        bool is_pointer = f < 23 && (bitvector >> f & 1);
+        obj_ptr[f] = is_pointer ? 0 : image_obj[2 + f];
+      }
+      roots[i] = (intptr_t) obj_ptr;
+    }
+  } catch (OutOfMemoryError &) {
+    munmap(mapping, st.st_size);
+    return ImageRestore::DoesNotFit;
+  }
+
+  // Patch the pointers. The stores go through the write barrier, which
+  // keeps the counts of a reference-counting collector and the cards of a
+  // generational one.
+  for (size_t i = 0; i < starts.size(); i++) {
+    const intptr_t *image_obj = objects + starts[i];
+    uint32_t head = image_obj[0];
+    uint32_t bitvector = pointer_fields(head, image_obj[1]);
+    for (uint32_t f = 0; f < head >> 24 && bitvector != 0; f++, bitvector >>= 1) {
+      intptr_t ref = image_obj[2 + f];
+      if ((bitvector & 1) && ref != 0) {
+        gc.WriteBarrier((intptr_t*) roots[i] + f, (intptr_t*) roots[ref - 1]);
+      }
+    }
+  }
+
+  for (int32_t i = 0; i < num_locals; i++) {
+    bool is_pointer = i < 32 && (local_info >> i & 1);
+    intptr_t value = locals[i];
+    if (is_pointer) value = value == 0 ? 0 : roots[value - 1];
+    *(frame_ptr - 3 - i) = value;
+  }
+
+  munmap(mapping, st.st_size);
+  return ImageRestore::Restored;
+}
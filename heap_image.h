@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+class Gc;
+
+// Heap images let a program skip the statements that build its data
+// structures. A program marks the end of that phase with a call to the
+// built-in 'checkpoint()' in its main block. The first run writes the locals
+// of the main block and the objects they reach to an image file when it gets
+// to the call. Later runs map the image, allocate its objects in their own
+// heap, patch the pointers between them and continue after the call.
+//
+// An image is a flat sequence of little-endian words of the runtime's word
+// size:
+//
+//   header:  'L2HI' magic, version, bytes per word, program id, num_locals,
+//            local info word, num_objects, num_object_words
+//   locals:  num_locals x { value }
+//   objects: num_objects x { header word, weak bits, fields }
+//
+// Pointers in locals and fields are stored as references: 0 for nil,
+// otherwise 1 + the position of the object in the objects section. The
+// fields of an object that hold pointers are the ones in the pointer bitmap
+// of its header word and in its weak bits (see Gc::AllocWeak). A weak field
+// whose object is only reachable through weak fields is stored as nil.
+//
+// The program id tells the images of different programs apart. It is the
+// offset of the code after the checkpoint from the runtime's code, so
+// rebuilding the program usually changes it.
+
+const uint32_t kHeapImageMagic = 0x4948324c;  // "L2HI"
+const uint32_t kHeapImageVersion = 1;
+
+// Writes the locals of the frame 'frame_ptr', the first 'num_locals' words
+// below its info words, and the objects they reach to 'path'. The file is
+// replaced at once, so a reader never sees part of an image. Returns false
+// if it could not be written.
+bool WriteHeapImage(const std::string &path, const Gc &gc,
+                    intptr_t *frame_ptr, int32_t num_locals,
+                    uint32_t program_id);
+
+// Outcome of RestoreHeapImage.
+enum class ImageRestore {
+  Restored,
+  // There is no image at the path
+  Missing,
+  // The file is not an image of this program
+  Invalid,
+  // The heap ran out of space before all objects of the image were
+  // allocated
+  DoesNotFit,
+};
+
+// Allocates the objects of the image at 'path' with 'gc' and stores the
+// locals of the image in the frame 'frame_ptr', which must be the frame of
+// the program's main block with 'num_locals' locals, all of them nil. The
+// frame is only changed if the image is restored.
+ImageRestore RestoreHeapImage(const std::string &path, Gc &gc,
+                              intptr_t *frame_ptr, int32_t num_locals,
+                              uint32_t program_id);
@@ -0,0 +1,127 @@
+#include "heap_snapshot.h"
+#include "gc.h"
+
+#include <csignal>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Pending snapshot request, stored as reason + 1 so that 0 means none.
+volatile sig_atomic_t pending_request = 0;
+
+struct SnapshotRoot {
+  uint32_t frame;
+  int32_t offset;
+  intptr_t *obj_ptr;
+};
+
+// Collects the roots of every frame between 'curr_frame_ptr' and
+// 'base_frame_ptr' using the argument and local info words. The frames are
+// recorded as belonging to 'thread'.
+void collect_roots(intptr_t *base_frame_ptr, intptr_t *curr_frame_ptr,
+                   uint32_t thread, std::vector<uint32_t> &frames,
+                   std::vector<SnapshotRoot> &roots) {
+  while (curr_frame_ptr != base_frame_ptr) {
+    uint32_t frame = frames.size() / 2;
+    frames.push_back((uint32_t)(uintptr_t) *(curr_frame_ptr + 1));
+    frames.push_back(thread);
+
+    FrameLayout::ForEachFrameSlot(curr_frame_ptr, [&](intptr_t *slot) {
+      int32_t offset = slot - curr_frame_ptr;
+      roots.push_back({frame, offset, (intptr_t*) *slot});
+    });
+
+    curr_frame_ptr = (intptr_t*) *curr_frame_ptr;
+  }
+}
+
+}  // namespace
+
+bool WriteHeapSnapshot(const std::string &path, const Gc &gc,
+                       intptr_t *base_frame_ptr, intptr_t *curr_frame_ptr,
+                       SnapshotReason reason) {
+  std::vector<uint32_t> frames;
+  std::vector<SnapshotRoot> roots;
+  collect_roots(base_frame_ptr, curr_frame_ptr, 0, frames, roots);
+  // The other threads are stopped while the runtime takes a snapshot
+  uint32_t thread = 1;
+  for (auto &stack : gc.ThreadStacks()) {
+    collect_roots(stack.base_frame_ptr, stack.top_frame_ptr, thread++,
+                  frames, roots);
+  }
+  for (auto &range : gc.ExternalRoots()) {
+    uint32_t frame = frames.size() / 2;
+    frames.push_back(0);
+    frames.push_back(kSnapshotHostThread);
+    for (size_t i = 0; i < range.second; i++) {
+      roots.push_back({frame, (int32_t) i, (intptr_t*) range.first[i]});
+    }
+  }
+
+  // Objects are numbered in breadth-first order from the roots, so the
+  // objects discovered while scanning object i are always appended after it.
+  std::unordered_map<intptr_t*, uint32_t> object_ids;
+  std::vector<intptr_t*> objects;
+  auto id_of = [&](intptr_t *obj_ptr) {
+    // During an incremental collection the heap may still point to objects
+    // that have been copied, their header is the address of the copy.
+    intptr_t head = gc.HeaderOf(obj_ptr);
+    if ((head & 1) == 0) obj_ptr = (intptr_t*) head;
+    auto inserted = object_ids.emplace(obj_ptr, (uint32_t) objects.size());
+    if (inserted.second) objects.push_back(obj_ptr);
+    return inserted.first->second;
+  };
+
+  std::vector<uint32_t> root_words;
+  for (auto &root : roots) {
+    if (root.obj_ptr == NULL) continue;
+    root_words.push_back(root.frame);
+    root_words.push_back((uint32_t) root.offset);
+    root_words.push_back(id_of(root.obj_ptr));
+  }
+
+  std::vector<uint32_t> object_words;
+  std::vector<uint32_t> edge_words;
+  for (size_t i = 0; i < objects.size(); i++) {
+    intptr_t *obj_ptr = objects[i];
+    uint32_t head = gc.HeaderOf(obj_ptr);
+    size_t first_edge = edge_words.size();
+
+    HeaderLayout::ForEachChild(obj_ptr, head, [&](intptr_t *child) {
+      edge_words.push_back(id_of(child));
+    });
+
+    object_words.push_back(head);
+    object_words.push_back(edge_words.size() - first_edge);
+  }
+
+  FILE *out = fopen(path.c_str(), "wb");
+  if (out == NULL) return false;
+
+  uint32_t header[] = {kHeapSnapshotMagic, kHeapSnapshotVersion,
+                       (uint32_t) reason, (uint32_t) frames.size() / 2,
+                       (uint32_t) objects.size(), (uint32_t) edge_words.size(),
+                       (uint32_t) root_words.size() / 3};
+  bool ok = fwrite(header, sizeof(header), 1, out) == 1;
+  for (auto *section : {&frames, &object_words, &edge_words, &root_words}) {
+    if (!section->empty()) {
+      ok = ok && fwrite(section->data(), 4, section->size(), out)
+                   == section->size();
+    }
+  }
+
+  return fclose(out) == 0 && ok;
+}
+
+void RequestHeapSnapshot(SnapshotReason reason) {
+  pending_request = (sig_atomic_t) reason + 1;
+}
+
+bool TakeHeapSnapshotRequest(SnapshotReason *reason) {
+  if (pending_request == 0) return false;
+  *reason = (SnapshotReason) (pending_request - 1);
+  pending_request = 0;
+  return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+class Gc;
+
+// Heap snapshots record the object graph reachable from the L2 stacks of all
+// threads so that the memory held by a program can be analyzed offline with
+// build/heap_analyzer.
+//
+// A snapshot is a flat sequence of little-endian 32-bit words:
+//
+//   header:  'L2HS' magic, version, reason, num_frames, num_objects,
+//            num_edges, num_roots
+//   frames:  num_frames x { return address, thread }, grouped by thread and
+//            innermost frame first. Thread 0 is the one that took the
+//            snapshot, the other threads follow in no particular order.
+//            The ranges of roots registered by a host come last, as a frame
+//            each with return address 0 and thread kSnapshotHostThread.
+//   objects: num_objects x { header word, number of outgoing edges }
+//   edges:   num_edges x { target object id }, grouped by source object in
+//            object order
+//   roots:   num_roots x { frame index, word offset from the frame pointer
+//                          or from the first slot of a host range,
+//                          object id }
+//
+// Object ids are the positions of the objects in the objects section. Only
+// non-nil pointers are recorded as edges and roots.
+
+const uint32_t kHeapSnapshotMagic = 0x5348324c;  // "L2HS"
+const uint32_t kHeapSnapshotVersion = 2;
+// Thread of the frames that hold the roots of the host, see HeapRoots in
+// runtime.h.
+const uint32_t kSnapshotHostThread = 0xffffffff;
+
+// Why a snapshot was taken, recorded in the snapshot header.
+enum class SnapshotReason : uint32_t {
+  Request = 0,
+  OutOfMemory = 1,
+  Signal = 2,
+};
+
+// Walks the stack from 'curr_frame_ptr' up to 'base_frame_ptr' and the stacks
+// of the other threads set in 'gc', adds the roots registered in 'gc' by the
+// host, traces every object reachable from the roots through the pointer
+// bitmaps in the header words, as reported by 'gc', and writes the resulting
+// graph to 'path'. Returns false if the file could not be written.
+bool WriteHeapSnapshot(const std::string &path, const Gc &gc,
+                       intptr_t *base_frame_ptr, intptr_t *curr_frame_ptr,
+                       SnapshotReason reason);
+
+// Asks the runtime to take a snapshot at the next allocation. Only sets a
+// flag, so it is safe to call from a signal handler.
+void RequestHeapSnapshot(SnapshotReason reason);
+
+// Returns true and clears the request if a snapshot has been requested since
+// the last call. The reason of the request is stored in 'reason'.
+bool TakeHeapSnapshotRequest(SnapshotReason *reason);
@@ -9,13 +9,17 @@ using namespace cs160::frontend;
 using namespace cs160::backend;
 
 void usage(char const* programName) {
-  std::cerr << "Usage: " << programName << " program.l2 [--gen-asm-only] output-file\n\n"
-            << "This program compiles given L2 program. If the `--gen-asm-only` option is given, it will only generate the assembly code, otherwise it will also link the assembly code with the bootstrap code and GC code to produce an executable.";
+  std::cerr << "Usage: " << programName << " program.l2 [--gen-asm-only] [--entry NAME] output-file\n\n"
+            << "This program compiles given L2 program. If the `--gen-asm-only` option is given, it will only generate the assembly code, otherwise it will also link the assembly code with the bootstrap code and GC code to produce an executable.\n"
+            << "The `--entry` option names the entry point of the program, `Entry` by default. Programs that are linked into the same host program need different names; the bootstrap code only calls `Entry`. Every function `f` of the program is exported as `NAME_f` for hosts.";
 }
 
 // Option for generating assembly only
 const std::string OnlyGenAsm{"--gen-asm-only"};
 
+// Option for naming the entry point
+const std::string EntryOption{"--entry"};
+
 // C++ compiler. We use it as linker. GCC's C++ compier is usually named `g++` on most systems.
 const std::string CPPCompiler{"g++"};
 
@@ -24,17 +28,25 @@ const std::string Assembler{"as"};
 
 int main(int argc, char* argv[]) {
   std::string outputFileName;
+  std::string entryName{"Entry"};
   bool link = true;
 
-  if (argc == 3) {
-    outputFileName = argv[2];
-  } else if (argc == 4 && OnlyGenAsm == argv[2]) {
-    outputFileName = argv[3];
-    link = false;
-  } else{
+  int arg = 2;
+  for (; arg < argc - 1; ++arg) {
+    if (OnlyGenAsm == argv[arg]) {
+      link = false;
+    } else if (EntryOption == argv[arg] && arg + 1 < argc - 1) {
+      entryName = argv[++arg];
+    } else {
+      break;
+    }
+  }
+
+  if (argc < 3 || arg != argc - 1) {
     usage(argv[0]);
     return 1;
   }
+  outputFileName = argv[arg];
 
   std::ifstream programFile{argv[1]};
   if (!programFile.is_open()) {
@@ -63,7 +75,7 @@ int main(int argc, char* argv[]) {
 
   // Run the code generator
   std::cout << "Generating code" << std::endl;
-  CodeGen codeGen;
+  CodeGen codeGen{entryName};
   auto insns = codeGen.generateCode(*ast);
 
   // Write out the assembly file
@@ -98,7 +110,7 @@ int main(int argc, char* argv[]) {
     std::cout << "Linking the bootstrap code with L2 program object code\n";
     // reset the command line
     cmdLine = std::ostringstream{};
-    cmdLine << CPPCompiler << " -m32 build/bootstrap.o build/gc.o " << outputFileName << ".o -o " << outputFileName;
+    cmdLine << CPPCompiler << " -m32 -pthread build/bootstrap.o build/runtime.o build/gc.o build/heap_snapshot.o build/heap_image.o build/alloc_trace.o build/profiler.o build/perf_counters.o build/program_stack.o " << outputFileName << ".o -o " << outputFileName;
     cmd = cmdLine.str();
     std::cout << "Running linker command: " << cmd << std::endl;
     // Run the linker
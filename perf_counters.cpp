@@ -0,0 +1,167 @@
+#include "perf_counters.h"
+
+#include <cstdio>
+#include <linux/perf_event.h>
+#include <string>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+struct EventConfig {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+};
+
+const EventConfig kEvents[kNumPerfEvents] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"dtlb_misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+const char *kPhaseNames[] = {"none", "mutator", "gc"};
+
+// Formats a ratio with three decimals
+std::string ratio(double value) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.3f", value);
+  return text;
+}
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Opens 'event' for the calling thread, in the group of 'group_fd' unless
+// it is -1. Returns -1 if the kernel or the CPU does not provide it.
+int open_event(const EventConfig &event, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = event.type;
+  attr.config = event.config;
+  attr.disabled = group_fd == -1;
+  // Paranoid kernels only let users count their own code
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+}  // namespace
+
+PerfCounters::~PerfCounters() {
+  Stop();
+}
+
+void PerfCounters::Start() {
+  // New counters start from 0
+  memset(phase_start_events, 0, sizeof(phase_start_events));
+  num_open = 0;
+  for (int event = 0; event < kNumPerfEvents; event++) {
+    fds[event] = open_event(kEvents[event], group_fd);
+    slots[event] = fds[event] >= 0 ? num_open++ : -1;
+    if (fds[event] >= 0 && group_fd == -1) group_fd = fds[event];
+  }
+  if (group_fd != -1 &&
+      ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) != 0) {
+    Stop();
+    for (int &slot : slots) slot = -1;
+  }
+  enter_phase(PerfPhase::Mutator);
+}
+
+void PerfCounters::Stop() {
+  if (phase != PerfPhase::None) enter_phase(PerfPhase::None);
+  for (int &fd : fds) {
+    if (fd >= 0) close(fd);
+    fd = -1;
+  }
+  group_fd = -1;
+  num_open = 0;
+}
+
+void PerfCounters::PauseStarted() {
+  paused_phase = phase;
+  enter_phase(PerfPhase::Gc);
+}
+
+void PerfCounters::PauseEnded() {
+  enter_phase(paused_phase);
+}
+
+void PerfCounters::enter_phase(PerfPhase next) {
+  uint64_t now = now_ns();
+  // Counts that cannot be read stay where they were
+  uint64_t events[kNumPerfEvents];
+  memcpy(events, phase_start_events, sizeof(events));
+  read_events(events);
+
+  PerfTotals &phase_totals = totals[(int) phase];
+  phase_totals.time_ns += now - phase_start_ns;
+  for (int event = 0; event < kNumPerfEvents; event++) {
+    phase_totals.events[event] += events[event] - phase_start_events[event];
+    phase_start_events[event] = events[event];
+  }
+  phase_start_ns = now;
+  phase = next;
+}
+
+void PerfCounters::read_events(uint64_t *events) const {
+  if (group_fd == -1) return;
+
+  // nr, time enabled, time running, then a value per event
+  uint64_t values[3 + kNumPerfEvents];
+  ssize_t size = sizeof(uint64_t) * (3 + num_open);
+  if (read(group_fd, values, size) != size || values[2] == 0) return;
+
+  for (int event = 0; event < kNumPerfEvents; event++) {
+    if (slots[event] < 0) continue;
+    // The counters only ran for part of the time if the kernel multiplexed
+    // them, scale them to the whole time
+    events[event] = (uint64_t) ((double) values[3 + slots[event]] *
+                                values[1] / values[2]);
+  }
+}
+
+void PerfCounters::Report(std::ostream &out) const {
+  for (PerfPhase phase : {PerfPhase::Mutator, PerfPhase::Gc}) {
+    const PerfTotals &phase_totals = Totals(phase);
+    out << "perf-stats: phase=" << kPhaseNames[(int) phase]
+        << " time_us=" << phase_totals.time_ns / 1000;
+    bool any_counter = false;
+    for (int event = 0; event < kNumPerfEvents; event++) {
+      if (!Available((PerfEvent) event)) continue;
+      out << " " << kEvents[event].name << "=" << phase_totals.events[event];
+      any_counter = true;
+    }
+    if (!any_counter) {
+      out << " counters=unavailable\n";
+      continue;
+    }
+
+    double cycles = phase_totals.events[kPerfCycles];
+    double kilo_instructions = phase_totals.events[kPerfInstructions] / 1000.0;
+    if (Available(kPerfCycles) && Available(kPerfInstructions) && cycles > 0) {
+      out << " ipc=" << ratio(phase_totals.events[kPerfInstructions] / cycles);
+    }
+    if (Available(kPerfInstructions) && kilo_instructions > 0) {
+      for (PerfEvent event : {kPerfCacheMisses, kPerfDtlbMisses}) {
+        if (!Available(event)) continue;
+        out << " " << kEvents[event].name << "_per_kinsn="
+            << ratio(phase_totals.events[event] / kilo_instructions);
+      }
+    }
+    out << "\n";
+  }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "gc.h"
+
+#include <stdint.h>
+
+#include <ostream>
+
+// Hardware performance counters of the runs of a context, read separately
+// while the program runs (the mutator phase) and while the collector pauses
+// it (the gc phase), so that the cache behaviour of a program can be told
+// apart from the cost of collecting it. The counters are read when a phase
+// ends, which takes a system call, so a phase only ends at the start and the
+// end of a run and of a pause: allocations that do not collect count as
+// mutator work.
+//
+// The counters are opened with perf_event_open as one group, for user-space
+// events of the thread that calls RuntimeContext::Run. Spawned threads and
+// the threads that help the collector are not counted. Counters that the
+// kernel or the CPU does not provide are left out, and with none of them
+// only the times of the phases are reported.
+
+// Events counted in every phase.
+enum PerfEvent {
+  kPerfCycles,
+  kPerfInstructions,
+  // Last-level cache misses
+  kPerfCacheMisses,
+  // Data TLB misses on loads
+  kPerfDtlbMisses,
+  kNumPerfEvents,
+};
+
+enum class PerfPhase {
+  // Outside of runs
+  None,
+  Mutator,
+  Gc,
+};
+
+// What was counted in a phase, summed over all its occurrences.
+struct PerfTotals {
+  uint64_t time_ns = 0;
+  // Scaled up if the kernel had to share the counters with other groups
+  uint64_t events[kNumPerfEvents] = {};
+};
+
+class PerfCounters : public GcPauseListener {
+ public:
+  PerfCounters() {}
+  ~PerfCounters() override;
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  // Opens the counters for the calling thread and starts the mutator phase.
+  // Called by Run.
+  void Start();
+  // Ends the current phase and closes the counters.
+  void Stop();
+
+  // Whether 'event' could be counted in the last run
+  bool Available(PerfEvent event) const { return slots[event] >= 0; }
+  const PerfTotals& Totals(PerfPhase phase) const {
+    return totals[(int) phase];
+  }
+
+  // Writes one line per phase with its time, the events, the instructions
+  // per cycle and the misses per thousand instructions, like:
+  //   perf-stats: phase=gc time_us=1200 cycles=... ipc=1.52 ...
+  void Report(std::ostream &out) const;
+
+  void PauseStarted() override;
+  void PauseEnded() override;
+
+ private:
+  // File descriptor of the group leader, -1 if no counter is open
+  int group_fd = -1;
+  int fds[kNumPerfEvents] = {-1, -1, -1, -1};
+  // Position of each event in the group reads, -1 if it is not counted
+  int slots[kNumPerfEvents] = {-1, -1, -1, -1};
+  int num_open = 0;
+
+  PerfPhase phase = PerfPhase::None;
+  // The phase a pause interrupted
+  PerfPhase paused_phase = PerfPhase::None;
+  uint64_t phase_start_ns = 0;
+  uint64_t phase_start_events[kNumPerfEvents] = {};
+  PerfTotals totals[3];
+
+  // Ends the current phase, adding what it counted to its totals, and
+  // starts 'next'
+  void enter_phase(PerfPhase next);
+  // Reads the scaled counts of the group into 'events'
+  void read_events(uint64_t *events) const;
+};
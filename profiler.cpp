@@ -0,0 +1,227 @@
+#include "profiler.h"
+#include "gc.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <map>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <vector>
+
+// Function table of the programs, see profiler.h. Weak, so that a host
+// without programs still links.
+struct L2Function {
+  const char *start;
+  const char *end;
+  const char *name;
+};
+extern "C" {
+extern const L2Function __start_l2_functions[] __attribute__((weak));
+extern const L2Function __stop_l2_functions[] __attribute__((weak));
+}
+
+namespace {
+
+// Pseudo-frames, function indices are positive
+const int32_t kGcFrame = -1;
+const int32_t kNativeFrame = -2;
+const int32_t kTruncatedFrame = -3;
+
+// Distinct stacks the table holds, a power of two, and the entries a
+// sample probes before it is dropped
+const size_t kProfileStacks = 8192;
+const size_t kMaxProbes = 64;
+
+// States of a table entry. An entry is claimed by one sample and filled in
+// before other samples compare against it.
+const uint32_t kFree = 0;
+const uint32_t kFilling = 1;
+const uint32_t kFilled = 2;
+
+struct StackCount {
+  uint32_t state;
+  uint32_t hash;
+  int32_t depth;
+  uint32_t count;
+  // innermost first
+  int32_t frames[kProfileMaxDepth];
+};
+
+bool profiling = false;
+std::vector<L2Function> functions;
+std::vector<StackCount> stacks;
+uint32_t num_dropped = 0;
+
+thread_local intptr_t *profiled_base_frame_ptr = NULL;
+
+// Index of the function containing 'address' in 'functions', -1 if none
+int32_t function_at(uintptr_t address) {
+  auto next = std::upper_bound(
+      functions.begin(), functions.end(), address,
+      [](uintptr_t a, const L2Function &f) { return a < (uintptr_t) f.start; });
+  if (next == functions.begin()) return -1;
+  --next;
+  return address < (uintptr_t) next->end ? next - functions.begin() : -1;
+}
+
+void count_stack(const int32_t *frames, int32_t depth) {
+  uint32_t hash = 2166136261u;
+  for (int32_t i = 0; i < depth; i++) {
+    hash = (hash ^ (uint32_t) frames[i]) * 16777619u;
+  }
+
+  for (size_t probe = 0; probe < kMaxProbes; probe++) {
+    StackCount &entry = stacks[(hash + probe) & (kProfileStacks - 1)];
+    uint32_t state = __atomic_load_n(&entry.state, __ATOMIC_ACQUIRE);
+    if (state == kFree) {
+      if (__atomic_compare_exchange_n(&entry.state, &state, kFilling, false,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        entry.hash = hash;
+        entry.depth = depth;
+        std::copy(frames, frames + depth, entry.frames);
+        entry.count = 1;
+        __atomic_store_n(&entry.state, kFilled, __ATOMIC_RELEASE);
+        return;
+      }
+    }
+    // An entry being filled by another thread is skipped, the stack may
+    // then be counted twice and is merged when the profile is written
+    if (state == kFilled && entry.hash == hash && entry.depth == depth &&
+        std::equal(frames, frames + depth, entry.frames)) {
+      __atomic_fetch_add(&entry.count, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+  __atomic_fetch_add(&num_dropped, 1, __ATOMIC_RELAXED);
+}
+
+void handle_sample(int, siginfo_t *, void *context) {
+  int saved_errno = errno;
+  const mcontext_t &regs = ((ucontext_t*) context)->uc_mcontext;
+#if defined(__i386__)
+  uintptr_t pc = regs.gregs[REG_EIP];
+  intptr_t *frame_ptr = (intptr_t*) regs.gregs[REG_EBP];
+  intptr_t *stack_ptr = (intptr_t*) regs.gregs[REG_ESP];
+#else
+  uintptr_t pc = regs.gregs[REG_RIP];
+  intptr_t *frame_ptr = (intptr_t*) regs.gregs[REG_RBP];
+  intptr_t *stack_ptr = (intptr_t*) regs.gregs[REG_RSP];
+#endif
+
+  int32_t frames[kProfileMaxDepth];
+  int32_t depth = 0;
+  if (Gc::InCollector()) frames[depth++] = kGcFrame;
+
+  intptr_t *base_frame_ptr = profiled_base_frame_ptr;
+  if (base_frame_ptr != NULL) {
+    int32_t function = function_at(pc);
+    if (function >= 0) frames[depth++] = function;
+
+    // The frame pointer is only followed while it points into the stack
+    // between the interrupted stack pointer and the base frame and grows
+    // towards the base, code without frame pointers may use it for
+    // anything
+    while (frame_ptr >= stack_ptr && frame_ptr < base_frame_ptr &&
+           ((uintptr_t) frame_ptr & (sizeof(intptr_t) - 1)) == 0) {
+      function = function_at((uintptr_t) *(frame_ptr + 1));
+      if (function >= 0) {
+        if (depth == kProfileMaxDepth) {
+          frames[kProfileMaxDepth - 1] = kTruncatedFrame;
+          break;
+        }
+        frames[depth++] = function;
+      }
+      intptr_t *next_frame_ptr = (intptr_t*) *frame_ptr;
+      if (next_frame_ptr <= frame_ptr) break;
+      frame_ptr = next_frame_ptr;
+    }
+  }
+
+  if (depth == 0) frames[depth++] = kNativeFrame;
+  count_stack(frames, depth);
+  errno = saved_errno;
+}
+
+const char* frame_name(int32_t frame) {
+  switch (frame) {
+    case kGcFrame: return "[gc]";
+    case kNativeFrame: return "[native]";
+    case kTruncatedFrame: return "[truncated]";
+    default: return functions[frame].name;
+  }
+}
+
+}  // namespace
+
+bool StartProfiler(int hz) {
+  if (profiling || hz <= 0) return false;
+
+  functions.clear();
+  if (__start_l2_functions != NULL) {
+    functions.assign(__start_l2_functions, __stop_l2_functions);
+  }
+  std::sort(functions.begin(), functions.end(),
+            [](const L2Function &a, const L2Function &b) {
+              return a.start < b.start;
+            });
+  stacks.assign(kProfileStacks, StackCount());
+  num_dropped = 0;
+
+  // Restarting interrupted system calls keeps the waits of the runtime and
+  // the host from failing with EINTR
+  struct sigaction action = {};
+  action.sa_sigaction = handle_sample;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, NULL) != 0) return false;
+
+  long interval_us = std::max(1000000L / hz, 1L);
+  struct itimerval timer = {};
+  timer.it_interval.tv_sec = interval_us / 1000000;
+  timer.it_interval.tv_usec = interval_us % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+    signal(SIGPROF, SIG_DFL);
+    return false;
+  }
+  profiling = true;
+  return true;
+}
+
+bool StopProfiler(const std::string &path) {
+  if (!profiling) return false;
+  profiling = false;
+  struct itimerval timer = {};
+  setitimer(ITIMER_PROF, &timer, NULL);
+  // A signal that is still pending is dropped
+  signal(SIGPROF, SIG_IGN);
+
+  std::map<std::string, uint64_t> folded;
+  for (const StackCount &entry : stacks) {
+    if (entry.state != kFilled) continue;
+    std::string line;
+    for (int32_t i = entry.depth; i-- > 0;) {
+      if (!line.empty()) line += ';';
+      line += frame_name(entry.frames[i]);
+    }
+    folded[line] += entry.count;
+  }
+  if (num_dropped != 0) folded["[dropped]"] += num_dropped;
+
+  FILE *out = fopen(path.c_str(), "w");
+  if (out == NULL) return false;
+  bool ok = true;
+  for (auto &stack : folded) {
+    ok = ok && fprintf(out, "%s %llu\n", stack.first.c_str(),
+                       (unsigned long long) stack.second) > 0;
+  }
+  return fclose(out) == 0 && ok;
+}
+
+intptr_t* SetProfiledStack(intptr_t *base_frame_ptr) {
+  intptr_t *previous = profiled_base_frame_ptr;
+  profiled_base_frame_ptr = base_frame_ptr;
+  return previous;
+}
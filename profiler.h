@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+// The profiler samples the call stacks of the running L2 programs on a
+// SIGPROF timer, which counts the CPU time of the whole process. The signal
+// handler walks the saved frame pointers of the interrupted thread the way
+// Gc::stack_walk does and counts the stack in a table allocated up front, so
+// a sample takes no locks and allocates nothing.
+//
+// Return addresses are mapped to functions with the table that the code
+// generator emits into the l2_functions section of every program: one entry
+// of three words per function, its start address, its end address and its
+// name. The linker gathers the tables of all programs of the executable.
+//
+// The profile is written as folded stacks, the input of flamegraph.pl: one
+// line per distinct stack with its frames from the outermost, separated by
+// ';', and the number of samples. The outermost frame of a program is its
+// entry point. Besides the L2 functions there are pseudo-frames:
+//
+//   [gc]         the collector, innermost on the stack of the program that
+//                collects, or alone on the threads that help it
+//   [native]     a thread that runs no L2 code, like the host
+//   [truncated]  the outer frames of a stack deeper than kProfileMaxDepth
+//   [dropped]    samples of stacks that no longer fit in the table
+
+// Samples per second of CPU time if the host does not choose.
+const int kDefaultProfileHz = 100;
+
+// Frames recorded per sample, the innermost ones.
+const int kProfileMaxDepth = 64;
+
+// Starts sampling 'hz' times per second of CPU time. Returns false if the
+// profiler is already running or the timer could not be set up.
+bool StartProfiler(int hz);
+
+// Stops sampling and writes the folded stacks to 'path'. Call it once the
+// programs are done. Returns false if the profiler was not running or the
+// file could not be written.
+bool StopProfiler(const std::string &path);
+
+// Sets the frame pointer of the frame right below the first L2 frame of the
+// calling thread, where the profiler stops walking its stack, or NULL while
+// the thread runs no L2 code. Returns the previous one. Called by the
+// runtime.
+intptr_t* SetProfiledStack(intptr_t *base_frame_ptr);
@@ -0,0 +1,137 @@
+#include "program_stack.h"
+
+#include <csignal>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+namespace {
+
+// Size of the alternate signal stack the fault handler runs on, which it
+// needs because the program stack has no room left when it overflows
+const size_t kSignalStackBytes = 64 << 10;
+
+// A call of ProgramStack::Run on the calling thread
+struct StackRun {
+  const std::function<void()> *function;
+  std::exception_ptr error;
+  // Where the call returns to once 'function' is done
+  ucontext_t caller;
+  char *guard_begin, *guard_end;
+  void (*on_overflow)();
+  // The call this one runs in, if 'function' runs another program stack
+  StackRun *outer;
+};
+
+thread_local StackRun *current_run = NULL;
+
+std::once_flag handler_installed;
+// The SIGSEGV action before ours, which gets the faults that are not stack
+// overflows
+struct sigaction previous_action;
+
+void handle_fault(int signal_number, siginfo_t *info, void *context) {
+  char *address = (char*) info->si_addr;
+  for (StackRun *run = current_run; run != NULL; run = run->outer) {
+    if (address < run->guard_begin || address >= run->guard_end) continue;
+    if (run->on_overflow != NULL) run->on_overflow();
+    static const char message[] = "Stack overflow of the L2 program.\n";
+    ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+    (void) written;
+    break;
+  }
+
+  // Returning runs the faulting instruction again, which then goes to the
+  // previous action
+  if (previous_action.sa_flags & SA_SIGINFO) {
+    previous_action.sa_sigaction(signal_number, info, context);
+  } else if (previous_action.sa_handler != SIG_DFL &&
+             previous_action.sa_handler != SIG_IGN) {
+    previous_action.sa_handler(signal_number);
+  } else {
+    signal(SIGSEGV, SIG_DFL);
+  }
+}
+
+void install_handler() {
+  struct sigaction action = {};
+  action.sa_sigaction = handle_fault;
+  // The overflow function may leave the handler with longjmp, which does
+  // not unblock the signal
+  action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &previous_action);
+}
+
+// Body of the program stack, started by makecontext
+void run_function() {
+  StackRun *run = current_run;
+  try {
+    (*run->function)();
+  } catch (...) {
+    // Exceptions cannot be unwound past the start of the stack
+    run->error = std::current_exception();
+  }
+}
+
+}  // namespace
+
+ProgramStack::ProgramStack(size_t size_bytes) {
+  size_t page_bytes = sysconf(_SC_PAGESIZE);
+  size = (size_bytes + page_bytes - 1) / page_bytes * page_bytes;
+  mapping_bytes = kStackGuardBytes + size;
+  void *memory = mmap(NULL, mapping_bytes, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    throw std::runtime_error("Cannot reserve a stack of " +
+                             std::to_string(size_bytes) + " bytes.");
+  }
+  mapping = (char*) memory;
+  stack = mapping + kStackGuardBytes;
+  if (mprotect(stack, size, PROT_READ | PROT_WRITE) != 0) {
+    munmap(mapping, mapping_bytes);
+    throw std::runtime_error("Cannot reserve a stack of " +
+                             std::to_string(size_bytes) + " bytes.");
+  }
+}
+
+ProgramStack::~ProgramStack() {
+  munmap(mapping, mapping_bytes);
+}
+
+void ProgramStack::Run(const std::function<void()> &function,
+                       void (*on_overflow)()) {
+  std::call_once(handler_installed, install_handler);
+
+  // The handler needs a stack of its own on this thread
+  std::unique_ptr<char[]> signal_stack(new char[kSignalStackBytes]);
+  stack_t alternate = {}, previous_alternate;
+  alternate.ss_sp = signal_stack.get();
+  alternate.ss_size = kSignalStackBytes;
+  sigaltstack(&alternate, &previous_alternate);
+
+  StackRun run;
+  run.function = &function;
+  run.guard_begin = mapping;
+  run.guard_end = stack;
+  run.on_overflow = on_overflow;
+  run.outer = current_run;
+  current_run = &run;
+
+  ucontext_t callee;
+  getcontext(&callee);
+  callee.uc_stack.ss_sp = stack;
+  callee.uc_stack.ss_size = size;
+  callee.uc_link = &run.caller;
+  makecontext(&callee, run_function, 0);
+  swapcontext(&run.caller, &callee);
+
+  current_run = run.outer;
+  sigaltstack(&previous_alternate, NULL);
+  if (run.error) std::rethrow_exception(run.error);
+}
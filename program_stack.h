@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <functional>
+#include <stdexcept>
+
+// Thrown by RuntimeContext::Run if the L2 program ran out of stack.
+struct StackOverflowError : public std::runtime_error {
+  StackOverflowError() : runtime_error("Stack overflow.") {}
+};
+
+// Size of the stack bootstrap.cpp runs programs on if the environment does
+// not choose one.
+const size_t kDefaultProgramStackBytes = 256 << 20;
+
+// Bytes below a program stack that are never mapped, so that running off
+// its end faults. Larger than a page because a frame with many locals moves
+// the stack pointer past a page before it touches it.
+const size_t kStackGuardBytes = 64 << 10;
+
+// A stack of its own for running L2 programs, which recurse as deep as their
+// data and easily outgrow the stack of the thread that runs them. The whole
+// stack is reserved up front without committing memory, so it grows a page
+// at a time as the program touches it and a large reservation only costs
+// address space.
+//
+// Running off the end of the stack hits the guard below it. A SIGSEGV
+// handler, which runs on an alternate signal stack of the thread, tells such
+// faults apart from others and calls the overflow function given to Run;
+// other faults go to the handler that was installed before.
+class ProgramStack {
+ public:
+  // Reserves a stack of 'size_bytes', rounded up to whole pages. Throws
+  // std::runtime_error if the address space is not available.
+  explicit ProgramStack(size_t size_bytes);
+  ~ProgramStack();
+
+  ProgramStack(const ProgramStack&) = delete;
+  ProgramStack& operator=(const ProgramStack&) = delete;
+
+  size_t Size() const { return size; }
+
+  // Calls 'function' on this stack and returns once it returns, on the
+  // calling thread. An exception thrown by 'function' is thrown again on the
+  // caller's stack. If 'function' overflows the stack, 'on_overflow' is
+  // called from the signal handler. It can leave the function with longjmp;
+  // if it returns, the overflow is reported on standard error and the
+  // process gets the fault like without a handler.
+  void Run(const std::function<void()> &function, void (*on_overflow)());
+
+ private:
+  char *mapping = NULL;
+  size_t mapping_bytes = 0;
+  // The usable part of the mapping, above the guard
+  char *stack = NULL;
+  size_t size = 0;
+};
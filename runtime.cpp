@@ -0,0 +1,704 @@
+#include "runtime.h"
+#include "heap_image.h"
+#include "heap_snapshot.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+int32_t safepoint_requested = 0;
+
+namespace {
+
+thread_local RuntimeContext *current_context = NULL;
+
+// Words of the allocation buffers of threads
+const int32_t kBufferWords = 1024;
+
+// Values a program's abort jmp_buf is jumped to with
+const int kAbortOutOfMemory = 1;
+const int kAbortStackOverflow = 2;
+
+// Heap snapshot configuration, shared by all contexts.
+std::string snapshot_path;
+std::atomic<int> num_snapshots(0);
+
+// Writes a heap snapshot for the stack of 'context' ending at
+// 'curr_frame_ptr'. The first snapshot goes to the configured path, later
+// ones get a sequence number.
+void DumpHeapSnapshot(RuntimeContext *context, intptr_t *curr_frame_ptr,
+                      SnapshotReason reason) {
+  std::string path = snapshot_path;
+  int snapshot_num = num_snapshots++;
+  if (snapshot_num > 0) path += "." + std::to_string(snapshot_num);
+
+  if (WriteHeapSnapshot(path, context->GetGc(), context->BaseFramePtr(),
+                        curr_frame_ptr, reason)) {
+    std::cerr << "Heap snapshot written to " << path << "\n";
+  } else {
+    std::cerr << "Failed to write heap snapshot to " << path << "\n";
+  }
+}
+
+}  // namespace
+
+thread_local RuntimeContext::Mutator *RuntimeContext::current_mutator = NULL;
+
+RuntimeContext::RuntimeContext(const RuntimeOptions &options) {
+  if (options.collector == "marksweep") {
+    gc.reset(new GcMarkSweep(/*frame_ptr=*/NULL, options.heap_size_in_words,
+                             options.huge_pages, options.gc_threads,
+                             options.concurrent_sweep, options.generational));
+  } else if (options.collector == "bibop") {
+    gc.reset(new GcBibop(/*frame_ptr=*/NULL, options.heap_size_in_words,
+                         options.huge_pages));
+  } else if (options.collector == "refcount") {
+    gc.reset(new GcRefCount(/*frame_ptr=*/NULL, options.heap_size_in_words,
+                            options.huge_pages));
+  } else if (options.collector == "hybrid") {
+    gc.reset(new GcHybrid(/*frame_ptr=*/NULL, options.heap_size_in_words,
+                          options.huge_pages));
+  } else if (options.collector == "semispace") {
+    gc.reset(new GcSemiSpace(/*frame_ptr=*/NULL, options.heap_size_in_words,
+                             options.huge_pages,
+                             options.incremental_scan_words));
+  } else {
+    throw std::invalid_argument("Unknown collector '" + options.collector +
+                                "', expected 'marksweep', 'semispace', "
+                                "'refcount', 'bibop' or 'hybrid'.");
+  }
+
+  if (!options.trace_path.empty()) {
+    if (options.collector == "semispace" || options.collector == "hybrid") {
+      throw std::invalid_argument("Allocation traces identify objects by "
+                                  "address and cannot be recorded with the "
+                                  "semispace or hybrid collector.");
+    }
+    if (!options.image_path.empty()) {
+      throw std::invalid_argument("Allocation traces cannot be recorded "
+                                  "together with heap images, the objects "
+                                  "of an image are not traced.");
+    }
+    trace.reset(new AllocTrace(options.trace_path, options.heap_size_in_words,
+                               options.trace_roots_interval_words));
+  }
+  image_path = options.image_path;
+  if (options.stack_size_bytes > 0) {
+    stack.reset(new ProgramStack(options.stack_size_bytes));
+  }
+
+  if (options.perf_counters) {
+    perf_counters.reset(new PerfCounters());
+    gc->SetPauseListener(perf_counters.get());
+  }
+}
+
+int32_t RuntimeContext::Run(L2EntryPoint entry) {
+  // The entry takes no arguments and ignores the ones it gets, like the
+  // functions of spawned threads
+  return Run(reinterpret_cast<L2ExportedFunction>(entry), {});
+}
+
+int32_t RuntimeContext::Run(L2ExportedFunction function,
+                            const std::vector<intptr_t> &args) {
+  if (args.size() > (size_t) kMaxSpawnArgs) {
+    throw std::invalid_argument("L2 functions take at most " +
+                                std::to_string(kMaxSpawnArgs) +
+                                " arguments.");
+  }
+  intptr_t all_args[kMaxSpawnArgs] = {};
+  std::copy(args.begin(), args.end(), all_args);
+  if (!stack) return run_program(function, all_args);
+
+  int32_t result = 0;
+  stack->Run([&] { result = run_program(function, all_args); },
+             abort_stack_overflow);
+  return result;
+}
+
+int32_t RuntimeContext::run_program(L2ExportedFunction function,
+                                    const intptr_t *args) {
+  RuntimeContext *previous_context = current_context;
+  Mutator *previous_mutator = current_mutator;
+  intptr_t *previous_profiled_stack = SetProfiledStack(NULL);
+  jmp_buf abort;
+
+  int abort_reason = setjmp(abort);
+  if (abort_reason != 0) {
+    // AbortOutOfMemory or abort_stack_overflow jumped over the frames of
+    // the program
+    end_threads();
+    if (perf_counters) perf_counters->Stop();
+    current_context = previous_context;
+    current_mutator = previous_mutator;
+    SetProfiledStack(previous_profiled_stack);
+    flush_trace();
+    if (abort_reason == kAbortStackOverflow) throw StackOverflowError();
+    throw OutOfMemoryError();
+  }
+
+  // The program's function saves the frame pointer of this function, so
+  // this is where its stack walks have to stop. Its arguments are part of
+  // its frame.
+  base_frame_ptr = (intptr_t*) __builtin_frame_address(0);
+  gc->SetBaseFramePtr(base_frame_ptr);
+  mutators.emplace_back(new Mutator());
+  mutators[0]->base_frame_ptr = base_frame_ptr;
+  mutators[0]->abort = &abort;
+  num_running = 1;
+  current_context = this;
+  current_mutator = mutators[0].get();
+  SetProfiledStack(base_frame_ptr);
+  if (perf_counters) perf_counters->Start();
+
+  int32_t result = function(args[0], args[1], args[2], args[3], args[4],
+                            args[5], args[6], args[7]);
+
+  bool thread_out_of_memory = end_threads();
+  if (perf_counters) perf_counters->Stop();
+  current_context = previous_context;
+  current_mutator = previous_mutator;
+  SetProfiledStack(previous_profiled_stack);
+  flush_trace();
+  if (thread_out_of_memory) throw OutOfMemoryError();
+  return result;
+}
+
+void RuntimeContext::AllocObjects(uint32_t tag, size_t count,
+                                  const intptr_t *fields, HeapRoots &roots,
+                                  size_t first) {
+  leave_stack();
+  uint32_t num_fields = HeaderLayout::NumFields(tag);
+  bool pointer_free = HeaderLayout::PointerBits(tag) == 0;
+  for (size_t i = 0; i < count; i++) {
+    intptr_t *obj_ptr = pointer_free ? gc->AllocAtomic(tag, NULL)
+                                     : gc->AllocTyped(tag, NULL);
+    memcpy(obj_ptr, fields + i * num_fields, sizeof(intptr_t) * num_fields);
+    HeaderLayout::ForEachPointerSlot(obj_ptr, tag,
+                                     [](intptr_t *slot) { *slot = 0; });
+    roots.Set(first + i, obj_ptr);
+  }
+}
+
+void RuntimeContext::Store(intptr_t *obj_ptr, int32_t field,
+                           intptr_t *value) {
+  leave_stack();
+  gc->WriteBarrier(obj_ptr + field, value);
+}
+
+intptr_t* RuntimeContext::Load(intptr_t *obj_ptr, int32_t field) {
+  leave_stack();
+  return gc->ReadBarrier(obj_ptr + field);
+}
+
+void RuntimeContext::leave_stack() {
+  // The stack of the last run is gone, only the external roots are left
+  gc->SetBaseFramePtr(NULL);
+}
+
+HeapRoots::HeapRoots(RuntimeContext &context, size_t num_roots)
+    : context(context), slots(num_roots, 0) {
+  if (context.Trace()) {
+    throw std::invalid_argument("Allocation traces only record the roots on "
+                                "the stack and cannot be recorded together "
+                                "with the roots of a host.");
+  }
+  context.GetGc().AddExternalRoots(slots.data(), slots.size());
+}
+
+HeapRoots::~HeapRoots() {
+  context.GetGc().RemoveExternalRoots(slots.data());
+}
+
+RuntimeContext* RuntimeContext::Current() {
+  return current_context;
+}
+
+intptr_t* RuntimeContext::BaseFramePtr() const {
+  return current_mutator->base_frame_ptr;
+}
+
+int32_t RuntimeContext::SpawnThread(L2SpawnedFunction function,
+                                    int32_t num_args, uint32_t arg_info,
+                                    const intptr_t *args) {
+  if (trace) {
+    // The roots of a trace come from the stack of one thread
+    std::cerr << "Threads cannot be spawned while an allocation trace is "
+                 "recorded\n";
+    abort();
+  }
+
+  std::unique_lock<std::mutex> lock(threads_lock);
+  Mutator *thread = new Mutator();
+  mutators.emplace_back(thread);
+
+  // The thread counts as stopped in its start frame until it runs, see
+  // thread_main. The frame is the only one of its stack, its saved frame
+  // pointer is the base frame pointer.
+  thread->start_frame.resize(kMaxSpawnArgs + 3);
+  intptr_t *frame_ptr = thread->start_frame.data() + kMaxSpawnArgs + 2;
+  frame_ptr[0] = 0;
+  frame_ptr[-1] = 0;
+  frame_ptr[-2] = arg_info;
+  for (int32_t i = 0; i < num_args; i++) frame_ptr[-3 - i] = args[i];
+  thread->stopped_frame_ptr = frame_ptr;
+
+  threaded = true;
+  thread->thread = std::thread(&RuntimeContext::thread_main, this, thread,
+                               function);
+  return mutators.size() - 1;
+}
+
+void RuntimeContext::thread_main(Mutator *self, L2SpawnedFunction function) {
+  current_context = this;
+  current_mutator = self;
+  jmp_buf abort;
+  if (setjmp(abort) != 0) {
+    // AbortOutOfMemory jumped over the frames of the function
+    finish_thread(self, 0, /*out_of_memory=*/true);
+    return;
+  }
+  self->abort = &abort;
+
+  // Once the thread runs, no collection happens before the function's
+  // frame holds the arguments.
+  intptr_t args[kMaxSpawnArgs];
+  {
+    std::unique_lock<std::mutex> lock(threads_lock);
+    resume_thread(self, lock);
+    // the function saves the frame pointer of this function
+    self->base_frame_ptr = (intptr_t*) __builtin_frame_address(0);
+    SetProfiledStack(self->base_frame_ptr);
+    for (int i = 0; i < kMaxSpawnArgs; i++) {
+      args[i] = self->start_frame[kMaxSpawnArgs - 1 - i];
+    }
+  }
+
+  int32_t result = function(args[0], args[1], args[2], args[3], args[4],
+                            args[5], args[6], args[7]);
+  finish_thread(self, result, /*out_of_memory=*/false);
+}
+
+void RuntimeContext::finish_thread(Mutator *self, int32_t result,
+                                   bool out_of_memory) {
+  std::unique_lock<std::mutex> lock(threads_lock);
+  self->finished = true;
+  self->out_of_memory = out_of_memory;
+  self->result = result;
+  num_running--;
+  threads_changed.notify_all();
+}
+
+int32_t RuntimeContext::JoinThread(int32_t handle, intptr_t *curr_frame_ptr) {
+  std::unique_lock<std::mutex> lock(threads_lock);
+  Mutator *self = current_mutator;
+  if (handle <= 0 || (size_t) handle >= mutators.size() ||
+      mutators[handle].get() == self) {
+    std::cerr << "Cannot join thread " << handle << "\n";
+    abort();
+  }
+
+  Mutator *thread = mutators[handle].get();
+  stop_thread(self, curr_frame_ptr);
+  threads_changed.wait(lock, [&] { return thread->finished; });
+  resume_thread(self, lock);
+
+  bool out_of_memory = thread->out_of_memory;
+  int32_t result = thread->result;
+  lock.unlock();
+  if (out_of_memory) AbortOutOfMemory();
+  return result;
+}
+
+bool RuntimeContext::end_threads() {
+  std::unique_lock<std::mutex> lock(threads_lock);
+  // The program's frames are gone, the stack of this thread is empty
+  stop_thread(mutators[0].get(), base_frame_ptr);
+  threads_changed.wait(lock, [&] { return num_running == 0; });
+  lock.unlock();
+
+  bool out_of_memory = false;
+  for (size_t i = 1; i < mutators.size(); i++) {
+    mutators[i]->thread.join();
+    out_of_memory = out_of_memory || mutators[i]->out_of_memory;
+  }
+  // The next run allocates without buffers
+  fill_buffers();
+  mutators.clear();
+  num_running = 0;
+  threaded = false;
+  return out_of_memory;
+}
+
+void RuntimeContext::fill_buffers() {
+  for (auto &thread : mutators) {
+    if (thread->buffer_ptr != NULL) {
+      gc->FillBuffer(thread->buffer_ptr, thread->buffer_end);
+    }
+  }
+}
+
+void RuntimeContext::stop_thread(Mutator *self, intptr_t *curr_frame_ptr) {
+  self->stopped_frame_ptr = curr_frame_ptr;
+  num_running--;
+  threads_changed.notify_all();
+}
+
+void RuntimeContext::resume_thread(Mutator *self,
+                                   std::unique_lock<std::mutex> &lock) {
+  threads_changed.wait(lock, [&] { return !world_stopped; });
+  self->stopped_frame_ptr = NULL;
+  num_running++;
+}
+
+void RuntimeContext::StopTheWorld(intptr_t *curr_frame_ptr,
+                                  const std::function<void()> &operation) {
+  std::unique_lock<std::mutex> lock(threads_lock);
+  Mutator *self = current_mutator;
+  stop_thread(self, curr_frame_ptr);
+  threads_changed.wait(lock, [&] { return !world_stopped; });
+  world_stopped = true;
+  __atomic_fetch_add(&safepoint_requested, 1, __ATOMIC_RELAXED);
+  threads_changed.wait(lock, [&] { return num_running == 0; });
+
+  // Every thread that has not ended is stopped now, in a safepoint, in the
+  // runtime or in its start frame
+  std::vector<Gc::ThreadStack> stacks;
+  for (auto &thread : mutators) {
+    if (thread.get() != self && !thread->finished) {
+      stacks.push_back({thread->stopped_frame_ptr, thread->base_frame_ptr});
+    }
+  }
+  gc->SetThreadStacks(std::move(stacks));
+  gc->SetBaseFramePtr(self->base_frame_ptr);
+  // A collection may walk the heap, buffers included
+  fill_buffers();
+  size_t num_collections = gc->Stats().num_collections;
+
+  operation();
+
+  gc->SetThreadStacks({});
+  gc->SetBaseFramePtr(base_frame_ptr);
+  if (gc->Stats().num_collections != num_collections) {
+    // the objects of the buffers may have moved, and their free space is
+    // part of the heap again
+    for (auto &thread : mutators) {
+      thread->buffer_ptr = thread->buffer_end = NULL;
+    }
+  }
+
+  __atomic_fetch_sub(&safepoint_requested, 1, __ATOMIC_RELAXED);
+  world_stopped = false;
+  threads_changed.notify_all();
+  resume_thread(self, lock);
+}
+
+void RuntimeContext::Safepoint(intptr_t *curr_frame_ptr) {
+  std::unique_lock<std::mutex> lock(threads_lock);
+  // Another context may be stopping its threads
+  if (!world_stopped) return;
+  stop_thread(current_mutator, curr_frame_ptr);
+  resume_thread(current_mutator, lock);
+}
+
+intptr_t* RuntimeContext::AllocFromBuffer(int32_t num_words,
+                                          intptr_t *curr_frame_ptr) {
+  Mutator *self = current_mutator;
+  if (self->buffer_end - self->buffer_ptr < num_words + 1) {
+    if (!buffers_supported) return NULL;
+
+    intptr_t *buffer = NULL;
+    int32_t buffer_words = kBufferWords;
+    bool out_of_memory = false;
+    StopTheWorld(curr_frame_ptr, [&] {
+      try {
+        buffer = gc->AllocBuffer(num_words + 1, &buffer_words, curr_frame_ptr);
+      } catch (OutOfMemoryError &) {
+        out_of_memory = true;
+      }
+    });
+    if (buffer == NULL) {
+      // the allocation without a buffer runs out of memory the usual way
+      if (!out_of_memory) buffers_supported = false;
+      return NULL;
+    }
+    // No other thread can stop the world before this one gets to a
+    // safepoint, the buffer is still valid
+    self->buffer_ptr = buffer;
+    self->buffer_end = buffer + buffer_words;
+  }
+
+  intptr_t *obj_ptr = self->buffer_ptr + 1;
+  self->buffer_ptr = self->buffer_ptr + num_words + 1;
+  return obj_ptr;
+}
+
+void RuntimeContext::flush_trace() {
+  if (trace && !trace->Flush()) {
+    std::cerr << "Failed to write the allocation trace\n";
+  }
+}
+
+void RuntimeContext::AbortOutOfMemory() {
+  // The frames of the compiled program have no unwind information, so an
+  // exception cannot be thrown through them.
+  longjmp(*current_mutator->abort, kAbortOutOfMemory);
+}
+
+void RuntimeContext::abort_stack_overflow() {
+  // Overflows in the collector or in a spawned thread leave state behind
+  // that the program's frames cannot be jumped over with
+  RuntimeContext *context = current_context;
+  if (context == NULL || Gc::InCollector() ||
+      current_mutator != context->mutators[0].get()) {
+    return;
+  }
+  longjmp(*current_mutator->abort, kAbortStackOverflow);
+}
+
+void SetHeapSnapshotPath(const std::string &path) {
+  snapshot_path = path;
+}
+
+// Allocates an object for 'allocate', 'allocate_typed', 'allocate_atomic' and
+// 'allocate_weak' with the collector: with Alloc if 'tag' is 0, with
+// AllocWeak if 'weak_bits' is not 0, with AllocAtomic if 'pointer_free' is
+// true, and with AllocTyped otherwise. 'site' is the return address into the
+// program, recorded in allocation traces. Returns NULL if the program ran out
+// of memory.
+static intptr_t *allocate_with_gc(RuntimeContext *context, int32_t num_words,
+                                  uint32_t tag, uint32_t weak_bits,
+                                  bool pointer_free, intptr_t *curr_frame_ptr,
+                                  void *site) {
+  // Snapshots requested by a signal are taken here, where the stack is in a
+  // known state.
+  SnapshotReason reason;
+  if (TakeHeapSnapshotRequest(&reason) && !snapshot_path.empty()) {
+    DumpHeapSnapshot(context, curr_frame_ptr, reason);
+  }
+
+  AllocTrace *trace = context->Trace();
+  size_t num_collections = trace ? context->Stats().num_collections : 0;
+
+  intptr_t *obj_ptr = NULL;
+  try {
+    if (tag == 0) {
+      obj_ptr = context->GetGc().Alloc(num_words, curr_frame_ptr);
+    } else if (weak_bits != 0) {
+      obj_ptr = context->GetGc().AllocWeak(tag, weak_bits, curr_frame_ptr);
+    } else if (pointer_free) {
+      obj_ptr = context->GetGc().AllocAtomic(tag, curr_frame_ptr);
+    } else {
+      obj_ptr = context->GetGc().AllocTyped(tag, curr_frame_ptr);
+    }
+  } catch (OutOfMemoryError &) {
+    // handled below, outside of the handler, since the jump out of the
+    // program must not skip the end of the handler
+  }
+
+  if (trace && obj_ptr != NULL) {
+    trace->RecordAlloc(obj_ptr, num_words, tag, site, context->BaseFramePtr(),
+                       curr_frame_ptr,
+                       context->Stats().num_collections != num_collections);
+  }
+
+  if (obj_ptr == NULL && !snapshot_path.empty()) {
+    DumpHeapSnapshot(context, curr_frame_ptr, SnapshotReason::OutOfMemory);
+  }
+  return obj_ptr;
+}
+
+// Allocates an object with allocate_with_gc, or from the allocation buffer
+// of the calling thread if the program has threads. Leaves the program if it
+// ran out of memory.
+static intptr_t *allocate_object(int32_t num_words, uint32_t tag,
+                                 uint32_t weak_bits, bool pointer_free,
+                                 intptr_t *curr_frame_ptr, void *site) {
+  RuntimeContext *context = current_context;
+  intptr_t *obj_ptr = NULL;
+
+  if (!context->Threaded()) {
+    obj_ptr = allocate_with_gc(context, num_words, tag, weak_bits,
+                               pointer_free, curr_frame_ptr, site);
+  } else {
+    // The collector keeps a list of the objects with weak fields
+    if (weak_bits == 0) {
+      obj_ptr = context->AllocFromBuffer(num_words, curr_frame_ptr);
+    }
+    if (obj_ptr != NULL) {
+      *(obj_ptr - 1) =
+          tag != 0 ? tag : HeaderLayout::ProvisionalHeader(num_words);
+    } else {
+      context->StopTheWorld(curr_frame_ptr, [&] {
+        obj_ptr = allocate_with_gc(context, num_words, tag, weak_bits,
+                                   pointer_free, curr_frame_ptr, site);
+      });
+    }
+  }
+
+  if (obj_ptr == NULL) context->AbortOutOfMemory();
+  return obj_ptr;
+}
+
+// Define the 'allocate' function without name mangling so that it can be called
+// from L2 code.
+extern "C" intptr_t *allocate(int32_t num_words) {
+  // The current frame pointer is for allocate(), which is called from
+  // the L2 program so we dereference the frame pointer once to get
+  // the L2 program's frame pointer.
+  intptr_t* curr_frame_ptr = *(intptr_t**)__builtin_frame_address(0);
+  return allocate_object(num_words, 0, 0, /*pointer_free=*/false,
+                         curr_frame_ptr, __builtin_return_address(0));
+}
+
+// Called by the L2 code to allocate a struct whose header word is 'tag'. The
+// collector stores the tag, or leaves the header out.
+extern "C" intptr_t *allocate_typed(uint32_t tag) {
+  intptr_t* curr_frame_ptr = *(intptr_t**)__builtin_frame_address(0);
+  return allocate_object(tag >> 24, tag, 0, /*pointer_free=*/false,
+                         curr_frame_ptr, __builtin_return_address(0));
+}
+
+// Called by the L2 code instead of allocate_typed for the structs without
+// pointer fields.
+extern "C" intptr_t *allocate_atomic(uint32_t tag) {
+  intptr_t* curr_frame_ptr = *(intptr_t**)__builtin_frame_address(0);
+  return allocate_object(tag >> 24, tag, 0, /*pointer_free=*/true,
+                         curr_frame_ptr, __builtin_return_address(0));
+}
+
+// Called by the L2 code instead of allocate_typed for the structs with weak
+// fields, which are set in 'weak_bits' and left out of 'tag'.
+extern "C" intptr_t *allocate_weak(uint32_t tag, uint32_t weak_bits) {
+  intptr_t* curr_frame_ptr = *(intptr_t**)__builtin_frame_address(0);
+  return allocate_object(tag >> 24, tag, weak_bits, /*pointer_free=*/false,
+                         curr_frame_ptr, __builtin_return_address(0));
+}
+
+// Identifies the program that calls checkpoint() and continues at 'resume'
+// in heap images.
+static uint32_t image_program_id(void *resume) {
+  return (uint32_t) ((uintptr_t) resume - (uintptr_t) &allocate_typed);
+}
+
+// Called by the L2 code after the declarations of the main block of a
+// program that calls checkpoint(), with the address of the code after the
+// call and the number of locals of the block. Returns 1 if it restored the
+// heap image of the context, in which case the program goes on at 'resume',
+// and 0 otherwise.
+extern "C" int32_t heap_image_restore(void *resume, int32_t num_locals) {
+  RuntimeContext *context = current_context;
+  const std::string &path = context->ImagePath();
+  if (path.empty()) return 0;
+
+  intptr_t* curr_frame_ptr = *(intptr_t**)__builtin_frame_address(0);
+  switch (RestoreHeapImage(path, context->GetGc(), curr_frame_ptr,
+                           num_locals, image_program_id(resume))) {
+    case ImageRestore::Restored:
+      return 1;
+    case ImageRestore::Missing:
+      break;
+    case ImageRestore::Invalid:
+      std::cerr << "Ignoring the heap image " << path
+                << ", it was written by another program\n";
+      break;
+    case ImageRestore::DoesNotFit:
+      std::cerr << "Ignoring the heap image " << path
+                << ", it does not fit in the heap\n";
+      break;
+  }
+  return 0;
+}
+
+// Called by the L2 code for checkpoint(), with the same arguments as
+// heap_image_restore. Writes the heap image of the context, if it has one,
+// and returns 0.
+extern "C" int32_t heap_image_save(void *resume, int32_t num_locals) {
+  RuntimeContext *context = current_context;
+  const std::string &path = context->ImagePath();
+  if (path.empty()) return 0;
+
+  intptr_t* curr_frame_ptr = *(intptr_t**)__builtin_frame_address(0);
+  bool written = false;
+  auto write = [&] {
+    written = WriteHeapImage(path, context->GetGc(), curr_frame_ptr,
+                             num_locals, image_program_id(resume));
+  };
+  if (context->Threaded()) {
+    context->StopTheWorld(curr_frame_ptr, write);
+  } else {
+    write();
+  }
+  if (written) {
+    std::cerr << "Heap image written to " << path << "\n";
+  } else {
+    std::cerr << "Failed to write the heap image to " << path << "\n";
+  }
+  return 0;
+}
+
+// Called by the L2 code to load a pointer from the heap field at 'slot' while
+// an incremental collection is running anywhere in the process.
+extern "C" intptr_t *read_barrier(intptr_t *slot) {
+  RuntimeContext *context = current_context;
+  if (!context->Threaded()) return context->GetGc().ReadBarrier(slot);
+
+  intptr_t *value = NULL;
+  intptr_t* curr_frame_ptr = *(intptr_t**)__builtin_frame_address(0);
+  context->StopTheWorld(curr_frame_ptr, [&] {
+    value = context->GetGc().ReadBarrier(slot);
+  });
+  return value;
+}
+
+// Called by the L2 code to store a pointer into the heap field at 'slot' while
+// a reference-counting collector is in use or a trace is recorded anywhere in
+// the process.
+extern "C" void write_barrier(intptr_t *slot, intptr_t *value) {
+  RuntimeContext *context = current_context;
+  if (AllocTrace *trace = context->Trace()) trace->RecordStore(slot, value);
+  if (!context->Threaded()) {
+    context->GetGc().WriteBarrier(slot, value);
+    return;
+  }
+
+  intptr_t* curr_frame_ptr = *(intptr_t**)__builtin_frame_address(0);
+  context->StopTheWorld(curr_frame_ptr, [&] {
+    context->GetGc().WriteBarrier(slot, value);
+  });
+}
+
+// Called by the L2 code for 'spawn f(a1, ..., an)', with 'arg_info' the
+// argument info word of f and the arguments of the call after it. Returns
+// the handle of the new thread.
+extern "C" int32_t spawn_thread(void *function, int32_t num_args,
+                                uint32_t arg_info, ...) {
+  intptr_t args[kMaxSpawnArgs] = {0};
+  va_list ap;
+  va_start(ap, arg_info);
+  for (int32_t i = 0; i < num_args && i < kMaxSpawnArgs; i++) {
+    args[i] = va_arg(ap, intptr_t);
+  }
+  va_end(ap);
+  return current_context->SpawnThread((L2SpawnedFunction) function, num_args,
+                                      arg_info, args);
+}
+
+// Called by the L2 code for 'join t'. Waits for the thread 't' to finish and
+// returns the result of its function.
+extern "C" int32_t join_thread(int32_t thread) {
+  intptr_t* curr_frame_ptr = *(intptr_t**)__builtin_frame_address(0);
+  return current_context->JoinThread(thread, curr_frame_ptr);
+}
+
+// Called by the L2 code at loop back-edges and function entries while
+// 'safepoint_requested' is set, to stop for a collection.
+extern "C" void safepoint() {
+  intptr_t* curr_frame_ptr = *(intptr_t**)__builtin_frame_address(0);
+  current_context->Safepoint(curr_frame_ptr);
+}
@@ -0,0 +1,298 @@
+#pragma once
+
+#include "alloc_trace.h"
+#include "gc.h"
+#include "perf_counters.h"
+#include "program_stack.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <csetjmp>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runtime contexts let one process run many L2 programs, one after the other
+// or at the same time on different threads. Every context owns a collector
+// with its own heap and statistics, and remembers where the stack of the
+// program it runs ends. The allocation functions the compiled programs call,
+// such as 'allocate_typed', find the context of the program running on the
+// calling thread through a thread-local pointer.
+//
+// A host links runtime.o, gc.o, heap_snapshot.o, heap_image.o,
+// alloc_trace.o, profiler.o, perf_counters.o and program_stack.o with the
+// compiled programs, compiled with distinct entry names through c1's
+// '--entry' option, and defines ReportGCStats.
+// bootstrap.cpp is the host that runs a single program named 'Entry'.
+//
+// A program can run functions on threads of their own with 'spawn'. The
+// threads share the heap of the context. Each one carves its objects out of
+// a thread-local allocation buffer if the collector hands them out (see
+// Gc::AllocBuffer). Every other call into the collector stops the world:
+// the calling thread waits until the others reach a safepoint, which the
+// compiled programs poll at the start of every function body and at every
+// loop back-edge, or block in the runtime, and the collector walks the
+// stacks of all of them.
+
+// Entry point of a compiled L2 program.
+typedef int32_t (*L2EntryPoint)(void);
+
+// A compiled L2 function started by 'spawn'. Functions with fewer
+// parameters ignore the extra arguments, which the cdecl convention has the
+// caller pop.
+const int kMaxSpawnArgs = 8;  // see kMaxSpawnArgs in backend/codegen.h
+typedef int32_t (*L2SpawnedFunction)(intptr_t, intptr_t, intptr_t, intptr_t,
+                                     intptr_t, intptr_t, intptr_t, intptr_t);
+
+// A compiled L2 function called by a host with RuntimeContext::Run. c1
+// exports every function 'f' of a program as '<entry>_f', where <entry> is
+// the name of the program's entry point. Called like L2SpawnedFunction.
+typedef L2SpawnedFunction L2ExportedFunction;
+
+class HeapRoots;
+
+// Number of contexts in the process that are stopping the threads of their
+// program. The compiled programs call 'safepoint' at their safepoints while
+// it is not zero.
+extern "C" int32_t safepoint_requested;
+
+// Options for creating a runtime context.
+struct RuntimeOptions {
+  // "marksweep", "semispace", "refcount", "bibop" or "hybrid"
+  std::string collector = "marksweep";
+  // Number of words in the heap, a positive even number
+  int heap_size_in_words = 0;
+  // Back the heap with huge pages when the system has them
+  bool huge_pages = false;
+  // Number of threads that mark and sweep, for the mark-sweep collector
+  int gc_threads = 1;
+  // Sweep in a background thread while the program runs, for the mark-sweep
+  // collector
+  bool concurrent_sweep = false;
+  // Collect the objects allocated since the last collection separately, for
+  // the mark-sweep collector
+  bool generational = false;
+  // Copy incrementally, scanning at most this many words per allocation, for
+  // the semispace collector. 0 copies everything in one pause.
+  int incremental_scan_words = 0;
+  // Record an allocation trace of the programs run by the context to this
+  // file, see alloc_trace.h. Empty for no trace.
+  std::string trace_path;
+  // Record the roots at least every this many allocated words in the trace
+  int trace_roots_interval_words = 64;
+  // Heap image of the programs run by the context, see heap_image.h. A run
+  // restores it if it exists and writes it otherwise. Empty for no image.
+  std::string image_path;
+  // Count cycles, instructions, cache misses and TLB misses of the program
+  // and of the collector separately, see perf_counters.h
+  bool perf_counters = false;
+  // Run the programs on a stack of this many bytes that the context
+  // reserves, see program_stack.h. 0 runs them on the stack of the thread
+  // that calls Run.
+  size_t stack_size_bytes = 0;
+};
+
+// The state of one execution of an L2 program.
+class RuntimeContext {
+ public:
+  // Creates the collector described by 'options'. Throws
+  // std::invalid_argument if the collector is unknown, or if a trace is
+  // requested for a collector that moves objects or together with a heap
+  // image, and std::runtime_error if the trace file cannot be created or the
+  // stack cannot be reserved.
+  explicit RuntimeContext(const RuntimeOptions &options);
+
+  RuntimeContext(const RuntimeContext&) = delete;
+  RuntimeContext& operator=(const RuntimeContext&) = delete;
+
+  // Runs 'entry' on the calling thread with this context installed and
+  // returns its result. Throws OutOfMemoryError if the program runs out of
+  // memory, or StackOverflowError if it runs out of the stack of the
+  // context, after unwinding the program's frames. A context runs one program
+  // at a time, but it can run several programs one after the other; objects
+  // left by earlier runs are garbage to later ones.
+  int32_t Run(L2EntryPoint entry);
+  // Runs the exported L2 function 'function' like Run runs an entry, with
+  // 'args' as its arguments. Pointer arguments are usually read from
+  // HeapRoots right before the call. Throws std::invalid_argument if there
+  // are more than kMaxSpawnArgs arguments.
+  int32_t Run(L2ExportedFunction function, const std::vector<intptr_t> &args);
+
+  // The functions below let a host build data structures for its programs
+  // in the heap. They must not be called while a program of the context
+  // runs.
+
+  // Allocates 'count' objects of the struct type whose header word is 'tag'
+  // (see TypeInfo::tag) and stores them in 'roots' from 'first' on. The
+  // fields of the objects are copied from 'fields', those of the first
+  // object followed by those of the second and so on, except for the
+  // pointer fields, which are set to nil; Store sets them. Throws
+  // OutOfMemoryError if the heap runs out, with the objects allocated until
+  // then in 'roots'.
+  void AllocObjects(uint32_t tag, size_t count, const intptr_t *fields,
+                    HeapRoots &roots, size_t first = 0);
+  // Stores 'value' in the pointer field 'field' of 'obj_ptr' through the
+  // collector's write barrier.
+  void Store(intptr_t *obj_ptr, int32_t field, intptr_t *value);
+  // Returns the pointer in the field 'field' of 'obj_ptr', through the
+  // collector's read barrier.
+  intptr_t* Load(intptr_t *obj_ptr, int32_t field);
+
+  Gc& GetGc() { return *gc; }
+  // The allocation trace being recorded, NULL if none.
+  AllocTrace* Trace() { return trace.get(); }
+  // Path of the heap image, empty if none.
+  const std::string& ImagePath() const { return image_path; }
+  const GcStats& Stats() const { return gc->Stats(); }
+  // The counters of the runs, NULL unless the options asked for them
+  const PerfCounters* Counters() const { return perf_counters.get(); }
+  // Bytes of the stack the programs run on, 0 if they run on the caller's
+  size_t StackSize() const { return stack ? stack->Size() : 0; }
+
+  // Frame pointer of the frame right below the first L2 frame of the
+  // calling thread: the program's entry, or the function of a spawned thread.
+  intptr_t* BaseFramePtr() const;
+
+  // Starts 'function' on a new thread with the 'num_args' arguments 'args',
+  // of which the ones set in 'arg_info' are pointers, and returns the handle
+  // of the thread.
+  int32_t SpawnThread(L2SpawnedFunction function, int32_t num_args,
+                      uint32_t arg_info, const intptr_t *args);
+  // Waits for the thread 'handle' to end and returns the result of its
+  // function. Leaves the program like AbortOutOfMemory if the thread ran out
+  // of memory. 'curr_frame_ptr' is the innermost L2 frame of the caller.
+  int32_t JoinThread(int32_t handle, intptr_t *curr_frame_ptr);
+  // Whether the running program has started threads. Stays true until Run
+  // returns.
+  bool Threaded() const { return threaded.load(std::memory_order_relaxed); }
+
+  // Runs 'operation' while the other threads of the program are stopped and
+  // the collector walks their stacks along with the caller's, whose
+  // innermost L2 frame is 'curr_frame_ptr'. Gives up the allocation buffers
+  // of the threads if the operation collects.
+  void StopTheWorld(intptr_t *curr_frame_ptr,
+                    const std::function<void()> &operation);
+  // Called at the safepoints of the program. Waits there while another
+  // thread has the world stopped.
+  void Safepoint(intptr_t *curr_frame_ptr);
+  // Allocates an object of 'num_words' words from the allocation buffer of
+  // the calling thread, with the header word left to the caller. Gets a new
+  // buffer if it is full. Returns NULL if the collector does not hand out
+  // buffers or has no room for one.
+  intptr_t* AllocFromBuffer(int32_t num_words, intptr_t *curr_frame_ptr);
+
+  // Context of the program running on the calling thread, NULL if none.
+  static RuntimeContext* Current();
+
+  // Leaves the running program and makes Run throw OutOfMemoryError. Must be
+  // called on the thread running the program, from code called by it.
+  [[noreturn]] void AbortOutOfMemory();
+
+ private:
+  // Before the collector, which tells it about its pauses until it is gone
+  std::unique_ptr<PerfCounters> perf_counters;
+  std::unique_ptr<Gc> gc;
+  std::unique_ptr<AllocTrace> trace;
+  std::string image_path;
+  // The stack the programs run on, NULL for the caller's
+  std::unique_ptr<ProgramStack> stack;
+  intptr_t *base_frame_ptr = NULL;
+
+  // A thread running the program: the one that called Run, or one started
+  // by SpawnThread
+  struct Mutator {
+    std::thread thread;
+    // Frame pointer of the frame right below the thread's first L2 frame
+    intptr_t *base_frame_ptr = NULL;
+    // Innermost L2 frame while the thread is stopped, NULL while it runs
+    intptr_t *stopped_frame_ptr = NULL;
+    // The part of the allocation buffer that is still free
+    intptr_t *buffer_ptr = NULL, *buffer_end = NULL;
+    // Where AbortOutOfMemory returns to
+    jmp_buf *abort = NULL;
+    // Until the thread starts, a frame laid out like an L2 frame whose
+    // locals are the arguments of its function, so that collections keep
+    // them up to date
+    std::vector<intptr_t> start_frame;
+    bool finished = false;
+    bool out_of_memory = false;
+    int32_t result = 0;
+  };
+  // The first one is the thread that called Run. Guarded by threads_lock.
+  std::vector<std::unique_ptr<Mutator>> mutators;
+  std::mutex threads_lock;
+  // Signalled when a thread stops, resumes or ends
+  std::condition_variable threads_changed;
+  // Threads running L2 code, the others are stopped or ended
+  int num_running = 0;
+  // Whether a thread is running an operation of StopTheWorld
+  bool world_stopped = false;
+  std::atomic<bool> threaded{false};
+  // Cleared once the collector returns no allocation buffer
+  std::atomic<bool> buffers_supported{true};
+  // The thread of the running program that is the calling thread
+  static thread_local Mutator *current_mutator;
+
+  // Writes the records of the trace buffered during a run.
+  void flush_trace();
+  // Body of Run, on the stack the program runs on. Calls 'function' with
+  // kMaxSpawnArgs arguments from 'args'.
+  int32_t run_program(L2ExportedFunction function, const intptr_t *args);
+  // Called before the collector is used outside of runs, where no stack
+  // is to be walked
+  void leave_stack();
+  // Called by the stack when the program overflows it. Leaves the program
+  // like AbortOutOfMemory if the overflow happened in the program's thread
+  // outside of the collector.
+  static void abort_stack_overflow();
+
+  // Body of a spawned thread
+  void thread_main(Mutator *self, L2SpawnedFunction function);
+  // Records that 'self' ended with 'result'.
+  void finish_thread(Mutator *self, int32_t result, bool out_of_memory);
+  // Called by Run once the program is done. Waits for the spawned threads
+  // to end and forgets them. Returns true if one of them ran out of memory.
+  bool end_threads();
+  // Has the collector fill the unallocated part of the buffers of all
+  // threads, see Gc::FillBuffer. Called while no thread runs.
+  void fill_buffers();
+  // Marks 'self' stopped at its frame 'curr_frame_ptr', and marks it running
+  // again once no thread has the world stopped. Called with threads_lock
+  // held.
+  void stop_thread(Mutator *self, intptr_t *curr_frame_ptr);
+  void resume_thread(Mutator *self, std::unique_lock<std::mutex> &lock);
+};
+
+// Pointers to objects held by a host, such as the data it passes to its
+// programs. The collector of the context treats them as roots and updates
+// them when it moves their objects, while programs run and in between.
+// Objects only reachable from the roots do not show in heap snapshots or
+// heap images.
+class HeapRoots {
+ public:
+  // Creates 'num_roots' roots of 'context', all nil. Throws
+  // std::invalid_argument if the context records an allocation trace, whose
+  // roots come from the stack only.
+  HeapRoots(RuntimeContext &context, size_t num_roots);
+  ~HeapRoots();
+
+  HeapRoots(const HeapRoots&) = delete;
+  HeapRoots& operator=(const HeapRoots&) = delete;
+
+  size_t Size() const { return slots.size(); }
+  intptr_t* Get(size_t i) const { return (intptr_t*) slots[i]; }
+  void Set(size_t i, intptr_t *obj_ptr) { slots[i] = (intptr_t) obj_ptr; }
+
+ private:
+  RuntimeContext &context;
+  std::vector<intptr_t> slots;
+};
+
+// Enables heap snapshots, written to 'path' when a program runs out of memory
+// and at the next allocation after RequestHeapSnapshot. Later snapshots get a
+// sequence number appended. An empty path disables them, which is the
+// default.
+void SetHeapSnapshotPath(const std::string &path);
@@ -0,0 +1,688 @@
+// Offline simulator for allocation traces recorded by the L2 runtime (see
+// alloc_trace.h). It replays a trace once to find out when every object
+// becomes unreachable, then runs models of the collectors' policies on the
+// allocation sequence for every heap size under study and prints how many
+// collections each would run, how many words they would trace and copy, and
+// how fragmented the mark-sweep heap would get.
+//
+// Death times are computed as in the Merlin algorithm: every object is
+// stamped with the last event at which it was known to be reachable (its
+// allocation, a roots record that refers to it, or a store into it, of it, or
+// over it), and the stamps of unreachable objects are propagated to the
+// unreachable objects they point to. Since the stack is only recorded by roots
+// records, an object counts as dead from the first roots record after its
+// stamp, which errs on the side of keeping objects alive.
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "alloc_trace.h"
+
+namespace {
+
+const uint64_t kNever = UINT64_MAX;
+const uint32_t kNil = UINT32_MAX;
+
+// The objects of a trace in allocation order. Times are given by the clock of
+// the collectors, the number of words allocated so far, headers included.
+struct Objects {
+  std::vector<uint32_t> numWords, sites;
+  // Clock when the object was allocated, and from which it is dead, kNever if
+  // it is still reachable at the end of the trace
+  std::vector<uint64_t> allocClock, death;
+  uint64_t totalWords = 0;
+};
+
+// Summary of the trace itself.
+struct TraceInfo {
+  uint32_t wordBytes = 0, heapWords = 0, rootsInterval = 0;
+  size_t numStores = 0, numRootsRecords = 0, numCollections = 0;
+  // Stores into fields and of pointers the replay could not match to an
+  // object, which means the trace is damaged
+  size_t numUnmatched = 0;
+};
+
+// Replays the records of a trace on a copy of its object graph and computes
+// the death times.
+class Replay {
+ public:
+  Replay(Objects & objects, TraceInfo & info) : objects(objects), info(info) {}
+
+  void alloc(uint32_t address, uint32_t numFields, uint32_t tag,
+             uint32_t site) {
+    // the object reuses the memory of objects that are dead by now
+    for (uint32_t i = 0; i <= numFields; ++i) {
+      byAddress.erase(address + i * info.wordBytes);
+    }
+    uint32_t id = objects.numWords.size();
+    byAddress[address] = id;
+    addresses.push_back(address);
+
+    objects.numWords.push_back(numFields + 1);
+    objects.sites.push_back(site);
+    objects.allocClock.push_back(clock);
+    objects.death.push_back(kNever);
+    tags.push_back(tag);
+    firstField.push_back(fields.size());
+    fields.insert(fields.end(), numFields, kNil);
+    stamps.push_back(event++);
+    marks.push_back(0);
+    alive.push_back(id);
+
+    clock += numFields + 1;
+    objects.totalWords = clock;
+  }
+
+  void store(uint32_t slot, uint32_t value) {
+    ++info.numStores;
+    uint32_t target = value == 0 ? kNil : find(value);
+    // the object the field belongs to is the closest one below it
+    uint32_t id = kNil, field = 0;
+    for (; field < 255 && id == kNil; ++field) {
+      id = find(slot - field * info.wordBytes);
+    }
+    --field;
+    if (id == kNil || field >= objects.numWords[id] - 1 ||
+        (value != 0 && target == kNil)) {
+      ++info.numUnmatched;
+      return;
+    }
+
+    // the object stored into, the one stored and the one overwritten are all
+    // reachable by the program at this point
+    uint32_t & slotId = fields[firstField[id] + field];
+    stamps[id] = event;
+    if (slotId != kNil) stamps[slotId] = event;
+    if (target != kNil) stamps[target] = event;
+    slotId = target;
+    ++event;
+  }
+
+  void roots(const uint32_t * addresses, size_t n) {
+    ++info.numRootsRecords;
+    lastRoots.clear();
+    for (size_t i = 0; i < n; ++i) {
+      uint32_t id = find(addresses[i]);
+      if (id == kNil) {
+        ++info.numUnmatched;
+        continue;
+      }
+      stamps[id] = event;
+      lastRoots.push_back(id);
+    }
+    rootsEvents.push_back(event++);
+    rootsClocks.push_back(clock);
+
+    // Tracing costs as much as the live data, so it is only done once the
+    // program has allocated that much since the last time.
+    if (clock - lastTraceClock >= std::max<uint64_t>(liveWords,
+                                                     info.rootsInterval)) {
+      findDeadObjects();
+    }
+  }
+
+  // Finds the objects that are unreachable from the last roots record.
+  void finish() {
+    findDeadObjects();
+  }
+
+ private:
+  Objects & objects;
+  TraceInfo & info;
+
+  uint64_t clock = 0, event = 0;
+  // Objects by address, and the object graph: the ids of the objects the
+  // fields of every object point to
+  std::unordered_map<uint32_t, uint32_t> byAddress;
+  std::vector<uint32_t> addresses, tags;
+  std::vector<uint64_t> firstField;
+  std::vector<uint32_t> fields;
+  // Last event at which every object was known to be reachable
+  std::vector<uint64_t> stamps;
+  // Objects without a death time, and the roots of the last roots record
+  std::vector<uint32_t> alive, lastRoots;
+  std::vector<uint64_t> rootsEvents, rootsClocks;
+  std::vector<uint32_t> marks;
+  uint32_t markEpoch = 0;
+  uint64_t lastTraceClock = 0, liveWords = 0;
+
+  uint32_t find(uint32_t address) {
+    auto it = byAddress.find(address);
+    return it == byAddress.end() ? kNil : it->second;
+  }
+
+  template <typename F>
+  void forEachChild(uint32_t id, F f) {
+    uint32_t bitmap = (tags[id] << 8) >> 9;
+    const uint32_t * field = &fields[firstField[id]];
+    for (uint32_t i = 0; i + 1 < objects.numWords[id] && bitmap != 0;
+         ++i, bitmap >>= 1) {
+      if ((bitmap & 1) && field[i] != kNil) f(field[i]);
+    }
+  }
+
+  void findDeadObjects() {
+    lastTraceClock = clock;
+    ++markEpoch;
+    uint32_t deadEpoch = ++markEpoch;
+    uint32_t liveEpoch = deadEpoch - 1;
+
+    std::vector<uint32_t> stack(lastRoots);
+    for (uint32_t id : stack) marks[id] = liveEpoch;
+    while (!stack.empty()) {
+      uint32_t id = stack.back();
+      stack.pop_back();
+      forEachChild(id, [&](uint32_t child) {
+        if (marks[child] != liveEpoch) {
+          marks[child] = liveEpoch;
+          stack.push_back(child);
+        }
+      });
+    }
+
+    std::vector<uint32_t> dead;
+    size_t numAlive = 0;
+    liveWords = 0;
+    for (uint32_t id : alive) {
+      if (marks[id] == liveEpoch) {
+        alive[numAlive++] = id;
+        liveWords += objects.numWords[id];
+      } else {
+        marks[id] = deadEpoch;
+        dead.push_back(id);
+        // no later record can refer to the object
+        auto it = byAddress.find(addresses[id]);
+        if (it != byAddress.end() && it->second == id) byAddress.erase(it);
+      }
+    }
+    alive.resize(numAlive);
+
+    // An unreachable object was reachable at least as long as the
+    // unreachable objects that point to it. Handling the latest stamps first
+    // reaches every object with its final stamp the first time.
+    std::sort(dead.begin(), dead.end(), [&](uint32_t a, uint32_t b) {
+      return stamps[a] > stamps[b];
+    });
+    for (uint32_t id : dead) {
+      if (marks[id] != deadEpoch) continue;
+      marks[id] = 0;
+      stack.push_back(id);
+      while (!stack.empty()) {
+        uint32_t obj = stack.back();
+        stack.pop_back();
+        auto next = std::upper_bound(rootsEvents.begin(), rootsEvents.end(),
+                                     stamps[obj]);
+        objects.death[obj] = next == rootsEvents.end()
+            ? kNever : rootsClocks[next - rootsEvents.begin()];
+        forEachChild(obj, [&](uint32_t child) {
+          if (marks[child] == deadEpoch) {
+            marks[child] = 0;
+            stamps[child] = std::max(stamps[child], stamps[obj]);
+            stack.push_back(child);
+          }
+        });
+      }
+    }
+  }
+};
+
+bool loadTrace(const char * fileName, Objects & objects, TraceInfo & info) {
+  std::ifstream in{fileName, std::ios::binary | std::ios::ate};
+  if (!in) return false;
+  std::vector<uint32_t> words(size_t(in.tellg()) / 4);
+  in.seekg(0);
+  if (!in.read(reinterpret_cast<char*>(words.data()), words.size() * 4) ||
+      words.size() < 5 || words[0] != kAllocTraceMagic ||
+      words[1] != kAllocTraceVersion || (words[2] != 4 && words[2] != 8)) {
+    return false;
+  }
+  info.wordBytes = words[2];
+  info.heapWords = words[3];
+  info.rootsInterval = words[4];
+
+  Replay replay{objects, info};
+  for (size_t i = 5; i < words.size();) {
+    uint32_t kind = words[i];
+    size_t left = words.size() - i - 1;
+    const uint32_t * record = &words[i + 1];
+    switch (TraceRecord(kind & 0xff)) {
+      case TraceRecord::Alloc:
+        if (left < 3) return false;
+        replay.alloc(record[0], kind >> 8, record[1], record[2]);
+        i += 4;
+        break;
+      case TraceRecord::Store:
+        if (left < 2) return false;
+        replay.store(record[0], record[1]);
+        i += 3;
+        break;
+      case TraceRecord::Roots:
+        if (left < 1 || left - 1 < record[0]) return false;
+        if (RootsReason(kind >> 8) == RootsReason::Collection) {
+          ++info.numCollections;
+        }
+        replay.roots(record + 1, record[0]);
+        i += 2 + record[0];
+        break;
+      default:
+        return false;
+    }
+  }
+  replay.finish();
+  return true;
+}
+
+// Number of words of the objects allocated before 'clock' that are still
+// alive at 'clock'.
+class LiveWords {
+ public:
+  explicit LiveWords(const Objects & objects) {
+    std::vector<std::pair<uint64_t, uint32_t>> deaths;
+    for (size_t id = 0; id < objects.death.size(); ++id) {
+      if (objects.death[id] != kNever) {
+        deaths.push_back({objects.death[id], objects.numWords[id]});
+      }
+    }
+    std::sort(deaths.begin(), deaths.end());
+    uint64_t dead = 0;
+    for (auto & [clock, words] : deaths) {
+      dead += words;
+      clocks.push_back(clock);
+      deadWords.push_back(dead);
+    }
+  }
+
+  uint64_t at(uint64_t clock) const {
+    size_t n = std::upper_bound(clocks.begin(), clocks.end(), clock) -
+               clocks.begin();
+    return clock - (n == 0 ? 0 : deadWords[n - 1]);
+  }
+
+ private:
+  std::vector<uint64_t> clocks, deadWords;
+};
+
+struct Result {
+  size_t collections = 0;
+  uint64_t tracedWords = 0, copiedWords = 0;
+  // Fragmentation of the free memory after each collection: 1 - largest
+  // free block / free words
+  double fragmentationSum = 0, fragmentationMax = 0;
+  // Clock of the allocation that ran out of memory, and whether there were
+  // enough free words for it
+  uint64_t outOfMemory = kNever;
+  bool fragmented = false;
+};
+
+// A collector policy that decides when to collect and where objects go.
+// Models see the objects in allocation order.
+class PolicyModel {
+ public:
+  PolicyModel(const Objects & objects, const LiveWords & live,
+              uint32_t heapWords)
+      : objects(objects), live(live), heapWords(heapWords) {}
+  virtual ~PolicyModel() {}
+
+  virtual const char * name() const = 0;
+
+  // Allocates object 'id', collecting first if the policy says so. Returns
+  // false and records the failure in the result if the heap is exhausted.
+  virtual bool alloc(uint32_t id) = 0;
+
+  uint32_t heapSize() const { return heapWords; }
+  const Result & result() const { return stats; }
+
+ protected:
+  const Objects & objects;
+  const LiveWords & live;
+  uint32_t heapWords;
+  Result stats;
+};
+
+// GcSemiSpace: collects when the object does not fit in what is left of the
+// current semispace, and copies the live objects to the other one.
+class SemiSpaceModel : public PolicyModel {
+ public:
+  SemiSpaceModel(const Objects & objects, const LiveWords & live,
+                 uint32_t heapWords)
+      : PolicyModel(objects, live, heapWords), freeWords(heapWords / 2) {}
+
+  const char * name() const override { return "semispace"; }
+
+  bool alloc(uint32_t id) override {
+    int64_t size = objects.numWords[id];
+    if (size > freeWords) {
+      uint64_t clock = objects.allocClock[id];
+      uint64_t liveWords = live.at(clock);
+      ++stats.collections;
+      stats.tracedWords += liveWords;
+      stats.copiedWords += liveWords;
+      freeWords = int64_t(heapWords / 2) - int64_t(liveWords);
+      if (size > freeWords) {
+        stats.outOfMemory = clock;
+        return false;
+      }
+    }
+    freeWords -= size;
+    return true;
+  }
+
+ private:
+  int64_t freeWords;
+};
+
+// GcMarkSweep: allocates from the end of the first free block in address
+// order that is large enough, and when there is none collects, turning the
+// memory between the surviving objects into free blocks.
+class MarkSweepModel : public PolicyModel {
+ public:
+  MarkSweepModel(const Objects & objects, const LiveWords & live,
+                 uint32_t heapWords)
+      : PolicyModel(objects, live, heapWords) {
+    blocks.push_back({0, heapWords});
+    buildTree();
+  }
+
+  const char * name() const override { return "marksweep"; }
+
+  bool alloc(uint32_t id) override {
+    uint32_t size = objects.numWords[id];
+    int64_t block = firstFit(size);
+    if (block < 0) {
+      collect(objects.allocClock[id]);
+      block = firstFit(size);
+      if (block < 0) {
+        stats.outOfMemory = objects.allocClock[id];
+        stats.fragmented = freeWords >= size;
+        return false;
+      }
+    }
+
+    // cut the object from the end of the block, a leftover of a single word
+    // cannot be used until the next collection
+    Block & b = blocks[block];
+    b.size -= size;
+    fresh.push_back({b.start + b.size, id});
+    freshBlocks.push_back(block);
+    freeWords -= size;
+    update(block, b.size < 2 ? 0 : b.size);
+    return true;
+  }
+
+ private:
+  struct Block {
+    uint32_t start, size;
+  };
+  std::vector<Block> blocks;
+  // Largest block size in every subtree of a segment tree over 'blocks'
+  std::vector<uint32_t> tree;
+  size_t leaves = 1;
+  uint64_t freeWords = 0;
+  // Objects by address after the last collection, and the objects allocated
+  // since then with the blocks they were cut from
+  std::vector<std::pair<uint32_t, uint32_t>> placed, fresh;
+  std::vector<uint32_t> freshBlocks;
+
+  void buildTree() {
+    leaves = 1;
+    while (leaves < blocks.size()) leaves *= 2;
+    tree.assign(2 * leaves, 0);
+    freeWords = 0;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      freeWords += blocks[i].size;
+      tree[leaves + i] = blocks[i].size < 2 ? 0 : blocks[i].size;
+    }
+    for (size_t i = leaves - 1; i > 0; --i) {
+      tree[i] = std::max(tree[2 * i], tree[2 * i + 1]);
+    }
+  }
+
+  void update(size_t block, uint32_t size) {
+    size_t i = leaves + block;
+    tree[i] = size;
+    for (i /= 2; i > 0; i /= 2) {
+      tree[i] = std::max(tree[2 * i], tree[2 * i + 1]);
+    }
+  }
+
+  int64_t firstFit(uint32_t size) const {
+    if (tree[1] < size) return -1;
+    size_t i = 1;
+    while (i < leaves) i = tree[2 * i] >= size ? 2 * i : 2 * i + 1;
+    return i - leaves;
+  }
+
+  void collect(uint64_t clock) {
+    ++stats.collections;
+    stats.tracedWords += live.at(clock);
+
+    // The objects cut from a block have decreasing addresses and the blocks
+    // are in address order, so sorting the new objects by block and
+    // reversing the order within each block sorts them by address.
+    std::vector<size_t> bucket(blocks.size() + 1, 0);
+    for (uint32_t block : freshBlocks) ++bucket[block + 1];
+    for (size_t i = 1; i < bucket.size(); ++i) bucket[i] += bucket[i - 1];
+    std::vector<std::pair<uint32_t, uint32_t>> sorted(fresh.size());
+    for (size_t i = fresh.size(); i-- > 0;) {
+      sorted[bucket[freshBlocks[i]]++] = fresh[i];
+    }
+    std::vector<std::pair<uint32_t, uint32_t>> all;
+    all.reserve(placed.size() + fresh.size());
+    std::merge(placed.begin(), placed.end(), sorted.begin(), sorted.end(),
+               std::back_inserter(all));
+    fresh.clear();
+    freshBlocks.clear();
+    placed.clear();
+    for (auto & object : all) {
+      if (objects.death[object.second] > clock) placed.push_back(object);
+    }
+
+    blocks.clear();
+    uint32_t end = 0, largest = 0;
+    for (auto & [start, id] : placed) {
+      if (start > end) blocks.push_back({end, start - end});
+      end = start + objects.numWords[id];
+    }
+    if (heapWords > end) blocks.push_back({end, heapWords - end});
+    buildTree();
+
+    for (auto & b : blocks) largest = std::max(largest, b.size);
+    double fragmentation = freeWords == 0 ? 0 : 1 - double(largest) / freeWords;
+    stats.fragmentationSum += fragmentation;
+    stats.fragmentationMax = std::max(stats.fragmentationMax,
+                                        fragmentation);
+  }
+};
+
+std::unique_ptr<PolicyModel> makeModel(const std::string & collector,
+                                       const Objects & objects,
+                                       const LiveWords & live,
+                                       uint32_t heapWords) {
+  if (collector == "semispace") {
+    return std::make_unique<SemiSpaceModel>(objects, live, heapWords);
+  } else if (collector == "marksweep") {
+    return std::make_unique<MarkSweepModel>(objects, live, heapWords);
+  }
+  return nullptr;
+}
+
+std::vector<std::string> split(const std::string & list) {
+  std::vector<std::string> items;
+  std::istringstream in{list};
+  for (std::string item; std::getline(in, item, ',');) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+void usage(char const * programName) {
+  std::cerr << "Usage: " << programName
+            << " trace-file [--collector semispace,marksweep]\n"
+               "          [--heap WORDS,...] [--factor F,...] [--sites N]\n\n"
+            << "Simulates the collectors on the allocation trace for every "
+               "given heap size, in words or as multiples of the peak live "
+               "size (default 1.25,1.5,2,3,4,6,8), and prints their number "
+               "of collections, traced and copied words and fragmentation. "
+               "With `--sites`, also prints the N allocation sites that "
+               "allocate the most.\n";
+}
+
+}  // namespace
+
+int main(int argc, char * argv[]) {
+  const char * traceFileName = nullptr;
+  std::vector<std::string> collectors = {"semispace", "marksweep"};
+  std::vector<uint64_t> heapSizes;
+  std::vector<double> factors;
+  size_t topSites = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--collector" && i + 1 < argc) {
+      collectors = split(argv[++i]);
+    } else if (arg == "--heap" && i + 1 < argc) {
+      for (auto & size : split(argv[++i])) {
+        heapSizes.push_back(std::stoull(size));
+      }
+    } else if (arg == "--factor" && i + 1 < argc) {
+      for (auto & factor : split(argv[++i])) {
+        factors.push_back(std::stod(factor));
+      }
+    } else if (arg == "--sites" && i + 1 < argc) {
+      topSites = std::stoul(argv[++i]);
+    } else if (!traceFileName) {
+      traceFileName = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!traceFileName) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  Objects objects;
+  TraceInfo info;
+  if (!loadTrace(traceFileName, objects, info)) {
+    std::cerr << "'" << traceFileName << "' is not a valid allocation trace\n";
+    return 1;
+  }
+  LiveWords live{objects};
+
+  uint64_t peakLive = 0;
+  for (size_t id = 0; id < objects.numWords.size(); ++id) {
+    peakLive = std::max(peakLive, live.at(objects.allocClock[id] +
+                                          objects.numWords[id]));
+  }
+  if (heapSizes.empty() && factors.empty()) {
+    factors = {1.25, 1.5, 2, 3, 4, 6, 8};
+  }
+  for (double factor : factors) {
+    heapSizes.push_back(uint64_t(peakLive * factor + 1) & ~uint64_t(1));
+  }
+
+  std::cout << "Trace of " << objects.numWords.size() << " objects, "
+            << objects.totalWords << " words, " << info.numStores
+            << " stores, " << info.numRootsRecords << " roots records\n"
+            << "Recorded with a heap of " << info.heapWords << " words and "
+            << info.numCollections << " collections\n"
+            << "Peak live size " << peakLive << " words\n";
+  if (info.numUnmatched > 0) {
+    std::cout << "Warning: " << info.numUnmatched
+              << " pointers did not match any object\n";
+  }
+
+  if (topSites > 0) {
+    struct SiteStats {
+      uint32_t site;
+      uint64_t objects = 0, words = 0, survivors = 0, lifetime = 0;
+    };
+    std::unordered_map<uint32_t, SiteStats> bySite;
+    for (size_t id = 0; id < objects.numWords.size(); ++id) {
+      auto & stats = bySite[objects.sites[id]];
+      stats.site = objects.sites[id];
+      ++stats.objects;
+      stats.words += objects.numWords[id];
+      if (objects.death[id] == kNever) {
+        ++stats.survivors;
+      } else {
+        stats.lifetime += objects.death[id] - objects.allocClock[id];
+      }
+    }
+    std::vector<SiteStats> sites;
+    for (auto & [site, stats] : bySite) sites.push_back(stats);
+    std::sort(sites.begin(), sites.end(), [](auto & a, auto & b) {
+      return a.words > b.words;
+    });
+    std::cout << "\nTop allocation sites (lifetimes in allocated words):\n"
+              << std::setw(12) << "words" << std::setw(10) << "objects"
+              << std::setw(14) << "avg_lifetime" << std::setw(10)
+              << "survivors" << "  return address\n";
+    for (size_t i = 0; i < sites.size() && i < topSites; ++i) {
+      auto & s = sites[i];
+      uint64_t died = s.objects - s.survivors;
+      std::cout << std::setw(12) << s.words << std::setw(10) << s.objects
+                << std::setw(14) << (died == 0 ? 0 : s.lifetime / died)
+                << std::setw(10) << s.survivors << "  0x" << std::hex
+                << s.site << std::dec << "\n";
+    }
+  }
+
+  std::vector<std::unique_ptr<PolicyModel>> models;
+  for (auto & collector : collectors) {
+    for (uint64_t heapWords : heapSizes) {
+      auto model = makeModel(collector, objects, live, heapWords);
+      if (!model) {
+        std::cerr << "Unknown collector '" << collector << "'\n";
+        return 1;
+      }
+      models.push_back(std::move(model));
+    }
+  }
+
+  // The models are independent, they are spread over all cores.
+  size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads && t < models.size(); ++t) {
+    threads.emplace_back([&, t] {
+      for (size_t m = t; m < models.size(); m += numThreads) {
+        for (uint32_t id = 0; id < objects.numWords.size(); ++id) {
+          if (!models[m]->alloc(id)) break;
+        }
+      }
+    });
+  }
+  for (auto & thread : threads) thread.join();
+
+  std::cout << "\n" << std::left << std::setw(11) << "collector"
+            << std::right << std::setw(12) << "heap_words" << std::setw(8)
+            << "gcs" << std::setw(14) << "traced_words" << std::setw(14)
+            << "copied_words" << std::setw(10) << "avg_frag" << std::setw(10)
+            << "max_frag" << "  result\n";
+  for (auto & model : models) {
+    const Result & r = model->result();
+    std::cout << std::left << std::setw(11) << model->name() << std::right
+              << std::setw(12) << model->heapSize() << std::setw(8)
+              << r.collections << std::setw(14) << r.tracedWords
+              << std::setw(14) << r.copiedWords << std::fixed
+              << std::setprecision(3) << std::setw(10)
+              << (r.collections == 0 ? 0 : r.fragmentationSum / r.collections)
+              << std::setw(10) << r.fragmentationMax << "  ";
+    if (r.outOfMemory == kNever) {
+      std::cout << "ok\n";
+    } else {
+      std::cout << (r.fragmented ? "fragmented" : "out of memory")
+                << " after " << r.outOfMemory << " words\n";
+    }
+  }
+  return 0;
+}
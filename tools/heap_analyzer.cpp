@@ -0,0 +1,428 @@
+// Offline analyzer for heap snapshots written by the L2 runtime (see
+// heap_snapshot.h). It computes the dominator tree of the object graph and
+// prints the struct types, roots and objects that retain the most memory.
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "heap_snapshot.h"
+#include "frontend/lexer.h"
+#include "frontend/parser.h"
+#include "backend/codegen.h"
+
+namespace {
+
+const char *reasonToString(uint32_t reason) {
+  switch (reason) {
+    case (uint32_t) SnapshotReason::Request: return "request";
+    case (uint32_t) SnapshotReason::OutOfMemory: return "out of memory";
+    case (uint32_t) SnapshotReason::Signal: return "signal";
+    default: return "unknown";
+  }
+}
+
+struct Snapshot {
+  uint32_t reason;
+  // return address and thread of each frame
+  std::vector<uint32_t> frames, threads;
+  // tag and edge count of each object
+  std::vector<uint32_t> tags, numEdges;
+  std::vector<uint32_t> edges;
+  // frame index, slot offset and object id of each root
+  std::vector<uint32_t> roots;
+};
+
+bool readWords(std::ifstream & in, std::vector<uint32_t> & words, size_t n) {
+  words.resize(n);
+  return n == 0 || in.read(reinterpret_cast<char*>(words.data()), n * 4);
+}
+
+bool loadSnapshot(const char * fileName, Snapshot & snapshot) {
+  std::ifstream in{fileName, std::ios::binary};
+  uint32_t header[7];
+  if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+      header[0] != kHeapSnapshotMagic || header[1] != kHeapSnapshotVersion) {
+    return false;
+  }
+  snapshot.reason = header[2];
+
+  std::vector<uint32_t> frameWords, objectWords;
+  if (!readWords(in, frameWords, 2 * size_t(header[3])) ||
+      !readWords(in, objectWords, 2 * size_t(header[4])) ||
+      !readWords(in, snapshot.edges, header[5]) ||
+      !readWords(in, snapshot.roots, 3 * size_t(header[6]))) {
+    return false;
+  }
+
+  snapshot.frames.resize(header[3]);
+  snapshot.threads.resize(header[3]);
+  for (size_t i = 0; i < header[3]; ++i) {
+    snapshot.frames[i] = frameWords[2 * i];
+    snapshot.threads[i] = frameWords[2 * i + 1];
+  }
+
+  snapshot.tags.resize(header[4]);
+  snapshot.numEdges.resize(header[4]);
+  for (size_t i = 0; i < header[4]; ++i) {
+    snapshot.tags[i] = objectWords[2 * i];
+    snapshot.numEdges[i] = objectWords[2 * i + 1];
+  }
+  return true;
+}
+
+// The object graph extended with a node for every frame and a single root
+// node above the frames, in compressed sparse row form.
+struct Graph {
+  uint32_t numNodes;
+  uint32_t firstObject;
+  std::vector<uint32_t> succStart, succ;
+  std::vector<uint32_t> predStart, pred;
+};
+
+Graph buildGraph(const Snapshot & snapshot) {
+  Graph g;
+  uint32_t numFrames = snapshot.frames.size();
+  g.firstObject = 1 + numFrames;
+  g.numNodes = g.firstObject + snapshot.tags.size();
+
+  // edges of the root and frame nodes come first
+  std::vector<std::pair<uint32_t, uint32_t>> extra;
+  for (uint32_t f = 0; f < numFrames; ++f) {
+    extra.push_back({0, 1 + f});
+  }
+  for (size_t r = 0; r < snapshot.roots.size(); r += 3) {
+    extra.push_back({1 + snapshot.roots[r], g.firstObject + snapshot.roots[r + 2]});
+  }
+
+  g.succStart.assign(g.numNodes + 1, 0);
+  for (auto & [from, _] : extra) {
+    ++g.succStart[from + 1];
+  }
+  for (size_t i = 0; i < snapshot.tags.size(); ++i) {
+    g.succStart[g.firstObject + i + 1] = snapshot.numEdges[i];
+  }
+  for (uint32_t v = 0; v < g.numNodes; ++v) {
+    g.succStart[v + 1] += g.succStart[v];
+  }
+
+  // 'extra' is sorted by source node, so it fills the frame rows in order
+  g.succ.resize(g.succStart[g.numNodes]);
+  size_t next = 0;
+  for (auto & [_, to] : extra) {
+    g.succ[next++] = to;
+  }
+  for (auto target : snapshot.edges) {
+    g.succ[next++] = g.firstObject + target;
+  }
+
+  g.predStart.assign(g.numNodes + 1, 0);
+  for (auto to : g.succ) {
+    ++g.predStart[to + 1];
+  }
+  for (uint32_t v = 0; v < g.numNodes; ++v) {
+    g.predStart[v + 1] += g.predStart[v];
+  }
+  g.pred.resize(g.succ.size());
+  std::vector<uint32_t> fill(g.predStart.begin(), g.predStart.end() - 1);
+  for (uint32_t v = 0; v < g.numNodes; ++v) {
+    for (uint32_t e = g.succStart[v]; e < g.succStart[v + 1]; ++e) {
+      g.pred[fill[g.succ[e]]++] = v;
+    }
+  }
+  return g;
+}
+
+// Computes immediate dominators with the Lengauer-Tarjan algorithm using path
+// compression. Every node is reachable from node 0 by construction. All
+// traversals are iterative so deep object chains do not overflow the stack.
+// Returns the preorder of the nodes in 'order' and the immediate dominator of
+// each node (the root is its own dominator).
+std::vector<uint32_t> dominators(const Graph & g, std::vector<uint32_t> & order) {
+  const uint32_t none = UINT32_MAX;
+  uint32_t n = g.numNodes;
+  // all per-node arrays below are indexed by preorder number
+  std::vector<uint32_t> number(n, none), parent(n), semi(n), label(n),
+      ancestor(n, none), idom(n), bucketHead(n, none), bucketNext(n, none);
+
+  // iterative depth-first search that numbers the nodes in preorder
+  order.clear();
+  order.reserve(n);
+  std::vector<std::pair<uint32_t, uint32_t>> stack{{0, g.succStart[0]}};
+  number[0] = 0;
+  order.push_back(0);
+  parent[0] = 0;
+  while (!stack.empty()) {
+    auto & [v, e] = stack.back();
+    if (e == g.succStart[v + 1]) {
+      stack.pop_back();
+      continue;
+    }
+    uint32_t w = g.succ[e++];
+    if (number[w] == none) {
+      number[w] = order.size();
+      parent[number[w]] = number[v];
+      order.push_back(w);
+      stack.push_back({w, g.succStart[w]});
+    }
+  }
+
+  for (uint32_t i = 0; i < n; ++i) {
+    semi[i] = label[i] = i;
+  }
+
+  std::vector<uint32_t> path;
+  auto eval = [&](uint32_t v) {
+    if (ancestor[v] == none) return v;
+    // compress the path from v to the root of its tree in the forest
+    path.clear();
+    for (uint32_t u = v; ancestor[ancestor[u]] != none; u = ancestor[u]) {
+      path.push_back(u);
+    }
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+      uint32_t u = *it;
+      if (semi[label[ancestor[u]]] < semi[label[u]]) {
+        label[u] = label[ancestor[u]];
+      }
+      ancestor[u] = ancestor[ancestor[u]];
+    }
+    return label[v];
+  };
+
+  for (uint32_t w = n - 1; w > 0; --w) {
+    uint32_t node = order[w];
+    for (uint32_t e = g.predStart[node]; e < g.predStart[node + 1]; ++e) {
+      uint32_t u = eval(number[g.pred[e]]);
+      semi[w] = std::min(semi[w], semi[u]);
+    }
+    bucketNext[w] = bucketHead[semi[w]];
+    bucketHead[semi[w]] = w;
+    ancestor[w] = parent[w];
+
+    uint32_t p = parent[w];
+    for (uint32_t v = bucketHead[p]; v != none; v = bucketNext[v]) {
+      uint32_t u = eval(v);
+      idom[v] = semi[u] < semi[v] ? u : p;
+    }
+    bucketHead[p] = none;
+  }
+
+  for (uint32_t w = 1; w < n; ++w) {
+    if (idom[w] != semi[w]) idom[w] = idom[idom[w]];
+  }
+  idom[0] = 0;
+  return idom;
+}
+
+// Maps header words to struct names using the type definitions of the
+// program the snapshot was taken from.
+std::map<uint32_t, std::string> typeNames(const char * programFileName) {
+  std::map<uint32_t, std::string> names;
+  std::ifstream programFile{programFileName};
+  if (!programFile.is_open()) {
+    std::cerr << "Cannot open '" << programFileName << "'\n";
+    return names;
+  }
+  std::string programText{std::istreambuf_iterator<char>(programFile),
+                          std::istreambuf_iterator<char>()};
+  auto tokens = cs160::frontend::Lexer().tokenize(programText);
+  auto ast = cs160::frontend::Parser(tokens).parse();
+
+  for (auto & def : ast->type_defs()) {
+    std::vector<std::pair<std::string, std::string>> fields;
+    for (auto & decl : def.fields()) {
+      fields.push_back({decl.id().name(), decl.type().name()});
+    }
+    cs160::backend::TypeInfo info{def.type_name(), std::move(fields)};
+    // structs with the same layout share a header word
+    auto & name = names[info.tag()];
+    name += (name.empty() ? "" : "|") + def.type_name();
+  }
+  return names;
+}
+
+void usage(char const * programName) {
+  std::cerr << "Usage: " << programName
+            << " snapshot-file [--program program.l2] [--top N]\n\n"
+            << "Prints the struct types, stack frames and objects that retain "
+               "the most heap memory in the given heap snapshot. With "
+               "`--program`, header words are shown as struct names.\n";
+}
+
+}  // namespace
+
+int main(int argc, char * argv[]) {
+  const char * snapshotFileName = nullptr;
+  const char * programFileName = nullptr;
+  size_t top = 10;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--program" && i + 1 < argc) {
+      programFileName = argv[++i];
+    } else if (arg == "--top" && i + 1 < argc) {
+      top = std::stoul(argv[++i]);
+    } else if (!snapshotFileName) {
+      snapshotFileName = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!snapshotFileName) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  Snapshot snapshot;
+  if (!loadSnapshot(snapshotFileName, snapshot)) {
+    std::cerr << "'" << snapshotFileName << "' is not a valid heap snapshot\n";
+    return 1;
+  }
+
+  std::map<uint32_t, std::string> names;
+  if (programFileName) names = typeNames(programFileName);
+  auto typeName = [&](uint32_t tag) {
+    auto name = names.find(tag);
+    if (name != names.end()) return name->second;
+    std::ostringstream s;
+    s << "<" << (tag >> 24) << " fields, ptrs 0x" << std::hex
+      << ((tag >> 1) & 0x7fffff) << ">";
+    return s.str();
+  };
+
+  Graph g = buildGraph(snapshot);
+  std::vector<uint32_t> order;
+  auto idom = dominators(g, order);
+  uint32_t n = g.numNodes;
+
+  // retained sizes in words, indexed by preorder number
+  std::vector<uint64_t> retained(n, 0);
+  uint64_t totalWords = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    if (order[i] >= g.firstObject) {
+      retained[i] = (snapshot.tags[order[i] - g.firstObject] >> 24) + 1;
+      totalWords += retained[i];
+    }
+  }
+  for (uint32_t i = n - 1; i > 0; --i) {
+    retained[idom[i]] += retained[i];
+  }
+
+  // Per-type retained sizes only count objects that are not dominated by
+  // another object of the same type, otherwise each node of a list would be
+  // counted once for every node in front of it.
+  std::map<uint32_t, uint32_t> typeIds;
+  std::vector<uint32_t> typeOf(n, UINT32_MAX);
+  for (uint32_t i = 0; i < n; ++i) {
+    if (order[i] >= g.firstObject) {
+      typeOf[i] = typeIds.emplace(snapshot.tags[order[i] - g.firstObject],
+                                  typeIds.size()).first->second;
+    }
+  }
+  struct TypeStats {
+    uint32_t tag;
+    uint64_t count = 0, shallow = 0, retained = 0;
+  };
+  std::vector<TypeStats> types(typeIds.size());
+  for (auto & [tag, id] : typeIds) {
+    types[id].tag = tag;
+  }
+
+  // children of each node in the dominator tree
+  std::vector<uint32_t> childStart(n + 1, 0), children(n - 1);
+  for (uint32_t i = 1; i < n; ++i) {
+    ++childStart[idom[i] + 1];
+  }
+  for (uint32_t i = 0; i < n; ++i) {
+    childStart[i + 1] += childStart[i];
+  }
+  std::vector<uint32_t> fill(childStart.begin(), childStart.end() - 1);
+  for (uint32_t i = 1; i < n; ++i) {
+    children[fill[idom[i]]++] = i;
+  }
+
+  // walk the dominator tree keeping count of how many objects of each type
+  // are on the path from the root
+  std::vector<uint32_t> active(types.size(), 0);
+  std::vector<std::pair<uint32_t, uint32_t>> stack{{0, childStart[0]}};
+  while (!stack.empty()) {
+    auto & [v, next] = stack.back();
+    if (next == childStart[v + 1]) {
+      if (typeOf[v] != UINT32_MAX) --active[typeOf[v]];
+      stack.pop_back();
+      continue;
+    }
+    uint32_t w = children[next++];
+    if (typeOf[w] != UINT32_MAX) {
+      auto & stats = types[typeOf[w]];
+      ++stats.count;
+      stats.shallow += (stats.tag >> 24) + 1;
+      if (active[typeOf[w]]++ == 0) stats.retained += retained[w];
+    }
+    stack.push_back({w, childStart[w]});
+  }
+
+  std::cout << "Heap snapshot taken on " << reasonToString(snapshot.reason)
+            << ": " << snapshot.frames.size() << " frames, "
+            << snapshot.roots.size() / 3 << " roots, " << snapshot.tags.size()
+            << " objects, " << totalWords << " words, "
+            << snapshot.edges.size() << " edges\n\n";
+
+  std::sort(types.begin(), types.end(), [](auto & a, auto & b) {
+    return a.retained > b.retained;
+  });
+  std::cout << "Top retainers by type:\n"
+            << std::setw(12) << "retained" << std::setw(12) << "shallow"
+            << std::setw(10) << "count" << "  type\n";
+  for (size_t i = 0; i < types.size() && i < top; ++i) {
+    std::cout << std::setw(12) << types[i].retained << std::setw(12)
+              << types[i].shallow << std::setw(10) << types[i].count << "  "
+              << typeName(types[i].tag) << "\n";
+  }
+
+  // frames are numbered 1..numFrames in the graph
+  std::vector<uint32_t> frameNodes, objectNodes;
+  for (uint32_t i = 1; i < n; ++i) {
+    (order[i] < g.firstObject ? frameNodes : objectNodes).push_back(i);
+  }
+  auto byRetained = [&](uint32_t a, uint32_t b) {
+    return retained[a] > retained[b];
+  };
+
+  std::sort(frameNodes.begin(), frameNodes.end(), byRetained);
+  std::cout << "\nTop retaining frames (innermost first in every thread, "
+            << "thread 0 took the snapshot):\n"
+            << std::setw(12) << "retained" << std::setw(8) << "thread"
+            << "  frame\n";
+  for (size_t i = 0; i < frameNodes.size() && i < top; ++i) {
+    uint32_t frame = order[frameNodes[i]] - 1;
+    std::cout << std::setw(12) << retained[frameNodes[i]];
+    if (snapshot.threads[frame] == kSnapshotHostThread) {
+      std::cout << std::setw(8) << "host" << "  #" << frame << " roots\n";
+      continue;
+    }
+    std::cout << std::setw(8) << snapshot.threads[frame] << "  #" << frame
+              << " return address 0x" << std::hex << snapshot.frames[frame]
+              << std::dec << "\n";
+  }
+
+  size_t shown = std::min(top, objectNodes.size());
+  std::partial_sort(objectNodes.begin(), objectNodes.begin() + shown,
+                    objectNodes.end(), byRetained);
+  std::cout << "\nTop retaining objects:\n"
+            << std::setw(12) << "retained" << std::setw(10) << "object"
+            << "  type\n";
+  for (size_t i = 0; i < shown; ++i) {
+    uint32_t id = order[objectNodes[i]] - g.firstObject;
+    std::cout << std::setw(12) << retained[objectNodes[i]] << std::setw(10)
+              << id << "  " << typeName(snapshot.tags[id]) << "\n";
+  }
+
+  return 0;
+}